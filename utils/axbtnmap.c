@@ -19,9 +19,14 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/utsname.h>
 
 #include <linux/input.h>
 #include <linux/joystick.h>
@@ -34,17 +39,83 @@
 #define JSIOCGBTNMAP_LARGE _IOR('j', 0x34, __u16[KEY_MAX_LARGE - BTN_MISC + 1])
 #define JSIOCGBTNMAP_SMALL _IOR('j', 0x34, __u16[KEY_MAX_SMALL - BTN_MISC + 1])
 
-int determine_ioctl(int fd, int *ioctls, int *ioctl_used, void *argp)
+/* The button map ioctl which works with the running kernel is kept here,
+   with the kernel's release, so that it's only probed once per kernel
+   rather than by every run. */
+#define BTNMAP_CACHE_DIR "/var/cache/joystick"
+#define BTNMAP_CACHE BTNMAP_CACHE_DIR "/btnmap-ioctl"
+
+/* The variants to try: as compiled against, then both sizes */
+#define VARIANTS 3
+
+static const unsigned long jsiocgbtnmap[VARIANTS] = {
+	JSIOCGBTNMAP, JSIOCGBTNMAP_LARGE, JSIOCGBTNMAP_SMALL
+};
+static const unsigned long jsiocsbtnmap[VARIANTS] = {
+	JSIOCSBTNMAP, JSIOCSBTNMAP_LARGE, JSIOCSBTNMAP_SMALL
+};
+
+static int variant = -1;	/* until known */
+static int cache_writable;
+
+static void load_variant(void)
+{
+	static int loaded;
+	struct utsname u;
+	char release[sizeof(u.release)];
+	FILE *f;
+	int v;
+
+	if (loaded++ || uname(&u) || !(f = fopen(BTNMAP_CACHE, "r")))
+		return;
+
+	if (fscanf(f, "%64s %d", release, &v) == 2 &&
+	    !strcmp(release, u.release) && v >= 0 && v < VARIANTS)
+		variant = v;
+
+	fclose(f);
+}
+
+/* Nobody minds if this fails; the next run will probe again */
+static void save_variant(void)
 {
-	int i, retval = 0;
+	struct utsname u;
+	FILE *f;
+
+	if (!cache_writable || uname(&u))
+		return;
+
+	mkdir(BTNMAP_CACHE_DIR, 0755);
+	if (!(f = fopen(BTNMAP_CACHE ".new", "w")))
+		return;
+	fprintf(f, "%s %d\n", u.release, variant);
+	if (fclose(f) || rename(BTNMAP_CACHE ".new", BTNMAP_CACHE))
+		unlink(BTNMAP_CACHE ".new");
+}
+
+static int btnmap_ioctl(int fd, const unsigned long *ioctls, void *argp)
+{
+	int i, retval = -1;
+
+	load_variant();
+	if (variant >= 0) {
+		/* We already know which ioctl to use, unless the cache is
+		   stale (another driver, a kernel rebuilt with the same
+		   release); then it's probed and saved afresh. */
+		if ((retval = ioctl(fd, ioctls[variant], argp)) >= 0 ||
+		    (errno != EINVAL && errno != ENOTTY))
+			return retval;
+		variant = -1;
+	}
 
 	/* Try each ioctl in turn. */
-	for (i = 0; ioctls[i]; i++) {
+	for (i = 0; i < VARIANTS; i++) {
 		if ((retval = ioctl(fd, ioctls[i], argp)) >= 0) {
 			/* The ioctl did something. */
-			*ioctl_used = ioctls[i];
+			variant = i;
+			save_variant();
 			return retval;
-		} else if (errno != -EINVAL) {
+		} else if (errno != EINVAL && errno != ENOTTY) {
 			/* Some other error occurred. */
 			return retval;
 		}
@@ -52,30 +123,19 @@ int determine_ioctl(int fd, int *ioctls, int *ioctl_used, void *argp)
 	return retval;
 }
 
+void setbtnmapcache(int writable)
+{
+	cache_writable = writable;
+}
+
 int getbtnmap(int fd, uint16_t *btnmap)
 {
-	static int jsiocgbtnmap = 0;
-	int ioctls[] = { JSIOCGBTNMAP, JSIOCGBTNMAP_LARGE, JSIOCGBTNMAP_SMALL, 0 };
-
-	if (jsiocgbtnmap != 0) {
-		/* We already know which ioctl to use. */
-		return ioctl(fd, jsiocgbtnmap, btnmap);
-	} else {
-		return determine_ioctl(fd, ioctls, &jsiocgbtnmap, btnmap);
-	}
+	return btnmap_ioctl(fd, jsiocgbtnmap, btnmap);
 }
 
 int setbtnmap(int fd, uint16_t *btnmap)
 {
-	static int jsiocsbtnmap = 0;
-	int ioctls[] = { JSIOCSBTNMAP, JSIOCSBTNMAP_LARGE, JSIOCSBTNMAP_SMALL, 0 };
-
-	if (jsiocsbtnmap != 0) {
-		/* We already know which ioctl to use. */
-		return ioctl(fd, jsiocsbtnmap, btnmap);
-	} else {
-		return determine_ioctl(fd, ioctls, &jsiocsbtnmap, btnmap);
-	}
+	return btnmap_ioctl(fd, jsiocsbtnmap, btnmap);
 }
 
 int getaxmap(int fd, uint8_t *axmap)
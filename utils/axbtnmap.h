@@ -53,9 +53,16 @@ int setaxmap(int fd, uint8_t *axmap);
    contain at least BTNMAP_SIZE elements. Returns the result of the
    ioctl(): negative in case of an error, 0 otherwise for kernels up
    to 2.6.30, the length of the array actually copied for later
-   kernels. */
+   kernels. Which of the ioctl's variants the running kernel takes is
+   probed once, and looked up for that kernel version in
+   /var/cache/joystick; it is probed again if that one fails. */
 int getbtnmap(int fd, uint16_t *btnmap);
 
+/* Lets the button map ioctl variant probed be saved in
+   /var/cache/joystick. Only jscal, which sets joysticks up, does; the
+   other tools just read what it saved. */
+void setbtnmapcache(int writable);
+
 /* Uses the given array as the button map. The array must contain at
    least BTNMAP_SIZE elements. Returns the result of the ioctl():
    negative in case of an error, 0 otherwise. */
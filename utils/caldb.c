@@ -0,0 +1,515 @@
+/*
+ * Joystick calibration database.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "caldb.h"
+
+/* Slots in a new database */
+#define CALDB_SLOTS	32
+
+/* Each slot holds two copies of a record */
+#define SLOT_SIZE	(2 * CALDB_PAGE)
+#define SLOT_OFFSET(i)	(CALDB_PAGE + (off_t)(i) * SLOT_SIZE)
+
+/* A record is its sequence number (0 if never written), a checksum of
+   the rest, the hash of its key, the key and the value: the mappings
+   and the correction, each terminated by a NUL. */
+#define REC_SEQ		0
+#define REC_CHECK	4
+#define REC_HASH	8
+#define REC_KEY		12
+#define REC_VALUE	(REC_KEY + CALDB_KEY)
+
+struct slot {
+	unsigned char copy[2][CALDB_PAGE];
+	int newest;		/* valid copy with the highest sequence, or -1 */
+	uint32_t seq;
+};
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/* FNV-1a, for both the keys and the checksums */
+static uint32_t fnv(const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	uint32_t h = 2166136261u;
+
+	while (n--) {
+		h ^= *p++;
+		h *= 16777619u;
+	}
+
+	return h;
+}
+
+/* Joysticks known by name or USB codes are found wherever they are
+   plugged; the others only under the same kernel name. */
+static void make_key(const struct caldb_ident *id, char *key)
+{
+	memset(key, 0, CALDB_KEY);
+
+	if (!*id->name && !*id->vendor)
+		snprintf(key, CALDB_KEY, "D%s", id->kernel);
+	else
+		snprintf(key, CALDB_KEY, "N%s\037%s\037%s\037%s", id->name,
+			 id->serial, id->vendor, id->product);
+}
+
+/* Reads a sysfs attribute, without its newline; empty if missing */
+static void read_attr(const char *dir, const char *attr, char *buf,
+		      size_t size)
+{
+	char path[PATH_MAX];
+	FILE *f;
+
+	*buf = 0;
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	if (!(f = fopen(path, "r")))
+		return;
+	if (!fgets(buf, size, f))
+		*buf = 0;
+	buf[strcspn(buf, "\n")] = 0;
+	fclose(f);
+}
+
+void caldb_ident(int fd, const char *path, struct caldb_ident *id)
+{
+	char link[64], dir[PATH_MAX];
+	struct stat st;
+	const char *base;
+	char *p;
+
+	memset(id, 0, sizeof(*id));
+	base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	snprintf(id->kernel, sizeof(id->kernel), "%s", base);
+
+	if (fstat(fd, &st) || !S_ISCHR(st.st_mode))
+		return;
+	snprintf(link, sizeof(link), "/sys/dev/char/%u:%u",
+		 major(st.st_rdev), minor(st.st_rdev));
+	if (!realpath(link, dir))
+		return;
+
+	/* The joystick's parent is the input device, with the name */
+	p = strrchr(dir, '/');
+	snprintf(id->kernel, sizeof(id->kernel), "%s", p + 1);
+	*p = 0;
+	read_attr(dir, "name", id->name, sizeof(id->name));
+	read_attr(dir, "serial", id->serial, sizeof(id->serial));
+
+	/* The closest USB device above it has the codes */
+	while ((p = strrchr(dir, '/')) && p > dir + strlen("/sys/devices")) {
+		*p = 0;
+		read_attr(dir, "idVendor", id->vendor, sizeof(id->vendor));
+		if (*id->vendor) {
+			read_attr(dir, "idProduct", id->product, sizeof(id->product));
+			break;
+		}
+	}
+}
+
+/* Read-only if that's all we're allowed */
+static int open_file(const char *path)
+{
+	int fd = open(path, O_RDWR);
+
+	return fd < 0 && errno == EACCES ? open(path, O_RDONLY) : fd;
+}
+
+static int read_header(struct caldb *db)
+{
+	unsigned char hdr[16];
+
+	if (pread(db->fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr, CALDB_MAGIC, 4) || get32(hdr + 4) != CALDB_VERSION) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	db->slots = get32(hdr + 8);
+	db->used = get32(hdr + 12);
+	if (!db->slots || (db->slots & (db->slots - 1))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int write_header(int fd, uint32_t slots, uint32_t used)
+{
+	unsigned char hdr[16];
+
+	memcpy(hdr, CALDB_MAGIC, 4);
+	put32(hdr + 4, CALDB_VERSION);
+	put32(hdr + 8, slots);
+	put32(hdr + 12, used);
+
+	return pwrite(fd, hdr, sizeof(hdr), 0) == sizeof(hdr) ? 0 : -1;
+}
+
+/*
+ * Locks the database, following it if it was rebuilt into a new file
+ * while we waited, and reads the header again.
+ */
+static int lock(struct caldb *db, int how)
+{
+	struct stat a, b;
+	int fd;
+
+	for (;;) {
+		if (flock(db->fd, how))
+			return -1;
+		if (fstat(db->fd, &a) || stat(db->path, &b))
+			goto fail;
+		if (a.st_dev == b.st_dev && a.st_ino == b.st_ino)
+			break;
+
+		if ((fd = open_file(db->path)) < 0)
+			goto fail;
+		close(db->fd);
+		db->fd = fd;
+	}
+
+	if (read_header(db))
+		goto fail;
+
+	return 0;
+
+fail:
+	flock(db->fd, LOCK_UN);
+	return -1;
+}
+
+static int read_slot(int fd, uint32_t i, struct slot *s)
+{
+	uint32_t seq;
+	int c;
+
+	if (pread(fd, s->copy, SLOT_SIZE, SLOT_OFFSET(i)) != SLOT_SIZE)
+		return -1;
+
+	s->newest = -1;
+	s->seq = 0;
+	for (c = 0; c < 2; c++) {
+		seq = get32(s->copy[c] + REC_SEQ);
+		if (seq && seq >= s->seq &&
+		    get32(s->copy[c] + REC_CHECK) ==
+		    fnv(s->copy[c] + REC_HASH, CALDB_PAGE - REC_HASH)) {
+			s->newest = c;
+			s->seq = seq;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Finds the slot holding a key, or the empty slot where it would go.
+ * Returns the slot number, or -1 on error.
+ */
+static long find(struct caldb *db, const char *key, uint32_t hash,
+		 struct slot *s)
+{
+	uint32_t i, n;
+
+	for (n = 0, i = hash & (db->slots - 1); n < db->slots;
+	     n++, i = (i + 1) & (db->slots - 1)) {
+		if (read_slot(db->fd, i, s))
+			return -1;
+		if (s->newest < 0 ||
+		    !memcmp(s->copy[s->newest] + REC_KEY, key, CALDB_KEY))
+			return i;
+	}
+
+	/* Never happens, the table is grown well before it's full */
+	errno = ENOSPC;
+	return -1;
+}
+
+int caldb_open(struct caldb *db, const char *path, int create)
+{
+	struct stat st;
+	int created = 0;
+
+	if (!(db->path = strdup(path)))
+		return -1;
+
+	if ((db->fd = open_file(path)) < 0 && errno == ENOENT && create)
+		db->fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (db->fd < 0)
+		goto fail;
+
+	if (flock(db->fd, LOCK_EX))
+		goto fail_close;
+
+	/* Whoever gets here first writes the header */
+	if (fstat(db->fd, &st))
+		goto fail_close;
+	if (!st.st_size) {
+		if (write_header(db->fd, CALDB_SLOTS, 0) ||
+		    ftruncate(db->fd, SLOT_OFFSET(CALDB_SLOTS)) ||
+		    fsync(db->fd))
+			goto fail_close;
+		created = 1;
+	}
+
+	if (read_header(db))
+		goto fail_close;
+	flock(db->fd, LOCK_UN);
+
+	return created;
+
+fail_close:
+	close(db->fd);
+fail:
+	free(db->path);
+	return -1;
+}
+
+int caldb_lookup(struct caldb *db, const struct caldb_ident *id,
+		 struct caldb_entry *e)
+{
+	char key[CALDB_KEY];
+	unsigned char *rec;
+	struct slot s;
+	size_t len;
+
+	make_key(id, key);
+	if (lock(db, LOCK_SH))
+		return -1;
+
+	if (find(db, key, fnv(key, CALDB_KEY), &s) < 0) {
+		flock(db->fd, LOCK_UN);
+		return -1;
+	}
+	flock(db->fd, LOCK_UN);
+
+	if (s.newest < 0)
+		return 0;
+
+	rec = s.copy[s.newest] + REC_VALUE;
+	rec[CALDB_VALUE - 1] = 0;
+	len = strlen((char *)rec);
+	memcpy(e->mappings, rec, len + 1);
+	snprintf(e->correction, sizeof(e->correction), "%s",
+		 (char *)rec + len + 1);
+
+	return 1;
+}
+
+/*
+ * Rebuilds the database twice the size, into a new file which replaces
+ * the old one. The database is locked, and the new one is locked too
+ * before anybody else can open it.
+ */
+static int grow(struct caldb *db)
+{
+	char path[PATH_MAX];
+	uint32_t slots = db->slots * 2, used = 0, i, j;
+	unsigned char *table, *rec;
+	struct slot s;
+	int fd;
+
+	if (!(table = calloc(slots, SLOT_SIZE)))
+		return -1;
+
+	for (i = 0; i < db->slots; i++) {
+		if (read_slot(db->fd, i, &s))
+			goto fail;
+		if (s.newest < 0)
+			continue;
+
+		rec = s.copy[s.newest];
+		for (j = get32(rec + REC_HASH) & (slots - 1);
+		     get32(table + (size_t)j * SLOT_SIZE + REC_SEQ);
+		     j = (j + 1) & (slots - 1))
+			;
+		memcpy(table + (size_t)j * SLOT_SIZE, rec, CALDB_PAGE);
+		used++;
+	}
+
+	snprintf(path, sizeof(path), "%s.new", db->path);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0)
+		goto fail;
+	if (flock(fd, LOCK_EX) ||
+	    write_header(fd, slots, used) ||
+	    pwrite(fd, table, (size_t)slots * SLOT_SIZE, SLOT_OFFSET(0)) !=
+	    (ssize_t)slots * SLOT_SIZE ||
+	    fsync(fd) || rename(path, db->path)) {
+		close(fd);
+		unlink(path);
+		goto fail;
+	}
+
+	free(table);
+	close(db->fd);
+	db->fd = fd;
+	db->slots = slots;
+	db->used = used;
+
+	return 0;
+
+fail:
+	free(table);
+	return -1;
+}
+
+int caldb_store(struct caldb *db, const struct caldb_ident *id,
+		const struct caldb_entry *e)
+{
+	unsigned char rec[CALDB_PAGE];
+	char key[CALDB_KEY];
+	size_t mlen = strlen(e->mappings), clen = strlen(e->correction);
+	uint32_t hash;
+	struct slot s;
+	long i;
+	int c;
+
+	if (mlen + clen + 2 > CALDB_VALUE) {
+		errno = E2BIG;
+		return -1;
+	}
+
+	make_key(id, key);
+	hash = fnv(key, CALDB_KEY);
+	if (lock(db, LOCK_EX))
+		return -1;
+
+	if ((i = find(db, key, hash, &s)) < 0)
+		goto fail;
+
+	/* A new joystick mustn't fill the table more than three quarters */
+	if (s.newest < 0 && (db->used + 1) * 4 > db->slots * 3) {
+		if (grow(db) || (i = find(db, key, hash, &s)) < 0)
+			goto fail;
+	}
+
+	memset(rec, 0, sizeof(rec));
+	put32(rec + REC_SEQ, s.seq + 1);
+	put32(rec + REC_HASH, hash);
+	memcpy(rec + REC_KEY, key, CALDB_KEY);
+	memcpy(rec + REC_VALUE, e->mappings, mlen);
+	memcpy(rec + REC_VALUE + mlen + 1, e->correction, clen);
+	put32(rec + REC_CHECK, fnv(rec + REC_HASH, CALDB_PAGE - REC_HASH));
+
+	/* Overwrite the older copy, leaving the newest intact */
+	c = s.newest < 0 ? 0 : !s.newest;
+	if (pwrite(db->fd, rec, CALDB_PAGE, SLOT_OFFSET(i) + c * CALDB_PAGE) !=
+	    CALDB_PAGE || fdatasync(db->fd))
+		goto fail;
+
+	if (s.newest < 0 && write_header(db->fd, db->slots, ++db->used))
+		goto fail;
+
+	flock(db->fd, LOCK_UN);
+	return 0;
+
+fail:
+	flock(db->fd, LOCK_UN);
+	return -1;
+}
+
+/* The value of a NAME="..." line */
+static void quoted(const char *line, char *buf, size_t size)
+{
+	const char *p = strchr(line, '"');
+
+	*buf = 0;
+	if (p)
+		snprintf(buf, size, "%.*s", (int)strcspn(p + 1, "\""), p + 1);
+}
+
+/* The argument of a jscal command line */
+static void argument(const char *line, char *buf, size_t size)
+{
+	const char *p = line + strlen("jscal -u ");
+
+	snprintf(buf, size, "%.*s", (int)strcspn(p, " "), p);
+}
+
+int caldb_import(struct caldb *db, FILE *f)
+{
+	static struct caldb_entry e, old;
+	struct caldb_ident id;
+	char line[CALDB_VALUE + 64];
+	int n = 0, end;
+
+	memset(&id, 0, sizeof(id));
+	memset(&e, 0, sizeof(e));
+
+	do {
+		end = !fgets(line, sizeof(line), f);
+		if (!end)
+			line[strcspn(line, "\n")] = 0;
+
+		if (end || !*line) {
+			/* As when extracting, the first section wins */
+			if ((*e.mappings || *e.correction) &&
+			    !caldb_lookup(db, &id, &old)) {
+				if (caldb_store(db, &id, &e))
+					return -1;
+				n++;
+			}
+			memset(&id, 0, sizeof(id));
+			memset(&e, 0, sizeof(e));
+		} else if (!strncmp(line, "DEVICE=", 7)) {
+			quoted(line, id.kernel, sizeof(id.kernel));
+		} else if (!strncmp(line, "NAME=", 5)) {
+			quoted(line, id.name, sizeof(id.name));
+		} else if (!strncmp(line, "SERIAL=", 7)) {
+			quoted(line, id.serial, sizeof(id.serial));
+		} else if (!strncmp(line, "VENDOR=", 7)) {
+			quoted(line, id.vendor, sizeof(id.vendor));
+		} else if (!strncmp(line, "PRODUCT=", 8)) {
+			quoted(line, id.product, sizeof(id.product));
+		} else if (!strncmp(line, "jscal -u ", 9)) {
+			argument(line, e.mappings, sizeof(e.mappings));
+		} else if (!strncmp(line, "jscal -s ", 9)) {
+			argument(line, e.correction, sizeof(e.correction));
+		}
+	} while (!end);
+
+	return n;
+}
+
+void caldb_close(struct caldb *db)
+{
+	close(db->fd);
+	free(db->path);
+}
@@ -0,0 +1,94 @@
+/*
+ * Joystick calibration database.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CALDB_H__
+#define __CALDB_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define CALDB_PATH	"/var/lib/joystick/joystick.db"
+
+/* The database is a hash table of fixed-size slots on disk, behind a
+   one-page header holding the magic, the version, the number of slots
+   (a power of two) and the number used. A joystick's key hashes to its
+   slot, with linear probing, so looking one up reads a slot or two
+   whatever the size of the database. Each slot holds two copies of its
+   record, with a sequence number and a checksum; an update overwrites
+   the older copy in place, so a record cut short by a crash is ignored
+   and the previous one still read. The table is rebuilt twice the size,
+   into a new file renamed over the old one, once three quarters full.
+   Readers and writers take flock() locks. All values are little
+   endian. */
+#define CALDB_MAGIC	"JSCD"
+#define CALDB_VERSION	1
+
+#define CALDB_PAGE	4096
+#define CALDB_KEY	256
+#define CALDB_VALUE	(CALDB_PAGE - CALDB_KEY - 12)
+
+/* What identifies a joystick, as jscal-store has always used it: its
+   kernel name (js0), and if available its name and serial number, its
+   USB vendor and product codes. */
+struct caldb_ident {
+	char kernel[32];
+	char name[128];
+	char serial[64];
+	char vendor[8];
+	char product[8];
+};
+
+/* The settings stored for a joystick: the arguments jscal takes for
+   --set-mappings and --set-correction. Both are kept in one record, so
+   together they can't be longer than CALDB_VALUE - 2. */
+struct caldb_entry {
+	char mappings[CALDB_VALUE];
+	char correction[CALDB_VALUE];
+};
+
+struct caldb {
+	int fd;
+	char *path;
+	uint32_t slots, used;
+};
+
+/* Fills in the identity of the open joystick device, from sysfs; only
+   the kernel name, taken from the path, is set if that fails. */
+void caldb_ident(int fd, const char *path, struct caldb_ident *id);
+
+/* Opens the database, creating it if asked to. Returns 1 if it was
+   created, 0 if it already existed, -1 on error. */
+int caldb_open(struct caldb *db, const char *path, int create);
+
+/* Looks up the settings for a joystick. Returns 1 if found, 0 if not,
+   -1 on error. */
+int caldb_lookup(struct caldb *db, const struct caldb_ident *id,
+		 struct caldb_entry *e);
+
+/* Stores the settings for a joystick, replacing any previous ones.
+   Returns -1 on error. */
+int caldb_store(struct caldb *db, const struct caldb_ident *id,
+		const struct caldb_entry *e);
+
+/* Stores the sections of a jscal-store text file which aren't in the
+   database yet. Returns the number stored, or -1 on error. */
+int caldb_import(struct caldb *db, FILE *f);
+
+void caldb_close(struct caldb *db);
+
+#endif
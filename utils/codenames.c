@@ -0,0 +1,59 @@
+/*
+ * Names of the input event codes, from the kernel headers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stddef.h>
+#include <strings.h>
+
+#include <linux/input.h>
+
+#include "codenames.h"
+#include "codetables.h"
+
+const struct codename *codename_lookup(const char *name)
+{
+	unsigned int seed, i;
+
+	seed = codenames_seed[namehash(name, 0) % CODENAMES_BUCKETS];
+	i = codenames_slot[namehash(name, seed) % CODENAMES_SLOTS];
+
+	/* A name that isn't there lands in some slot all the same */
+	if (i && !strcasecmp(codenames[i - 1].name, name))
+		return &codenames[i - 1];
+
+	return NULL;
+}
+
+const char *code_name(int type, int code)
+{
+	switch (type) {
+	case EV_KEY:
+		if (code >= 0 && code < CODENAMES_KEYS)
+			return key_names[code];
+		break;
+	case EV_ABS:
+		if (code >= 0 && code < CODENAMES_ABS)
+			return abs_names[code];
+		break;
+	case EV_REL:
+		if (code >= 0 && code < CODENAMES_REL)
+			return rel_names[code];
+		break;
+	}
+
+	return NULL;
+}
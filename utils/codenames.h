@@ -0,0 +1,43 @@
+/*
+ * Names of the input event codes, from the kernel headers.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __CODENAMES_H__
+#define __CODENAMES_H__
+
+#include "namehash.h"
+
+/* The tables are generated by mkcodenames into codetables.h, from the
+   KEY_, BTN_, ABS_ and REL_ definitions of <linux/input.h>. */
+
+/* A name, and the event type (EV_KEY, EV_ABS or EV_REL) and code it
+   stands for */
+struct codename {
+	const char *name;
+	unsigned short type;
+	unsigned short code;
+};
+
+/* Looks a name up, ignoring case; aliases (BTN_A for BTN_SOUTH) are
+   found too. Returns NULL if there is no such code. */
+const struct codename *codename_lookup(const char *name);
+
+/* Returns the name of a code, the last one the headers define for it
+   (BTN_TRIGGER rather than BTN_JOYSTICK), or NULL if it has none. */
+const char *code_name(int type, int code);
+
+#endif
@@ -23,6 +23,9 @@
 
 #include <linux/input.h>
 #include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,8 +33,11 @@
 #include <unistd.h>
 #include <errno.h>
 #include <math.h>
+#include <time.h>
 
 #include "bitmaskros.h"
+#include "ffdev.h"
+#include "histogram.h"
 
 
 /* Default values for the options */
@@ -43,6 +49,17 @@
 #define DEFAULT_AXIS_INDEX          0
 #define DEFAULT_AXIS_CODE       ABS_X
 
+/* Timed mode: the bars are redrawn this often, and the search for the
+   highest update rate runs steps this long, each this much faster than
+   the previous one, up to this rate */
+#define DISPLAY_RATE              25.0
+#define SEARCH_STEP               1.0
+#define SEARCH_FACTOR             1.25
+#define SEARCH_LIMIT         100000.0
+
+/* A rate is sustained if at most this share of the ticks are missed */
+#define SUSTAINED_MISSES          0.01
+
 static const char* axis_names[] = { "X", "Y", "Z", "RX", "RY", "RZ", "WHEEL" };
 static const int axis_codes[] = { ABS_X, ABS_Y, ABS_Z, ABS_RX, ABS_RY, ABS_RZ, ABS_WHEEL };
 
@@ -56,12 +73,48 @@ int    axis_index        = DEFAULT_AXIS_INDEX;
 int    axis_code         = DEFAULT_AXIS_CODE;
 int stop_and_play = 0;  /* Stop-upload-play effects instead of updating */
 int autocenter_off = 0; /* switch the autocentering off */
+int timed = 0;          /* run the loop on a timer and measure it */
+double duration = 0;    /* seconds the timed loop runs, 0 for ever */
+int search = 0;         /* look for the highest sustainable update rate */
+const char * trace_name = NULL; /* record what is sent to the device */
 
 
 /* Global variables about the initialized device */
-int device_handle;
+struct ffdev device;
 int axis_min, axis_max;
 struct ff_effect effect;
+clockid_t event_clock = CLOCK_REALTIME; /* of the event timestamps */
+
+
+/* Timing of the force loop, all in ns */
+struct loop_stats {
+	struct histogram upload;	/* setting the force */
+	struct histogram lag;		/* age of the position events read */
+	struct histogram late;		/* waking up after the tick */
+	struct histogram busy;		/* the whole iteration */
+	unsigned long ticks, missed, errors;
+};
+
+volatile sig_atomic_t interrupted = 0;
+
+void interrupt(int sig)
+{
+	interrupted = 1;
+}
+
+int64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Histograms hold 32 bits */
+uint32_t clamp(int64_t v)
+{
+	return v < 0 ? 0 : v > UINT32_MAX ? UINT32_MAX : v;
+}
 
 
 /* Parse command line arguments */
@@ -94,8 +147,18 @@ void parse_args(int argc, char * argv[])
 			;
 		} else if (!strcmp(argv[i],"-A")) {
 			autocenter_off = 1;
+		} else if (!strcmp(argv[i],"-T")) {
+			timed = 1;
+		} else if (!strcmp(argv[i],"-D")) {
+		        if (i<argc-1) duration = atof(argv[++i]); else help = 1;
+		} else if (!strcmp(argv[i],"-M")) {
+			search = 1;
+		} else if (!strcmp(argv[i],"-r")) {
+		        if (i<argc-1) trace_name = argv[++i]; else help = 1;
 		} else help = 1;
 	}
+
+	if (update_rate <= 0 || duration < 0) help = 1;
  
 
 	if (help) {
@@ -116,6 +179,13 @@ void parse_args(int argc, char * argv[])
 		printf("  -x <int>     absolute axis to test (default: %d=%s)\n",DEFAULT_AXIS_INDEX, axis_names[DEFAULT_AXIS_INDEX]);
 		printf("               (0 = X, 1 = Y, 2 = Z, 3 = RX, 4 = RY, 5 = RZ, 6 = WHEEL)\n");
 		printf("  -A           switch off auto-centering\n");
+		printf("  -T           run the loop on a timer at the update rate, measuring\n");
+		printf("               how long setting the force takes, how old the positions\n");
+		printf("               read are and how late each iteration wakes up\n");
+		printf("  -D <double>  with -T, stop after that many seconds (default: never)\n");
+		printf("  -M           find the highest update rate the device sustains, in\n");
+		printf("               %.0f s steps from the update rate up\n", SEARCH_STEP);
+		printf("  -r <string>  record what is sent to the device, for ffreplay\n");
 		printf("  -o           dummy option (useful because at least one option is needed)\n");
 		exit(1);
 	}
@@ -126,54 +196,38 @@ void parse_args(int argc, char * argv[])
 /* Initialize device, create constant force effect */
 void init_device()
 {
-	unsigned char key_bits[1 + KEY_MAX/8/sizeof(unsigned char)];
-	unsigned char abs_bits[1 + ABS_MAX/8/sizeof(unsigned char)];
-	unsigned char ff_bits[1 + FF_MAX/8/sizeof(unsigned char)];
-
-	struct input_event event;
 	struct input_absinfo absinfo;
 
-	/* Open event device with write permission */
-	device_handle = open(device_name,O_RDWR|O_NONBLOCK);
-	if (device_handle<0) {
+	/* Open event device with write permission, and find out which
+	   buttons, axes and force feedback effects it has */
+	if (ffdev_open(&device,device_name,O_NONBLOCK)<0) {
 		fprintf(stderr,"ERROR: can not open %s (%s) [%s:%d]\n",
 		        device_name,strerror(errno),__FILE__,__LINE__);
 		exit(1);
 	}
 
-	/* Which buttons has the device? */
-	memset(key_bits,0,sizeof(key_bits));
-	if (ioctl(device_handle,EVIOCGBIT(EV_KEY,sizeof(key_bits)),key_bits)<0) {
-		fprintf(stderr,"ERROR: can not get key bits (%s) [%s:%d]\n",
-		        strerror(errno),__FILE__,__LINE__);
-		exit(1);
-	}
-
-	/* Which axes has the device? */
-	memset(abs_bits,0,sizeof(abs_bits));
-	if (ioctl(device_handle,EVIOCGBIT(EV_ABS,sizeof(abs_bits)),abs_bits)<0) {
-		fprintf(stderr,"ERROR: can not get abs bits (%s) [%s:%d]\n",
-		        strerror(errno),__FILE__,__LINE__);
+	/* Record everything sent to the device, from the start */
+	if (trace_name && ffdev_record(&device,trace_name)<0) {
+		fprintf(stderr,"ERROR: can not create %s (%s) [%s:%d]\n",
+		        trace_name,strerror(errno),__FILE__,__LINE__);
 		exit(1);
 	}
 
-	/* Now get some information about force feedback */
-	memset(ff_bits,0,sizeof(ff_bits));
-	if (ioctl(device_handle,EVIOCGBIT(EV_FF ,sizeof(ff_bits)),ff_bits)<0) {
-		fprintf(stderr,"ERROR: can not get ff bits (%s) [%s:%d]\n",
-		        strerror(errno),__FILE__,__LINE__);
-		exit(1);
-	}
+	/* Event timestamps from the clock the timed loop uses, if the
+	   kernel can */
+	event_clock = CLOCK_MONOTONIC;
+	if (ioctl(device.fd,EVIOCSCLOCKID,&event_clock)<0)
+		event_clock = CLOCK_REALTIME;
 
 	/* Check if selected axis is available */
-	if (!testBit(axis_code, abs_bits)) {
+	if (!testBit(axis_code, device.abs_bits)) {
 		fprintf(stderr,"ERROR: selected axis %s not available [%s:%d] (see available ones with fftest)\n",
 		        axis_names[axis_index], __FILE__,__LINE__);
 		exit(1);
 	}
 
 	/* get axis value range */
-	if (ioctl(device_handle,EVIOCGABS(axis_code),&absinfo)<0) {
+	if (ioctl(device.fd,EVIOCGABS(axis_code),&absinfo)<0) {
 		fprintf(stderr,"ERROR: can not get axis value range (%s) [%s:%d]\n",
 		        strerror(errno),__FILE__,__LINE__);
 		exit(1);
@@ -187,7 +241,7 @@ void init_device()
 	}
 
 	/* force feedback supported? */
-	if (!testBit(FF_CONSTANT,ff_bits)) {
+	if (!testBit(FF_CONSTANT,device.ff_bits)) {
 		fprintf(stderr,"ERROR: device (or driver) has no constant force feedback support [%s:%d]\n",
 		        __FILE__,__LINE__);
 		exit(1);
@@ -195,11 +249,8 @@ void init_device()
 
 	/* Switch off auto centering */
 	if (autocenter_off) {
-		memset(&event,0,sizeof(event));
-		event.type=EV_FF;
-		event.code=FF_AUTOCENTER;
-		event.value=0;
-		if (write(device_handle,&event,sizeof(event))!=sizeof(event)) {
+		if (ffdev_queue(&device,FF_AUTOCENTER,0)<0 ||
+		    ffdev_flush(&device)<0) {
 			fprintf(stderr,"ERROR: failed to disable auto centering (%s) [%s:%d]\n",
 				strerror(errno),__FILE__,__LINE__);
 			exit(1);
@@ -222,18 +273,14 @@ void init_device()
 	effect.u.constant.envelope.fade_level=0;
 
 	/* Upload effect */
-	if (ioctl(device_handle,EVIOCSFF,&effect)<0) {
+	if (ffdev_upload(&device,&effect)<0) {
 		fprintf(stderr,"ERROR: uploading effect failed (%s) [%s:%d]\n",
 		        strerror(errno),__FILE__,__LINE__);
 		exit(1);
 	}
 
 	/* Start effect */
-	memset(&event,0,sizeof(event));
-	event.type=EV_FF;
-	event.code=effect.id;
-	event.value=1;
-	if (write(device_handle,&event,sizeof(event))!=sizeof(event)) {
+	if (ffdev_play(&device,&effect,1)<0 || ffdev_flush(&device)<0) {
 		fprintf(stderr,"ERROR: starting effect failed (%s) [%s:%d]\n",
 		        strerror(errno),__FILE__,__LINE__);
 		exit(1);
@@ -241,19 +288,21 @@ void init_device()
 }
 
 
-/* update the device: set force and query joystick position */
-void update_device(double force, double * position)
+/* update the device: set force and query joystick position; the
+   timing is recorded if stats are given */
+void update_device(double force, double * position, struct loop_stats * stats)
 {
 	struct input_event event;
+	int64_t start = clock_ns(CLOCK_MONOTONIC);
+	int failed = 0;
 
 	/* Delete effect */
 	if (stop_and_play && effect.id!=-1) {
-		if (ioctl(device_handle,EVIOCRMFF,effect.id)<0) {
+		if (ffdev_remove(&device,&effect)<0) {
 			fprintf(stderr,"ERROR: removing effect failed (%s) [%s:%d]\n",
 			        strerror(errno),__FILE__,__LINE__);
 			exit(1);
 		}
-		effect.id=-1;
 	}
 
 	/* Set force */
@@ -264,32 +313,40 @@ void update_device(double force, double * position)
 	effect.u.constant.envelope.attack_level=(short)(force*32767.0); /* this one counts! */
 	effect.u.constant.envelope.fade_level=(short)(force*32767.0); /* only to be safe */
 
-	/* Upload effect */
-	if (ioctl(device_handle,EVIOCSFF,&effect)<0) {
-		perror("upload effect");
+	/* Upload effect; unchanged, it isn't sent again, unless it is
+	   timed: every update is then a round trip to the device */
+	if ((stats ? ffdev_send(&device,&effect) :
+	     ffdev_upload(&device,&effect))<0) {
+		if (!stats) perror("upload effect");
 		/* We do not exit here. Indeed, too frequent updates may be
 		 * refused, but that is not a fatal error */
+		failed = 1;
 	}
 
 	/* Start effect */
 	if (stop_and_play && effect.id!=-1) {
-		memset(&event,0,sizeof(event));
-		event.type=EV_FF;
-		event.code=effect.id;
-		event.value=1;
-		if (write(device_handle,&event,sizeof(event))!=sizeof(event)) {
+		if (ffdev_play(&device,&effect,1)<0 || ffdev_flush(&device)<0) {
 			fprintf(stderr,"ERROR: re-starting effect failed (%s) [%s:%d]\n",
 			        strerror(errno),__FILE__,__LINE__);
 			exit(1);
 		}
 	}
 
+	if (stats) {
+		hist_add(&stats->upload, clamp(clock_ns(CLOCK_MONOTONIC) - start));
+		stats->errors += failed;
+	}
+
 	/* Get events */
-	while (read(device_handle,&event,sizeof(event))==sizeof(event)) {
+	while (read(device.fd,&event,sizeof(event))==sizeof(event)) {
 		if (event.type==EV_ABS && event.code==axis_code) {
 			*position=((double)(((short)event.value)-axis_min))*2.0/(axis_max-axis_min)-1.0;
 			if (*position>1.0) *position=1.0;
 			else if (*position<-1.0) *position=-1.0;
+			if (stats)
+				hist_add(&stats->lag, clamp(clock_ns(event_clock) -
+					(event.time.tv_sec * 1000000000LL +
+					 event.time.tv_usec * 1000LL)));
 		}
 	}
 }
@@ -314,10 +371,188 @@ void fprint_bar(FILE * file, double value, int radius)
 }
 
 
+/* print the bars showing where the spring is */
+void print_bars(double position, double center, double force)
+{
+	printf("\r");
+	fprint_bar(stdout,position,12);
+	printf(" ");
+	fprint_bar(stdout,center,12);
+	printf(" ");
+	fprint_bar(stdout,force,12);
+	fflush(stdout);
+}
+
+
+/* Spring center oscillates, the force pulls towards it */
+double spring_force(double time, double position, double * center)
+{
+	double force;
+
+	*center = sin( time * 2 * M_PI * motion_frequency ) * motion_amplitude;
+
+	force = ( *center - position ) * spring_strength;
+	if (force >  1.0) force =  1.0;
+	if (force < -1.0) force = -1.0;
+
+	return force;
+}
+
+
+/* Run the spring simulation on a timer at the given rate, for the given
+   time (0 for ever, or until interrupted), measuring each iteration */
+void run_timed(double rate, double seconds, struct loop_stats * stats,
+               int show)
+{
+	struct itimerspec its;
+	int64_t period = 1000000000.0 / rate, start, now, shown = 0;
+	double position = 0, center, force;
+	uint64_t expirations;
+	int fd;
+
+	memset(stats, 0, sizeof(*stats));
+
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	if (fd<0) {
+		fprintf(stderr,"ERROR: can not create timer (%s) [%s:%d]\n",
+		        strerror(errno),__FILE__,__LINE__);
+		exit(1);
+	}
+
+	/* The ticks are absolute: a late iteration doesn't move the next */
+	start = clock_ns(CLOCK_MONOTONIC);
+	its.it_interval.tv_sec = period / 1000000000;
+	its.it_interval.tv_nsec = period % 1000000000;
+	its.it_value.tv_sec = (start + period) / 1000000000;
+	its.it_value.tv_nsec = (start + period) % 1000000000;
+	if (timerfd_settime(fd,TFD_TIMER_ABSTIME,&its,NULL)<0) {
+		fprintf(stderr,"ERROR: can not set timer (%s) [%s:%d]\n",
+		        strerror(errno),__FILE__,__LINE__);
+		exit(1);
+	}
+
+	while (!interrupted) {
+		if (read(fd,&expirations,sizeof(expirations))!=sizeof(expirations)) {
+			if (errno==EINTR) continue;
+			fprintf(stderr,"ERROR: can not read timer (%s) [%s:%d]\n",
+			        strerror(errno),__FILE__,__LINE__);
+			exit(1);
+		}
+		now = clock_ns(CLOCK_MONOTONIC);
+
+		/* Ticks which went by while we were busy are lost */
+		stats->ticks += expirations;
+		stats->missed += expirations - 1;
+		hist_add(&stats->late, clamp(now - start - stats->ticks * period));
+
+		force = spring_force((now - start) / 1e9, position, &center);
+		update_device(force,&position,stats);
+
+		hist_add(&stats->busy, clamp(clock_ns(CLOCK_MONOTONIC) - now));
+
+		if (show && now - shown >= 1e9 / DISPLAY_RATE) {
+			print_bars(position,center,force);
+			shown = now;
+		}
+
+		if (seconds > 0 && now - start >= seconds * 1e9)
+			break;
+	}
+
+	close(fd);
+}
+
+
+/* Prints the percentiles of a histogram in ns, in us */
+void print_percentiles(const char * what, const struct histogram * h)
+{
+	printf("  %-8s p50 %9.1f  p90 %9.1f  p99 %9.1f  p99.9 %9.1f  max %9.1f us\n",
+	       what, hist_percentile(h,50)/1e3, hist_percentile(h,90)/1e3,
+	       hist_percentile(h,99)/1e3, hist_percentile(h,99.9)/1e3,
+	       h->max/1e3);
+}
+
+
+void print_stats(double rate, const struct loop_stats * stats)
+{
+	printf("%.1f Hz: %lu ticks, %lu missed (%.2f%%), %lu uploads refused\n",
+	       rate, stats->ticks, stats->missed,
+	       stats->ticks ? 100.0 * stats->missed / stats->ticks : 0,
+	       stats->errors);
+	print_percentiles("upload", &stats->upload);
+	if (stats->lag.count)
+		print_percentiles("lag", &stats->lag);
+	print_percentiles("late", &stats->late);
+	print_percentiles("busy", &stats->busy);
+}
+
+
+/* A rate is sustained if the device takes every update and (nearly) no
+   ticks are missed */
+int sustained(const struct loop_stats * stats)
+{
+	return stats->ticks && !stats->errors &&
+	       stats->missed <= stats->ticks * SUSTAINED_MISSES;
+}
+
+
+/* Timed mode: run at the update rate, then print the timing */
+void measure(void)
+{
+	struct loop_stats stats;
+
+	printf("\n        position                   center                     force\n");
+	run_timed(update_rate,duration,&stats,1);
+
+	printf("\n\n");
+	print_stats(update_rate,&stats);
+	printf("\nTime to set the force:\n");
+	hist_print(stdout,&stats.upload,1e3,"us");
+	if (stats.lag.count) {
+		printf("\nAge of the positions read:\n");
+		hist_print(stdout,&stats.lag,1e3,"us");
+	}
+	printf("\nLateness of the iterations:\n");
+	hist_print(stdout,&stats.late,1e3,"us");
+
+	/* What the iterations took bounds the rate */
+	if (stats.busy.count)
+		printf("\nIterations take up to %.1f us (p99): at most %.0f Hz\n",
+		       hist_percentile(&stats.busy,99)/1e3,
+		       1e9/hist_percentile(&stats.busy,99));
+}
+
+
+/* Search mode: raise the rate until the device can't keep up */
+void search_rate(void)
+{
+	struct loop_stats stats;
+	double rate, best = 0;
+
+	for (rate = update_rate; rate <= SEARCH_LIMIT && !interrupted;
+	     rate *= SEARCH_FACTOR) {
+		run_timed(rate,SEARCH_STEP,&stats,0);
+		if (interrupted)
+			break;
+		print_stats(rate,&stats);
+		fflush(stdout);
+		if (!sustained(&stats))
+			break;
+		best = rate;
+	}
+
+	if (best > 0)
+		printf("\nHighest sustained update rate: %.1f Hz\n", best);
+	else
+		printf("\nThe device doesn't sustain %.1f Hz\n", update_rate);
+}
+
+
 /* main: perform the spring simulation */
 int main(int argc, char * argv[])
 {
 	double time,position,center,force;
+	struct sigaction sa;
 
 	/* Parse command line arguments */
 	parse_args(argc,argv);
@@ -325,34 +560,43 @@ int main(int argc, char * argv[])
 	/* Initialize device, create constant force effect */
 	init_device();
 
-	/* Print header */
-	printf("\n        position                   center                     force\n");
+	/* Stop cleanly when interrupted, so that the trace is complete */
+	memset(&sa,0,sizeof(sa));
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT,&sa,NULL);
+	sigaction(SIGTERM,&sa,NULL);
 
-	/* For ever */
-	for (position=0, time=0;; time+=1.0/update_rate) {
+	if (search)
+		search_rate();
+	else if (timed)
+		measure();
+	else {
+		/* Print header */
+		printf("\n        position                   center                     force\n");
 
-		/* Spring center oscillates */
-		center = sin( time * 2 * M_PI * motion_frequency ) * motion_amplitude;
+		/* Until interrupted */
+		for (position=0, time=0; !interrupted; time+=1.0/update_rate) {
 
-		/* Calculate spring force */
-		force = ( center - position ) * spring_strength;
-		if (force >  1.0) force =  1.0;
-		if (force < -1.0) force = -1.0;
+			/* Calculate spring force */
+			force = spring_force(time,position,&center);
 
-		/* Print graph bars */
-		printf("\r");
-		fprint_bar(stdout,position,12);
-		printf(" ");
-		fprint_bar(stdout,center,12);
-		printf(" ");
-		fprint_bar(stdout,force,12);
-		fflush(stdout);
+			/* Print graph bars */
+			print_bars(position,center,force);
 
-		/* Set force and ask for joystick position */
-		update_device(force,&position);
+			/* Set force and ask for joystick position */
+			update_device(force,&position,NULL);
 
-		/* Next time... */
-		usleep((unsigned long)(1000000.0/update_rate));
+			/* Next time... */
+			usleep((unsigned long)(1000000.0/update_rate));
+
+		}
+		printf("\n");
+	}
 
+	if (ffdev_close(&device)<0) {
+		fprintf(stderr,"ERROR: can not write %s (%s) [%s:%d]\n",
+		        trace_name,strerror(errno),__FILE__,__LINE__);
+		return 1;
 	}
+	return 0;
 }
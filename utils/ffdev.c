@@ -0,0 +1,365 @@
+/*
+ * Force feedback device access, shared by the ff* utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ffdev.h"
+
+int ffdev_record(struct ffdev *dev, const char *path)
+{
+	struct fftrace *t = calloc(1, sizeof(*t));
+
+	if (!t)
+		return -1;
+
+	t->n_effects = dev->n_effects;
+	memcpy(t->ff_bits, dev->ff_bits, sizeof(t->ff_bits));
+	if (ioctl(dev->fd, EVIOCGNAME(sizeof(t->name)), t->name) < 0)
+		t->name[0] = 0;
+	t->name[sizeof(t->name) - 1] = 0;
+
+	if (fftrace_create(t, path) < 0) {
+		free(t);
+		return -1;
+	}
+	dev->trace = t;
+	return 0;
+}
+
+/* Traces what was just sent, if recording */
+static void trace(struct ffdev *dev, struct fftrace_record *r, int failed)
+{
+	r->error = failed ? errno : 0;
+	fftrace_write(dev->trace, r);
+	errno = r->error;
+}
+
+int ffdev_open(struct ffdev *dev, const char *path, int flags)
+{
+	int err;
+
+	memset(dev, 0, sizeof(*dev));
+
+	dev->fd = open(path, O_RDWR | flags);
+	if (dev->fd < 0)
+		return -1;
+
+	if (ioctl(dev->fd, EVIOCGBIT(0, sizeof(dev->ev_bits)), dev->ev_bits) < 0 ||
+	    ioctl(dev->fd, EVIOCGBIT(EV_KEY, sizeof(dev->key_bits)), dev->key_bits) < 0 ||
+	    ioctl(dev->fd, EVIOCGBIT(EV_ABS, sizeof(dev->abs_bits)), dev->abs_bits) < 0 ||
+	    ioctl(dev->fd, EVIOCGBIT(EV_REL, sizeof(dev->rel_bits)), dev->rel_bits) < 0 ||
+	    ioctl(dev->fd, EVIOCGBIT(EV_FF, sizeof(dev->ff_bits)), dev->ff_bits) < 0)
+		goto fail;
+
+	/* Without the number of effects, nothing is cached */
+	if (ioctl(dev->fd, EVIOCGEFFECTS, &dev->n_effects) < 0 ||
+	    dev->n_effects < 0)
+		dev->n_effects = 0;
+
+	if (dev->n_effects) {
+		dev->slots = calloc(dev->n_effects, sizeof(*dev->slots));
+		dev->cached = calloc(dev->n_effects, 1);
+		if (!dev->slots || !dev->cached)
+			goto fail;
+	}
+
+	return 0;
+
+fail:
+	err = errno;
+	free(dev->slots);
+	free(dev->cached);
+	close(dev->fd);
+	dev->fd = -1;
+	errno = err;
+	return -1;
+}
+
+static int same_envelope(const struct ff_envelope *a, const struct ff_envelope *b)
+{
+	return a->attack_length == b->attack_length &&
+	       a->attack_level == b->attack_level &&
+	       a->fade_length == b->fade_length &&
+	       a->fade_level == b->fade_level;
+}
+
+/* Compares the parameters the effect's type uses, field by field: the
+   rest of the union, and the padding, may hold anything */
+static int same_effect(const struct ff_effect *a, const struct ff_effect *b)
+{
+	if (a->type != b->type || a->direction != b->direction ||
+	    a->trigger.button != b->trigger.button ||
+	    a->trigger.interval != b->trigger.interval ||
+	    a->replay.length != b->replay.length ||
+	    a->replay.delay != b->replay.delay)
+		return 0;
+
+	switch (a->type) {
+	case FF_CONSTANT:
+		return a->u.constant.level == b->u.constant.level &&
+		       same_envelope(&a->u.constant.envelope,
+				     &b->u.constant.envelope);
+	case FF_RAMP:
+		return a->u.ramp.start_level == b->u.ramp.start_level &&
+		       a->u.ramp.end_level == b->u.ramp.end_level &&
+		       same_envelope(&a->u.ramp.envelope, &b->u.ramp.envelope);
+	case FF_PERIODIC:
+		/* The custom data may have changed behind the pointer */
+		return !a->u.periodic.custom_len && !b->u.periodic.custom_len &&
+		       a->u.periodic.waveform == b->u.periodic.waveform &&
+		       a->u.periodic.period == b->u.periodic.period &&
+		       a->u.periodic.magnitude == b->u.periodic.magnitude &&
+		       a->u.periodic.offset == b->u.periodic.offset &&
+		       a->u.periodic.phase == b->u.periodic.phase &&
+		       same_envelope(&a->u.periodic.envelope,
+				     &b->u.periodic.envelope);
+	case FF_SPRING:
+	case FF_FRICTION:
+	case FF_DAMPER:
+	case FF_INERTIA:
+		return !memcmp(a->u.condition, b->u.condition,
+			       sizeof(a->u.condition));
+	case FF_RUMBLE:
+		return a->u.rumble.strong_magnitude == b->u.rumble.strong_magnitude &&
+		       a->u.rumble.weak_magnitude == b->u.rumble.weak_magnitude;
+	default:
+		return 0;
+	}
+}
+
+static int cacheable(const struct ffdev *dev, int id)
+{
+	return id >= 0 && id < dev->n_effects;
+}
+
+int ffdev_upload(struct ffdev *dev, struct ff_effect *effect)
+{
+	int id = effect->id;
+
+	if (cacheable(dev, id) && dev->cached[id] &&
+	    same_effect(&dev->slots[id], effect))
+		return 0;
+
+	return ffdev_send(dev, effect);
+}
+
+int ffdev_send(struct ffdev *dev, struct ff_effect *effect)
+{
+	int id = effect->id;
+
+	if (dev->trace) {
+		struct fftrace_record r;
+		int failed;
+
+		r.time = fftrace_now(dev->trace);
+		r.type = FFTRACE_UPLOAD;
+		r.id = id;
+		failed = ioctl(dev->fd, EVIOCSFF, effect) < 0;
+		r.effect = *effect;
+		trace(dev, &r, failed);
+		if (failed)
+			goto fail;
+	} else if (ioctl(dev->fd, EVIOCSFF, effect) < 0) {
+		goto fail;
+	}
+
+	if (cacheable(dev, effect->id)) {
+		dev->slots[effect->id] = *effect;
+		dev->cached[effect->id] = 1;
+	}
+	return 0;
+
+fail:
+	/* Whatever the device holds now, upload it next time */
+	if (cacheable(dev, id))
+		dev->cached[id] = 0;
+	return -1;
+}
+
+int ffdev_remove(struct ffdev *dev, struct ff_effect *effect)
+{
+	struct fftrace_record r;
+	int failed;
+
+	if (dev->trace)
+		r.time = fftrace_now(dev->trace);
+	failed = ioctl(dev->fd, EVIOCRMFF, effect->id) < 0;
+
+	if (dev->trace) {
+		r.type = FFTRACE_REMOVE;
+		r.id = effect->id;
+		trace(dev, &r, failed);
+	}
+	if (failed)
+		return -1;
+
+	if (cacheable(dev, effect->id))
+		dev->cached[effect->id] = 0;
+	effect->id = -1;
+	return 0;
+}
+
+int ffdev_flush(struct ffdev *dev)
+{
+	ssize_t size = dev->queued * sizeof(*dev->queue);
+	ssize_t written;
+	struct fftrace_record r;
+	int i, failed;
+
+	if (!dev->queued)
+		return 0;
+
+	if (dev->trace)
+		r.time = fftrace_now(dev->trace);
+
+	written = write(dev->fd, dev->queue, size);
+	failed = written != size;
+	if (failed && written >= 0)
+		errno = EIO;
+
+	/* The events were written together, so at the same time */
+	if (dev->trace) {
+		r.type = FFTRACE_EVENT;
+		for (i = 0; i < dev->queued; i++) {
+			r.code = dev->queue[i].code;
+			r.value = dev->queue[i].value;
+			trace(dev, &r, failed);
+		}
+	}
+
+	dev->queued = 0;
+	return failed ? -1 : 0;
+}
+
+int ffdev_queue(struct ffdev *dev, int code, int value)
+{
+	struct input_event *ev;
+
+	if (dev->queued == FFDEV_BATCH && ffdev_flush(dev) < 0)
+		return -1;
+
+	ev = &dev->queue[dev->queued++];
+	memset(ev, 0, sizeof(*ev));
+	ev->type = EV_FF;
+	ev->code = code;
+	ev->value = value;
+	return 0;
+}
+
+int ffdev_play(struct ffdev *dev, const struct ff_effect *effect, int count)
+{
+	return ffdev_queue(dev, effect->id, count);
+}
+
+int ffdev_stop(struct ffdev *dev, const struct ff_effect *effect)
+{
+	return ffdev_queue(dev, effect->id, 0);
+}
+
+static int run_step(struct ffdev *dev, struct ffdev_step *step)
+{
+	switch (step->action) {
+	case FFDEV_UPLOAD:
+	case FFDEV_REMOVE:
+		/* Queued events go first, in order */
+		if (ffdev_flush(dev) < 0)
+			return -1;
+		if (step->action == FFDEV_UPLOAD)
+			return ffdev_upload(dev, step->effect);
+		return ffdev_remove(dev, step->effect);
+	case FFDEV_PLAY:
+		return ffdev_play(dev, step->effect, step->value);
+	case FFDEV_STOP:
+		return ffdev_stop(dev, step->effect);
+	case FFDEV_GAIN:
+		return ffdev_queue(dev, FF_GAIN, step->value);
+	case FFDEV_AUTOCENTER:
+		return ffdev_queue(dev, FF_AUTOCENTER, step->value);
+	}
+	errno = EINVAL;
+	return -1;
+}
+
+int ffdev_run(struct ffdev *dev, struct ffdev_step *steps, int n)
+{
+	struct timespec start, when;
+	int i, queued = 0, err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	for (i = 0; i < n; i++) {
+		/* Wait for the step, unless it is at the same time as the
+		   previous one */
+		if (i == 0 || steps[i].at != steps[i - 1].at) {
+			if (ffdev_flush(dev) < 0)
+				return queued;
+
+			when.tv_sec = start.tv_sec + steps[i].at / 1000;
+			when.tv_nsec = start.tv_nsec + steps[i].at % 1000 * 1000000;
+			if (when.tv_nsec >= 1000000000) {
+				when.tv_sec++;
+				when.tv_nsec -= 1000000000;
+			}
+			err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					      &when, NULL);
+			if (err) {
+				errno = err;
+				return i;
+			}
+		}
+
+		/* A failed write fails all the steps which queued it, so
+		   the writes a step would make are made here */
+		if ((dev->queued == FFDEV_BATCH ||
+		     steps[i].action == FFDEV_UPLOAD ||
+		     steps[i].action == FFDEV_REMOVE) && ffdev_flush(dev) < 0)
+			return queued;
+		if (!dev->queued)
+			queued = i;
+
+		if (run_step(dev, &steps[i]) < 0)
+			return i;
+	}
+
+	if (ffdev_flush(dev) < 0)
+		return queued;
+	return n;
+}
+
+int ffdev_close(struct ffdev *dev)
+{
+	int ret = 0;
+
+	ffdev_flush(dev);
+	if (dev->trace) {
+		ret = fftrace_close(dev->trace);
+		free(dev->trace);
+		dev->trace = NULL;
+	}
+	free(dev->slots);
+	free(dev->cached);
+	close(dev->fd);
+	dev->fd = -1;
+	return ret;
+}
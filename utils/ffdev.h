@@ -0,0 +1,109 @@
+/*
+ * Force feedback device access, shared by the ff* utilities.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __FFDEV_H__
+#define __FFDEV_H__
+
+#include <linux/input.h>
+
+#include "fftrace.h"
+
+/* Play, stop, gain and autocenter events are queued and written this
+   many at a time at most, in one write() */
+#define FFDEV_BATCH	32
+
+struct ffdev {
+	int fd;
+	unsigned char ev_bits[1 + EV_MAX/8];
+	unsigned char key_bits[1 + KEY_MAX/8];
+	unsigned char abs_bits[1 + ABS_MAX/8];
+	unsigned char rel_bits[1 + REL_MAX/8];
+	unsigned char ff_bits[1 + FF_MAX/8];
+	int n_effects;		/* effects the device holds, 0 if unknown */
+	/* The effects as last uploaded, by id, so that uploading one
+	   unchanged can be skipped */
+	struct ff_effect *slots;
+	unsigned char *cached;
+	struct input_event queue[FFDEV_BATCH];
+	int queued;
+	struct fftrace *trace;	/* what is sent to the device, if set */
+};
+
+/* What a step of a sequence does */
+enum ffdev_action {
+	FFDEV_UPLOAD,		/* upload the effect, setting its id */
+	FFDEV_PLAY,		/* play the effect value times */
+	FFDEV_STOP,		/* stop the effect */
+	FFDEV_REMOVE,		/* remove the effect, resetting its id */
+	FFDEV_GAIN,		/* set the gain to value, 0 to 0xffff */
+	FFDEV_AUTOCENTER	/* set the autocenter strength likewise */
+};
+
+/* A step of a timed sequence of effects */
+struct ffdev_step {
+	unsigned long at;	/* ms after the start of the sequence */
+	enum ffdev_action action;
+	struct ff_effect *effect;
+	int value;
+};
+
+/* Opens the event device for reading and writing, with any extra open()
+   flags, and queries its features. Returns -1 on error, with errno
+   set. */
+int ffdev_open(struct ffdev *dev, const char *path, int flags);
+
+/* Records everything sent to the device from now on to a trace, until
+   it is closed. Returns -1 on error. */
+int ffdev_record(struct ffdev *dev, const char *path);
+
+/* Uploads an effect, a new one if its id is -1, else over the one with
+   that id. Nothing is sent if the device has that effect already, with
+   the same parameters. Returns -1 on error. */
+int ffdev_upload(struct ffdev *dev, struct ff_effect *effect);
+
+/* Uploads an effect as ffdev_upload() does, but sends it even if the
+   device has it already. Returns -1 on error. */
+int ffdev_send(struct ffdev *dev, struct ff_effect *effect);
+
+/* Removes an effect from the device, and sets its id to -1. */
+int ffdev_remove(struct ffdev *dev, struct ff_effect *effect);
+
+/* Queues an EV_FF event: playing (value is the count) or stopping
+   (value 0) the effect with that id, or setting FF_GAIN or
+   FF_AUTOCENTER. The queue is written when full, or by ffdev_flush().
+   Returns -1 if that write failed. */
+int ffdev_queue(struct ffdev *dev, int code, int value);
+
+int ffdev_play(struct ffdev *dev, const struct ff_effect *effect, int count);
+int ffdev_stop(struct ffdev *dev, const struct ff_effect *effect);
+
+/* Writes the queued events, all in one write(). Returns -1 on error;
+   the events are dropped either way. */
+int ffdev_flush(struct ffdev *dev);
+
+/* Runs a sequence of steps, ordered by time, waiting for each; steps
+   at the same time are done together, their events in one write().
+   Returns the number of steps done, fewer than n if one failed, with
+   errno set. */
+int ffdev_run(struct ffdev *dev, struct ffdev_step *steps, int n);
+
+/* Flushes the queue, closes the trace if any and the device. Returns
+   -1 if the trace couldn't be written. */
+int ffdev_close(struct ffdev *dev);
+
+#endif
@@ -1,8 +1,7 @@
 /*
  * Tests the force feedback driver
- * Opens a window. When the user clicks in the window, a force effect
- * is generated according to the position of the mouse.
- * This program needs the SDL library (http://www.libsdl.org)
+ * Reads a pointer device. While a button is held, a force effect is
+ * generated according to the position of the pointer.
  * Copyright 2001 Johann Deneux <deneux@ifrance.com>
  */
 
@@ -26,32 +25,60 @@
  * Johann Deneux <deneux@ifrance.com>
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/stat.h>
 #include <sys/ioctl.h>
-#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 #include <math.h>
 #include <linux/input.h>
-#include <SDL.h>
 
-#define BIT(x) (1<<(x))
+#include "bitmaskros.h"
+#include "ffdev.h"
+
+/* The pointer moves in a virtual window this big; relative motion
+   moves it a unit per count */
 #define	WIN_W	400
 #define WIN_H	400
 #define max(a,b)	((a)>(b)?(a):(b))
 
-/* File descriptor of the force feedback /dev entry */
-static int ff_fd;
+/* Events read at once */
+#define EVENT_BATCH	64
+
+/* The force feedback /dev entry */
+static struct ffdev ff_dev;
 static struct ff_effect effect;
 
+/* The pointer device, read directly */
+static struct pointer {
+	int fd;
+	int rel;			/* moves by EV_REL, else by EV_ABS */
+	struct input_absinfo abs[2];	/* of ABS_X and ABS_Y */
+	double x, y;			/* in the window */
+	int buttons;			/* held */
+	int dx, dy;			/* EV_REL motion in this frame */
+	int moved;			/* anything changed in this frame */
+	int dropped;			/* events lost, skip to the next frame */
+} pointer;
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void interrupt(int sig)
+{
+	interrupted = 1;
+}
+
 static void welcome()
 {
 	const char* txt[] = {
 "ffmvforce: test orientation of forces",
-"Click in the window to generate a force whose direction will be the position",
-"of your mouse relatively to the center of the window",
+"Hold a button of the pointer device to generate a force whose direction will",
+"be the position of the pointer relatively to the center of its range",
 "USE WITH CARE !!! HOLD STRONGLY YOUR WHEEL OR JOYSTICK TO PREVENT DAMAGES",
 "To run this program, run it with at least one argument.",
 "",
@@ -65,6 +92,14 @@ NULL };
 	}
 }
 
+static long long now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
 static void generate_force(int x, int y)
 {
 	static int first = 1;
@@ -74,11 +109,13 @@ static void generate_force(int x, int y)
 	nx = 2*(x-WIN_W/2.0)/WIN_W;
 	ny = 2*(y-WIN_H/2.0)/WIN_H;
 	angle = atan2(nx, -ny);
-printf("mouse: %d %d n: %4.2f %4.2f angle: %4.2f\n", x, y, nx, ny, angle);
 	effect.type = FF_CONSTANT;
         effect.u.constant.level = 0x7fff * max(fabs(nx), fabs(ny));
         effect.direction = 0x8000 * (angle + M_PI)/M_PI;
-printf("level: %04x direction: %04x\n", (unsigned int)effect.u.constant.level, (unsigned int)effect.direction);
+	printf("\rpointer: %3d %3d  angle: %5.2f  level: %04x  direction: %04x",
+	       x, y, angle, (unsigned int)effect.u.constant.level,
+	       (unsigned int)effect.direction);
+	fflush(stdout);
         effect.u.constant.envelope.attack_length = 0;
         effect.u.constant.envelope.attack_level = 0;
         effect.u.constant.envelope.fade_length = 0;
@@ -92,18 +129,15 @@ printf("level: %04x direction: %04x\n", (unsigned int)effect.u.constant.level, (
 		effect.id = -1;
 	}
 
-        if (ioctl(ff_fd, EVIOCSFF, &effect) < 0) {
+	/* Only sent if the force changed */
+        if (ffdev_upload(&ff_dev, &effect) < 0) {
 /* If updates are sent to frequently, they can be refused */
         }
 
 	/* If first time, start to play the effect */
 	if (first) {
-		struct input_event play;
-		play.type = EV_FF;
-		play.code = effect.id;
-		play.value = 1;
-
-		if (write(ff_fd, (const void*) &play, sizeof(play)) == -1) {
+		if (ffdev_play(&ff_dev, &effect, 1) == -1 ||
+		    ffdev_flush(&ff_dev) == -1) {
 			perror("Play effect");
 			exit(1);
 		}
@@ -112,12 +146,151 @@ printf("level: %04x direction: %04x\n", (unsigned int)effect.u.constant.level, (
 	first = 0;
 }
 
+static double clamp(double v, int size)
+{
+	return v < 0 ? 0 : v > size ? size : v;
+}
+
+/* Maps an absolute axis value into the window */
+static double abs_position(const struct input_absinfo *abs, int value, int size)
+{
+	if (abs->maximum <= abs->minimum)
+		return size / 2.0;
+	return clamp((double)(value - abs->minimum) * size /
+		     (abs->maximum - abs->minimum), size);
+}
+
+/* Reads the pointer's state after events were lost */
+static void resync_pointer(void)
+{
+	unsigned char keys[1 + KEY_MAX/8];
+	int i;
+
+	if (!pointer.rel) {
+		if (ioctl(pointer.fd, EVIOCGABS(ABS_X), &pointer.abs[0]) == 0)
+			pointer.x = abs_position(&pointer.abs[0],
+						 pointer.abs[0].value, WIN_W);
+		if (ioctl(pointer.fd, EVIOCGABS(ABS_Y), &pointer.abs[1]) == 0)
+			pointer.y = abs_position(&pointer.abs[1],
+						 pointer.abs[1].value, WIN_H);
+	}
+
+	memset(keys, 0, sizeof(keys));
+	ioctl(pointer.fd, EVIOCGKEY(sizeof(keys)), keys);
+	pointer.buttons = 0;
+	for (i = 0; i <= KEY_MAX; i++)
+		pointer.buttons += testBit(i, keys) != 0;
+	pointer.dx = pointer.dy = 0;
+	pointer.moved = 1;
+}
+
+/* Opens the pointer device, or uses the force feedback device if it is
+   the same, and checks it has X and Y axes */
+static void open_pointer(const char *name, const char *ff_name)
+{
+	unsigned char rel_bits[1 + REL_MAX/8];
+	unsigned char abs_bits[1 + ABS_MAX/8];
+
+	if (!name || strcmp(name, ff_name) == 0) {
+		pointer.fd = ff_dev.fd;
+		memcpy(rel_bits, ff_dev.rel_bits, sizeof(rel_bits));
+		memcpy(abs_bits, ff_dev.abs_bits, sizeof(abs_bits));
+	} else {
+		pointer.fd = open(name, O_RDONLY | O_NONBLOCK);
+		if (pointer.fd == -1) {
+			perror("Open pointer device");
+			exit(1);
+		}
+		memset(rel_bits, 0, sizeof(rel_bits));
+		memset(abs_bits, 0, sizeof(abs_bits));
+		if (ioctl(pointer.fd, EVIOCGBIT(EV_REL, sizeof(rel_bits)), rel_bits) == -1 ||
+		    ioctl(pointer.fd, EVIOCGBIT(EV_ABS, sizeof(abs_bits)), abs_bits) == -1) {
+			perror("Query pointer device");
+			exit(1);
+		}
+	}
+
+	if (testBit(REL_X, rel_bits) && testBit(REL_Y, rel_bits)) {
+		pointer.rel = 1;
+		pointer.x = WIN_W / 2.0;
+		pointer.y = WIN_H / 2.0;
+	} else if (!testBit(ABS_X, abs_bits) || !testBit(ABS_Y, abs_bits)) {
+		fprintf(stderr, "%s has no X and Y axes\n", name ? name : ff_name);
+		exit(1);
+	}
+
+	resync_pointer();
+	pointer.moved = 0;
+}
+
+/* Applies an event to the pointer; relative motion is summed over the
+   frame, and nothing is acted on before its SYN_REPORT, so all the
+   events of a frame count as one move */
+static void pointer_event(const struct input_event *ev)
+{
+	if (ev->type == EV_SYN) {
+		if (ev->code == SYN_DROPPED) {
+			pointer.dropped = 1;
+		} else if (ev->code == SYN_REPORT) {
+			if (pointer.dropped) {
+				resync_pointer();
+				pointer.dropped = 0;
+			} else if (pointer.dx || pointer.dy) {
+				pointer.x = clamp(pointer.x + pointer.dx, WIN_W);
+				pointer.y = clamp(pointer.y + pointer.dy, WIN_H);
+				pointer.dx = pointer.dy = 0;
+			}
+		}
+		return;
+	}
+
+	if (pointer.dropped)
+		return;
+
+	switch (ev->type) {
+	case EV_REL:
+		if (!pointer.rel)
+			break;
+		if (ev->code == REL_X) {
+			pointer.dx += ev->value;
+			pointer.moved = 1;
+		} else if (ev->code == REL_Y) {
+			pointer.dy += ev->value;
+			pointer.moved = 1;
+		}
+		break;
+	case EV_ABS:
+		if (pointer.rel)
+			break;
+		if (ev->code == ABS_X) {
+			pointer.x = abs_position(&pointer.abs[0], ev->value, WIN_W);
+			pointer.moved = 1;
+		} else if (ev->code == ABS_Y) {
+			pointer.y = abs_position(&pointer.abs[1], ev->value, WIN_H);
+			pointer.moved = 1;
+		}
+		break;
+	case EV_KEY:
+		/* Autorepeats don't change anything */
+		if (ev->value == 1)
+			pointer.buttons++;
+		else if (ev->value == 0 && pointer.buttons > 0)
+			pointer.buttons--;
+		pointer.moved = 1;
+		break;
+	}
+}
+
 int main(int argc, char** argv)
 {
-	SDL_Surface* screen;
 	const char * dev_name = "/dev/input/event0";
-	int i;
-	Uint32 ticks, period = 200;
+	const char * pointer_name = NULL;
+	const char * trace_name = NULL;
+	struct input_event events[EVENT_BATCH];
+	struct sigaction sa;
+	struct pollfd pfd;
+	int i, n, pending = 0, timeout;
+	long long last = 0, period = 200;
 
 	welcome();
 	if (argc <= 1) return 0;
@@ -125,8 +298,9 @@ int main(int argc, char** argv)
 	/* Parse parameters */
 	for (i=1; i<argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0) {
-			printf("Usage: %s /dev/input/eventXX [-u update frequency in HZ]\n", argv[0]);
-			printf("Generates constant force effects depending on the position of the mouse\n");
+			printf("Usage: %s /dev/input/eventXX [-p pointer device] [-u update frequency in HZ] [-r trace]\n", argv[0]);
+			printf("Generates constant force effects depending on the position of the pointer\n");
+			printf("(by default, the force feedback device's own X and Y axes)\n");
 			exit(1);
 		}
 		else if (strcmp(argv[i], "-u") == 0) {
@@ -136,49 +310,101 @@ int main(int argc, char** argv)
 			}
 			period = 1000.0/atof(argv[i]);
 		}
+		else if (strcmp(argv[i], "-r") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "Missing trace file\n");
+				exit(1);
+			}
+			trace_name = argv[i];
+		}
+		else if (strcmp(argv[i], "-p") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "Missing pointer device\n");
+				exit(1);
+			}
+			pointer_name = argv[i];
+		}
 		else {
 			dev_name = argv[i];
 		}
 	}
 
-	/* Initialize SDL */
-	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-		fprintf(stderr, "Could not initialize SDL: %s\n", SDL_GetError());
-		exit(1);
-	}
-	atexit(SDL_Quit);
-	screen = SDL_SetVideoMode(WIN_W, WIN_H, 0, SDL_SWSURFACE);
-	if (screen == NULL) {
-		fprintf(stderr, "Could not set video mode: %s\n", SDL_GetError());
-		exit(1);
-	}
-		
 	/* Open force feedback device */
-	ff_fd = open(dev_name, O_RDWR);
-	if (ff_fd == -1) {
+	if (ffdev_open(&ff_dev, dev_name, O_NONBLOCK) == -1) {
                 perror("Open device file");
 		exit(1);
 	}
 
-	ticks = SDL_GetTicks();
-	/* Main loop */
-	for (;;) {
-		SDL_Event event;
-		SDL_WaitEvent(&event);
+	if (trace_name && ffdev_record(&ff_dev, trace_name) == -1) {
+		perror("Create trace");
+		exit(1);
+	}
+
+	open_pointer(pointer_name, dev_name);
+	effect.id = -1;
 
-		switch (event.type) {
-		case SDL_QUIT:
-			exit(0);
-			break;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
-		case SDL_MOUSEMOTION:
-			if (event.motion.state && SDL_GetTicks()-ticks > period) {
-				ticks = SDL_GetTicks();
-				generate_force(event.motion.x, event.motion.y);
+	pfd.fd = pointer.fd;
+	pfd.events = POLLIN;
+
+	/* Main loop: the pointer is read as it moves, but the force is
+	   updated at most once per period, to the latest position */
+	while (!interrupted) {
+		timeout = -1;
+		if (pending) {
+			timeout = last + period - now_ms();
+			if (timeout <= 0) {
+				last = now_ms();
+				pending = 0;
+				generate_force(pointer.x, pointer.y);
+				continue;
 			}
-			
-			break;
 		}
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Poll pointer device");
+			exit(1);
+		}
+		if (!(pfd.revents & (POLLIN | POLLERR | POLLHUP)))
+			continue;
+
+		n = read(pointer.fd, events, sizeof(events));
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR)
+				continue;
+			perror("Read pointer device");
+			exit(1);
+		}
+		if (n == 0) {
+			fprintf(stderr, "Pointer device closed\n");
+			exit(1);
+		}
+
+		for (i = 0; i < n / (int)sizeof(*events); i++) {
+			pointer_event(&events[i]);
+			if (events[i].type == EV_SYN &&
+			    events[i].code == SYN_REPORT && pointer.moved) {
+				pending |= pointer.buttons > 0;
+				pointer.moved = 0;
+			}
+		}
+	}
+
+	printf("\n");
+	if (effect.id != -1 && !(ffdev_stop(&ff_dev, &effect) == 0 &&
+				 ffdev_flush(&ff_dev) == 0))
+		perror("Stop effect");
+	if (pointer.fd != ff_dev.fd)
+		close(pointer.fd);
+	if (ffdev_close(&ff_dev) == -1) {
+		perror("Write trace");
+		return 1;
 	}
 
 	return 0;
@@ -0,0 +1,446 @@
+/*
+ * ffreplay.c
+ *
+ * Replays force feedback traces
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/*
+ * A trace, recorded by the ff* utilities with their record option, holds
+ * each effect upload and removal and each event written to the device,
+ * with the time it happened. Replaying it does the same to another
+ * device, at the same times: the effect ids the device gives are mapped
+ * to those recorded, and events written together are written together
+ * again. How late each record is issued, and how long the device takes
+ * to handle it, are reported, with the records which fail when they
+ * didn't when recorded, or the reverse.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/input.h>
+
+#include "bitmaskros.h"
+#include "ffdev.h"
+#include "fftrace.h"
+#include "histogram.h"
+
+/* Effect ids mapped, from those recorded to those of the device */
+#define MAX_IDS		1024
+
+static const char *effect_names[] = {
+	"rumble", "periodic", "constant", "spring",
+	"friction", "damper", "inertia", "ramp"
+};
+
+/* What replaying took, in ns */
+struct replay_stats {
+	struct histogram drift;		/* issuing each record late */
+	struct histogram upload;	/* uploading new effects */
+	struct histogram update;	/* updating them */
+	struct histogram remove;
+	struct histogram write;		/* writing events */
+	unsigned long records, failed, mismatched, unmapped;
+	int64_t end_drift;
+};
+
+static volatile sig_atomic_t interrupted = 0;
+static int verbose = 0;
+
+static void interrupt(int sig)
+{
+	interrupted = 1;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_time(struct histogram *h, int64_t start)
+{
+	int64_t t = now_ns() - start;
+
+	hist_add(h, t < 0 ? 0 : t > UINT32_MAX ? UINT32_MAX : t);
+}
+
+static const char *effect_name(int type)
+{
+	if (type >= FF_EFFECT_MIN && type <= FF_EFFECT_MAX)
+		return effect_names[type - FF_EFFECT_MIN];
+	return "unknown";
+}
+
+static void print_record(FILE *f, const struct fftrace_record *r)
+{
+	fprintf(f, "%12.6f ", r->time / 1e6);
+
+	switch (r->type) {
+	case FFTRACE_UPLOAD:
+		fprintf(f, "upload %s id %d -> %d", effect_name(r->effect.type),
+			r->id, r->effect.id);
+		break;
+	case FFTRACE_REMOVE:
+		fprintf(f, "remove id %d", r->id);
+		break;
+	case FFTRACE_EVENT:
+		if (r->code == FF_GAIN)
+			fprintf(f, "gain %d", r->value);
+		else if (r->code == FF_AUTOCENTER)
+			fprintf(f, "autocenter %d", r->value);
+		else if (r->value)
+			fprintf(f, "play id %d count %d", r->code, r->value);
+		else
+			fprintf(f, "stop id %d", r->code);
+		break;
+	}
+
+	if (r->error)
+		fprintf(f, " (%s)", strerror(r->error));
+	fputc('\n', f);
+}
+
+/* Prints the records of a trace */
+static int print_trace(const char *path)
+{
+	struct fftrace t;
+	struct fftrace_record r;
+	unsigned long n = 0;
+
+	if (fftrace_open(&t, path)) {
+		fprintf(stderr, "ffreplay: %s: %s\n", path,
+			errno ? strerror(errno) : "not a force feedback trace");
+		return 1;
+	}
+
+	printf("Device: %s, %d effects\n", t.name, t.n_effects);
+	while (fftrace_read(&t, &r) == 0) {
+		print_record(stdout, &r);
+		n++;
+	}
+	printf("%lu records.\n", n);
+
+	fftrace_close(&t);
+	return 0;
+}
+
+/* Counts a record which fails now but didn't when recorded, or the
+   reverse */
+static void check(struct replay_stats *stats, const struct fftrace_record *r,
+		  int failed, int err)
+{
+	stats->failed += failed;
+	if (failed == (r->error != 0))
+		return;
+
+	stats->mismatched++;
+	if (verbose) {
+		fprintf(stderr, "%s: ", failed ? strerror(err) : "succeeded");
+		print_record(stderr, r);
+	}
+}
+
+static int map_id(const int *map, int id)
+{
+	return id >= 0 && id < MAX_IDS ? map[id] : -1;
+}
+
+/* Writes the queued events, checking them against the recorded ones */
+static void flush(struct ffdev *dev, struct replay_stats *stats,
+		  const struct fftrace_record *batch, int n)
+{
+	int64_t start;
+	int failed, err, i;
+
+	if (!n)
+		return;
+
+	start = now_ns();
+	failed = ffdev_flush(dev) < 0;
+	err = errno;
+	add_time(&stats->write, start);
+
+	for (i = 0; i < n; i++)
+		check(stats, &batch[i], failed, err);
+}
+
+static void replay_upload(struct ffdev *dev, int *map,
+			  struct replay_stats *stats,
+			  const struct fftrace_record *r)
+{
+	struct ff_effect effect = r->effect;
+	int64_t start;
+	int failed, err, *mapped;
+
+	effect.id = r->id == -1 ? -1 : map_id(map, r->id);
+	if (r->id != -1 && effect.id == -1) {
+		stats->unmapped++;
+		return;
+	}
+
+	/* Everything traced was sent, so it is sent again, bypassing the
+	   cache of uploaded effects */
+	start = now_ns();
+	failed = ioctl(dev->fd, EVIOCSFF, &effect) < 0;
+	err = errno;
+	add_time(r->id == -1 ? &stats->upload : &stats->update, start);
+	check(stats, r, failed, err);
+
+	if (failed || r->id != -1)
+		return;
+
+	/* A new effect the trace has no id for, as it failed when recorded,
+	   is never referred to again: it is erased rather than left taking
+	   up room on the device. An effect the id was given to before has
+	   been removed when recorded, even if that failed now. */
+	if (r->error || r->effect.id < 0 || r->effect.id >= MAX_IDS) {
+		ioctl(dev->fd, EVIOCRMFF, effect.id);
+		return;
+	}
+	mapped = &map[r->effect.id];
+	if (*mapped != -1)
+		ioctl(dev->fd, EVIOCRMFF, *mapped);
+	*mapped = effect.id;
+}
+
+static void replay_remove(struct ffdev *dev, int *map,
+			  struct replay_stats *stats,
+			  const struct fftrace_record *r)
+{
+	int id = map_id(map, r->id);
+	int64_t start;
+	int failed, err;
+
+	if (id == -1) {
+		stats->unmapped++;
+		return;
+	}
+
+	start = now_ns();
+	failed = ioctl(dev->fd, EVIOCRMFF, id) < 0;
+	err = errno;
+	add_time(&stats->remove, start);
+	check(stats, r, failed, err);
+
+	if (!failed)
+		map[r->id] = -1;
+}
+
+/* Replays the trace, speed times faster than recorded. Returns the time
+   it took, in ns. */
+static int64_t replay(struct fftrace *t, struct ffdev *dev, double speed,
+		  struct replay_stats *stats)
+{
+	struct fftrace_record r, batch[FFDEV_BATCH];
+	struct timespec when;
+	int map[MAX_IDS];
+	int64_t start, target = 0;
+	uint64_t previous = 0;
+	int i, n = 0, code, err;
+
+	for (i = 0; i < MAX_IDS; i++)
+		map[i] = -1;
+
+	start = now_ns();
+	while (!interrupted && fftrace_read(t, &r) == 0) {
+		stats->records++;
+
+		/* Events written together are queued together */
+		if (r.type == FFTRACE_EVENT && n && n < FFDEV_BATCH &&
+		    r.time == previous) {
+			batch[n++] = r;
+			goto queue;
+		}
+
+		flush(dev, stats, batch, n);
+		n = 0;
+
+		target = start + (int64_t)(r.time * 1000 / speed);
+		when.tv_sec = target / 1000000000;
+		when.tv_nsec = target % 1000000000;
+		err = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &when,
+				      NULL);
+		if (err == EINTR)
+			break;
+		add_time(&stats->drift, target);
+		previous = r.time;
+
+		switch (r.type) {
+		case FFTRACE_UPLOAD:
+			replay_upload(dev, map, stats, &r);
+			continue;
+		case FFTRACE_REMOVE:
+			replay_remove(dev, map, stats, &r);
+			continue;
+		case FFTRACE_EVENT:
+			batch[n++] = r;
+			break;
+		}
+
+queue:
+		/* Gain and autocenter aren't effect ids */
+		code = r.code;
+		if (code != FF_GAIN && code != FF_AUTOCENTER) {
+			code = map_id(map, code);
+			if (code == -1) {
+				stats->unmapped++;
+				n--;
+				continue;
+			}
+		}
+		ffdev_queue(dev, code, r.value);
+	}
+
+	flush(dev, stats, batch, n);
+	if (stats->records)
+		stats->end_drift = now_ns() - target;
+
+	return now_ns() - start;
+}
+
+/* Prints the percentiles of a histogram in ns, in us */
+static void print_percentiles(const char *what, const struct histogram *h)
+{
+	if (!h->count)
+		return;
+	printf("  %-8s %7lu  p50 %9.1f  p90 %9.1f  p99 %9.1f  max %9.1f us\n",
+	       what, h->count, hist_percentile(h, 50) / 1e3,
+	       hist_percentile(h, 90) / 1e3, hist_percentile(h, 99) / 1e3,
+	       h->max / 1e3);
+}
+
+static void usage(void)
+{
+	puts("Usage: ffreplay [-s <speed>] [-v] <trace> <device>");
+	puts("       ffreplay --print <trace>");
+	puts("");
+	puts("Replays a force feedback trace on a device, at the times it was");
+	puts("recorded, and reports the timing.");
+	puts("");
+	puts("  -s, --speed <speed>  replays that many times faster (default 1)");
+	puts("  -v, --verbose        prints the records which fail when they");
+	puts("                       didn't when recorded, or the reverse");
+	puts("  -p, --print          prints the records of the trace");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_options[] = {
+		{ "speed", required_argument, NULL, 's' },
+		{ "verbose", no_argument, NULL, 'v' },
+		{ "print", no_argument, NULL, 'p' },
+		{ "help", no_argument, NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct replay_stats stats;
+	struct sigaction sa;
+	struct fftrace t;
+	struct ffdev dev;
+	double speed = 1;
+	int print = 0, c, i;
+	int64_t took;
+
+	while ((c = getopt_long(argc, argv, "s:vph", long_options, NULL)) != -1) {
+		switch (c) {
+		case 's':
+			speed = atof(optarg);
+			if (speed <= 0) {
+				fprintf(stderr, "ffreplay: bad speed %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'p':
+			print = 1;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+
+	if (print) {
+		if (argc - optind != 1) {
+			usage();
+			return 1;
+		}
+		return print_trace(argv[optind]);
+	}
+
+	if (argc - optind != 2) {
+		usage();
+		return 1;
+	}
+
+	if (fftrace_open(&t, argv[optind])) {
+		fprintf(stderr, "ffreplay: %s: %s\n", argv[optind],
+			errno ? strerror(errno) : "not a force feedback trace");
+		return 1;
+	}
+
+	if (ffdev_open(&dev, argv[optind + 1], 0)) {
+		fprintf(stderr, "ffreplay: %s: %s\n", argv[optind + 1],
+			strerror(errno));
+		return 1;
+	}
+
+	/* Differences which will make records fail */
+	if (dev.n_effects && dev.n_effects < t.n_effects)
+		printf("The device holds %d effects, the traced one %d\n",
+		       dev.n_effects, t.n_effects);
+	for (i = FF_EFFECT_MIN; i <= FF_EFFECT_MAX; i++)
+		if (testBit(i, t.ff_bits) && !testBit(i, dev.ff_bits))
+			printf("The device has no %s effects\n", effect_name(i));
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	memset(&stats, 0, sizeof(stats));
+	took = replay(&t, &dev, speed, &stats);
+
+	printf("Replayed %lu records traced on %s, over %.3f s, in %.3f s\n",
+	       stats.records, t.name[0] ? t.name : "an unnamed device",
+	       t.time / 1e6, took / 1e9);
+	printf("Ended %.3f ms late\n", stats.end_drift / 1e6);
+	print_percentiles("drift", &stats.drift);
+	print_percentiles("upload", &stats.upload);
+	print_percentiles("update", &stats.update);
+	print_percentiles("remove", &stats.remove);
+	print_percentiles("write", &stats.write);
+	printf("%lu failed, %lu not as traced, %lu for effects never uploaded\n",
+	       stats.failed, stats.mismatched, stats.unmapped);
+
+	fftrace_close(&t);
+	ffdev_close(&dev);
+
+	return stats.mismatched || stats.unmapped ? 1 : 0;
+}
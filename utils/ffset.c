@@ -23,27 +23,25 @@
  * Johann Deneux <deneux@ifrance.com>
  */
 
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
 #include <linux/input.h>
-#include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "ffdev.h"
+
 int main(int argc, char** argv)
 {
-	int fd;
+	struct ffdev dev;
 	const char * device_file_name = "/dev/input/event0";
+	const char * trace_file_name = NULL;
 	int i;
 	int gain = -1;
 	int autocenter = -1;
 
 	for (i=1; i<argc; ++i) {
 		if (strcmp(argv[i], "--help") == 0) {
-			printf("Usage: %s /dev/input/eventXX [-g gain] [-a autocenter_strength]\n", argv[0]);
+			printf("Usage: %s /dev/input/eventXX [-g gain] [-a autocenter_strength] [-r trace]\n", argv[0]);
 			printf("Sets the gain and the autocenter of a force-feedback device\n");
 			printf("Values should belong to 0 to 100\n");
 			exit(1);
@@ -55,6 +53,13 @@ int main(int argc, char** argv)
 			}
 			gain = atoi(argv[i]);
 		}
+		else if (strcmp(argv[i], "-r") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "Missing trace file\n");
+				exit(1);
+			}
+			trace_file_name = argv[i];
+		}
 		else if (strcmp(argv[i], "-a") == 0) {
 			if (++i >= argc) {
 				fprintf(stderr, "Missing auto-center value\n");
@@ -72,30 +77,30 @@ int main(int argc, char** argv)
 	}
 
 	/* Open device */
-	fd = open(device_file_name, O_RDWR);
-	if (fd == -1) {
+	if (ffdev_open(&dev, device_file_name, 0) == -1) {
 		perror("Open device file");
 		exit(1);
 	}
 	printf("Device %s opened\n", device_file_name);
 
-	if (autocenter >= 0 && autocenter <= 100) {
-		struct input_event ie;
-		ie.type = EV_FF;
-		ie.code = FF_AUTOCENTER;
-		ie.value = 0xFFFFUL * autocenter / 100;
-		if (write(fd, &ie, sizeof(ie)) == -1)
-			perror("set auto-center");
+	if (trace_file_name && ffdev_record(&dev, trace_file_name) == -1) {
+		perror("Create trace");
+		exit(1);
 	}
 
-	if (gain >= 0 && gain <= 100) {
-		struct input_event ie;
-		ie.type = EV_FF;
-		ie.code = FF_GAIN;
-		ie.value = 0xFFFFUL * gain / 100;
-		if (write(fd, &ie, sizeof(ie)) == -1)
-			perror("set gain");
-	}
+	/* Both are set in one write */
+	if (autocenter >= 0 && autocenter <= 100)
+		ffdev_queue(&dev, FF_AUTOCENTER, 0xFFFFUL * autocenter / 100);
+
+	if (gain >= 0 && gain <= 100)
+		ffdev_queue(&dev, FF_GAIN, 0xFFFFUL * gain / 100);
+
+	if (ffdev_flush(&dev) == -1)
+		perror("set auto-center/gain");
 
+	if (ffdev_close(&dev) == -1) {
+		perror("Write trace");
+		exit(1);
+	}
 	exit(0);
 }
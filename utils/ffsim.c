@@ -0,0 +1,710 @@
+/*
+ * ffsim.c
+ *
+ * Virtual force feedback device, for testing the ff utilities
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/*
+ * ffsim creates a joystick with force feedback through uinput, and
+ * plays the part of its driver: it takes the effects uploaded to the
+ * device and removed from it, in as many slots as it was told to have,
+ * and plays and stops them, with the gain and autocenter set. The stick
+ * has an X axis, moved by the forces of the effects playing, by a
+ * simple model: a mass on a rail with viscous friction, pulled back to
+ * the center by the autocenter spring. Its position is reported as it
+ * changes, so that ffcfstress, whose spring follows the position, sees
+ * its force acting.
+ *
+ * What the device was asked to do is counted, and printed on SIGUSR1,
+ * every --stats seconds, and when ffsim is interrupted; how long
+ * handling each upload took is kept in a histogram. The event device
+ * created is printed first, for scripts to run the ff utilities on.
+ */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "histogram.h"
+
+#define SIM_NAME	"ffsim virtual force feedback joystick"
+#define SIM_VENDOR	0x0001
+#define SIM_PRODUCT	0xff51
+#define SIM_EFFECTS	16
+#define SIM_MAX_EFFECTS	256
+#define SIM_RATE	1000	/* Hz of the physics model */
+#define SIM_FORCE	100.0	/* acceleration at full force, ranges/s^2 */
+#define SIM_DAMPING	10.0	/* viscous friction, 1/s */
+#define SIM_AXIS_MAX	32767
+
+/* Events read at once */
+#define SIM_BATCH	64
+
+/* Options */
+static const char *name = SIM_NAME;
+static int n_effects = SIM_EFFECTS;
+static int rate = SIM_RATE;
+static double force_scale = SIM_FORCE;
+static double damping = SIM_DAMPING;
+static int latency;		/* us spent handling each upload */
+static double stats_interval;	/* s */
+static int verbose;
+
+/* An effect slot */
+struct slot {
+	int used;
+	struct ff_effect effect;
+	int count;		/* plays left, 0 if stopped */
+	double started;		/* s, when the current play starts */
+};
+
+/* What the device was asked to do */
+struct counters {
+	unsigned long uploads, updates, rejected, erases;
+	unsigned long plays, stops, gains, autocenters, events;
+	unsigned long ticks, positions;
+	struct histogram upload;	/* handling an upload or erase, ns */
+};
+
+static struct sim {
+	int fd;
+	struct slot slots[SIM_MAX_EFFECTS];
+	unsigned int gain, autocenter;
+	double position, velocity, acceleration;	/* of X, in ranges */
+	int reported;		/* the position last reported */
+	struct counters count;
+} sim;
+
+static volatile sig_atomic_t interrupted, dump;
+
+static void interrupt(int sig)
+{
+	interrupted = 1;
+}
+
+static void request_dump(int sig)
+{
+	dump = 1;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void send_event(int type, int code, int value)
+{
+	struct input_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.code = code;
+	ev.value = value;
+	if (write(sim.fd, &ev, sizeof(ev)) != sizeof(ev))
+		perror("ffsim: write");
+}
+
+/* Creates the device; the setup ioctls need Linux 4.5, earlier kernels
+   take a struct uinput_user_dev written to the device */
+static int create_device(void)
+{
+	static const int ff[] = {
+		FF_CONSTANT, FF_PERIODIC, FF_RAMP, FF_SPRING, FF_FRICTION,
+		FF_DAMPER, FF_INERTIA, FF_RUMBLE, FF_GAIN, FF_AUTOCENTER,
+		FF_SQUARE, FF_TRIANGLE, FF_SINE, FF_SAW_UP, FF_SAW_DOWN
+	};
+	struct uinput_setup setup;
+	struct uinput_abs_setup abs;
+	struct uinput_user_dev dev;
+	int i;
+
+	sim.fd = open("/dev/uinput", O_RDWR | O_NONBLOCK);
+	if (sim.fd < 0) {
+		perror("ffsim: /dev/uinput");
+		return -1;
+	}
+
+	if (ioctl(sim.fd, UI_SET_EVBIT, EV_KEY) < 0 ||
+	    ioctl(sim.fd, UI_SET_KEYBIT, BTN_TRIGGER) < 0 ||
+	    ioctl(sim.fd, UI_SET_EVBIT, EV_ABS) < 0 ||
+	    ioctl(sim.fd, UI_SET_ABSBIT, ABS_X) < 0 ||
+	    ioctl(sim.fd, UI_SET_EVBIT, EV_FF) < 0)
+		goto fail;
+	for (i = 0; i < sizeof(ff) / sizeof(ff[0]); i++)
+		if (ioctl(sim.fd, UI_SET_FFBIT, ff[i]) < 0)
+			goto fail;
+
+	memset(&setup, 0, sizeof(setup));
+	strncpy(setup.name, name, UINPUT_MAX_NAME_SIZE - 1);
+	setup.id.bustype = BUS_VIRTUAL;
+	setup.id.vendor = SIM_VENDOR;
+	setup.id.product = SIM_PRODUCT;
+	setup.ff_effects_max = n_effects;
+
+	memset(&abs, 0, sizeof(abs));
+	abs.code = ABS_X;
+	abs.absinfo.minimum = -SIM_AXIS_MAX;
+	abs.absinfo.maximum = SIM_AXIS_MAX;
+
+	if (ioctl(sim.fd, UI_DEV_SETUP, &setup) < 0 ||
+	    ioctl(sim.fd, UI_ABS_SETUP, &abs) < 0) {
+		if (errno != EINVAL && errno != ENOTTY)
+			goto fail;
+
+		memset(&dev, 0, sizeof(dev));
+		memcpy(dev.name, setup.name, sizeof(dev.name));
+		dev.id = setup.id;
+		dev.ff_effects_max = n_effects;
+		dev.absmin[ABS_X] = -SIM_AXIS_MAX;
+		dev.absmax[ABS_X] = SIM_AXIS_MAX;
+		if (write(sim.fd, &dev, sizeof(dev)) != sizeof(dev))
+			goto fail;
+	}
+
+	if (ioctl(sim.fd, UI_DEV_CREATE) < 0)
+		goto fail;
+
+	return 0;
+
+fail:
+	perror("ffsim: creating the device");
+	close(sim.fd);
+	return -1;
+}
+
+/* Prints the event device created, found through sysfs; older kernels
+   can't say */
+static void print_device(void)
+{
+	char sysname[64], path[128];
+	struct dirent *d;
+	DIR *dir;
+
+	if (ioctl(sim.fd, UI_GET_SYSNAME(sizeof(sysname)), sysname) < 0) {
+		printf("Device created: %s\n", name);
+		return;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/virtual/input/%s", sysname);
+	if ((dir = opendir(path))) {
+		while ((d = readdir(dir)))
+			if (!strncmp(d->d_name, "event", 5))
+				break;
+		if (d)
+			printf("/dev/input/%s\n", d->d_name);
+		closedir(dir);
+	}
+	if (!dir || !d)
+		printf("Device created: %s\n", sysname);
+	fflush(stdout);
+}
+
+static int supported(const struct ff_effect *e)
+{
+	switch (e->type) {
+	case FF_CONSTANT:
+	case FF_RAMP:
+	case FF_SPRING:
+	case FF_FRICTION:
+	case FF_DAMPER:
+	case FF_INERTIA:
+	case FF_RUMBLE:
+		return 1;
+	case FF_PERIODIC:
+		return e->u.periodic.waveform >= FF_SQUARE &&
+		       e->u.periodic.waveform <= FF_SAW_DOWN;
+	}
+	return 0;
+}
+
+static void upload(int request)
+{
+	struct uinput_ff_upload up;
+	struct slot *s;
+	int64_t start = now_ns();
+
+	memset(&up, 0, sizeof(up));
+	up.request_id = request;
+	if (ioctl(sim.fd, UI_BEGIN_FF_UPLOAD, &up) < 0) {
+		perror("ffsim: UI_BEGIN_FF_UPLOAD");
+		return;
+	}
+
+	if (up.effect.id < 0 || up.effect.id >= n_effects ||
+	    !supported(&up.effect)) {
+		up.retval = -EINVAL;
+		sim.count.rejected++;
+	} else {
+		s = &sim.slots[up.effect.id];
+		if (s->used)
+			sim.count.updates++;
+		else
+			sim.count.uploads++;
+		/* Updating an effect which is playing restarts it, after
+		   its delay, as ff-memless does */
+		s->used = 1;
+		s->effect = up.effect;
+		if (s->count)
+			s->started = now_s() + up.effect.replay.delay / 1000.0;
+		up.retval = 0;
+	}
+
+	if (verbose)
+		fprintf(stderr, "upload: id %d type 0x%x: %s\n",
+			up.effect.id, up.effect.type,
+			up.retval ? "rejected" : "ok");
+
+	if (latency)
+		usleep(latency);
+
+	if (ioctl(sim.fd, UI_END_FF_UPLOAD, &up) < 0)
+		perror("ffsim: UI_END_FF_UPLOAD");
+	hist_add(&sim.count.upload, now_ns() - start);
+}
+
+static void erase(int request)
+{
+	struct uinput_ff_erase er;
+
+	memset(&er, 0, sizeof(er));
+	er.request_id = request;
+	if (ioctl(sim.fd, UI_BEGIN_FF_ERASE, &er) < 0) {
+		perror("ffsim: UI_BEGIN_FF_ERASE");
+		return;
+	}
+
+	if (er.effect_id < n_effects && sim.slots[er.effect_id].used) {
+		memset(&sim.slots[er.effect_id], 0, sizeof(struct slot));
+		sim.count.erases++;
+		er.retval = 0;
+	} else {
+		er.retval = -EINVAL;
+	}
+
+	if (verbose)
+		fprintf(stderr, "erase: id %u: %s\n", er.effect_id,
+			er.retval ? "rejected" : "ok");
+
+	if (ioctl(sim.fd, UI_END_FF_ERASE, &er) < 0)
+		perror("ffsim: UI_END_FF_ERASE");
+}
+
+/* Handles an event written to the device */
+static void ff_event(const struct input_event *ev)
+{
+	struct slot *s;
+
+	sim.count.events++;
+
+	switch (ev->type) {
+	case EV_UINPUT:
+		if (ev->code == UI_FF_UPLOAD)
+			upload(ev->value);
+		else if (ev->code == UI_FF_ERASE)
+			erase(ev->value);
+		return;
+	case EV_FF:
+		break;
+	default:
+		return;
+	}
+
+	if (ev->code == FF_GAIN) {
+		sim.gain = ev->value;
+		sim.count.gains++;
+	} else if (ev->code == FF_AUTOCENTER) {
+		sim.autocenter = ev->value;
+		sim.count.autocenters++;
+	} else if (ev->code < n_effects && sim.slots[ev->code].used) {
+		s = &sim.slots[ev->code];
+		if (ev->value) {
+			s->count = ev->value;
+			s->started = now_s() + s->effect.replay.delay / 1000.0;
+			sim.count.plays++;
+		} else {
+			s->count = 0;
+			sim.count.stops++;
+		}
+	}
+
+	if (verbose)
+		fprintf(stderr, "ff: code %d value %d\n", ev->code, ev->value);
+}
+
+/* The envelope's share of the level, at t s into a play of length s */
+static double envelope(const struct ff_envelope *env, double level,
+		       double t, double length)
+{
+	double attack = env->attack_length / 1000.0;
+	double fade = env->fade_length / 1000.0;
+	double from;
+
+	if (attack > 0 && t < attack) {
+		from = env->attack_level / 32767.0;
+		return from + (level - from) * t / attack;
+	}
+	if (fade > 0 && length > 0 && t > length - fade) {
+		from = env->fade_level / 32767.0;
+		return from + (level - from) * (length - t) / fade;
+	}
+	return level;
+}
+
+static double waveform(int shape, double phase)
+{
+	phase -= floor(phase);
+
+	switch (shape) {
+	case FF_SQUARE:
+		return phase < 0.5 ? 1 : -1;
+	case FF_TRIANGLE:
+		return phase < 0.5 ? 4 * phase - 1 : 3 - 4 * phase;
+	case FF_SINE:
+		return sin(2 * M_PI * phase);
+	case FF_SAW_UP:
+		return 2 * phase - 1;
+	case FF_SAW_DOWN:
+		return 1 - 2 * phase;
+	}
+	return 0;
+}
+
+/* The force a condition puts on the axis, given the quantity it acts on
+   (position for a spring, speed for a damper...) */
+static double condition(const struct ff_condition_effect *c, double x)
+{
+	double d = x - c->center / 32767.0;
+	double band = c->deadband / 65535.0;
+	double f;
+
+	if (fabs(d) <= band)
+		return 0;
+
+	if (d > 0)
+		f = -(d - band) * c->right_coeff / 32767.0;
+	else
+		f = -(d + band) * c->left_coeff / 32767.0;
+
+	if (f > c->right_saturation / 65535.0)
+		f = c->right_saturation / 65535.0;
+	if (f < -(c->left_saturation / 65535.0))
+		f = -(c->left_saturation / 65535.0);
+	return f;
+}
+
+/* The force of an effect along X, at t s into its play: its direction
+   is where it pushes, 0x4000 left and 0xc000 right */
+static double effect_force(const struct ff_effect *e, double t)
+{
+	double length = e->replay.length / 1000.0;
+	double x = -sin(2 * M_PI * e->direction / 65536.0);
+	double level;
+
+	switch (e->type) {
+	case FF_CONSTANT:
+		level = envelope(&e->u.constant.envelope,
+				 e->u.constant.level / 32767.0, t, length);
+		return x * level;
+	case FF_RAMP:
+		level = e->u.ramp.start_level / 32767.0;
+		if (length > 0)
+			level += (e->u.ramp.end_level - e->u.ramp.start_level) /
+				 32767.0 * t / length;
+		return x * envelope(&e->u.ramp.envelope, level, t, length);
+	case FF_PERIODIC:
+		level = envelope(&e->u.periodic.envelope,
+				 e->u.periodic.magnitude / 32767.0, t, length);
+		return x * (level * waveform(e->u.periodic.waveform,
+				t * 1000.0 / (e->u.periodic.period ? e->u.periodic.period : 1) +
+				e->u.periodic.phase / 65536.0) +
+			    e->u.periodic.offset / 32767.0);
+	case FF_SPRING:
+		return condition(&e->u.condition[0], sim.position);
+	case FF_DAMPER:
+		return condition(&e->u.condition[0], sim.velocity);
+	case FF_INERTIA:
+		return condition(&e->u.condition[0], sim.acceleration);
+	case FF_FRICTION:
+		return condition(&e->u.condition[0],
+				 sim.velocity > 0 ? 1 : sim.velocity < 0 ? -1 : 0);
+	}
+
+	/* Rumble shakes, but doesn't push */
+	return 0;
+}
+
+/* Moves the stick on by dt s, under the forces of the effects playing */
+static void step(double dt)
+{
+	double now = now_s(), force = 0, length, t, a;
+	struct slot *s;
+	int i, value;
+
+	for (i = 0; i < n_effects; i++) {
+		s = &sim.slots[i];
+		if (!s->count || now < s->started)
+			continue;
+
+		t = now - s->started;
+		length = s->effect.replay.length / 1000.0;
+		if (length > 0 && t >= length) {
+			/* Played to the end, once more if asked to */
+			if (--s->count)
+				s->started = now;
+			continue;
+		}
+		force += effect_force(&s->effect, t);
+	}
+
+	force = force * sim.gain / 65535.0 -
+		sim.position * sim.autocenter / 65535.0;
+
+	a = force * force_scale - damping * sim.velocity;
+	sim.acceleration = a;
+	sim.velocity += a * dt;
+	sim.position += sim.velocity * dt;
+	if (sim.position > 1 || sim.position < -1) {
+		sim.position = sim.position > 1 ? 1 : -1;
+		sim.velocity = 0;
+	}
+	sim.count.ticks++;
+
+	value = lrint(sim.position * SIM_AXIS_MAX);
+	if (value != sim.reported) {
+		send_event(EV_ABS, ABS_X, value);
+		send_event(EV_SYN, SYN_REPORT, 0);
+		sim.reported = value;
+		sim.count.positions++;
+	}
+}
+
+static void print_counters(void)
+{
+	const struct counters *c = &sim.count;
+	int i, used = 0, playing = 0;
+
+	for (i = 0; i < n_effects; i++) {
+		used += sim.slots[i].used;
+		playing += sim.slots[i].count > 0;
+	}
+
+	printf("uploads %lu updates %lu rejected %lu erases %lu "
+	       "plays %lu stops %lu gains %lu autocenters %lu events %lu\n",
+	       c->uploads, c->updates, c->rejected, c->erases, c->plays,
+	       c->stops, c->gains, c->autocenters, c->events);
+	printf("slots %d/%d playing %d gain %u autocenter %u "
+	       "ticks %lu positions %lu position %.4f\n",
+	       used, n_effects, playing, sim.gain, sim.autocenter,
+	       c->ticks, c->positions, sim.position);
+	if (c->upload.count)
+		printf("upload handling: p50 %.1f p99 %.1f max %.1f us\n",
+		       hist_percentile(&c->upload, 50) / 1e3,
+		       hist_percentile(&c->upload, 99) / 1e3,
+		       c->upload.max / 1e3);
+	fflush(stdout);
+}
+
+static int run(void)
+{
+	struct input_event events[SIM_BATCH];
+	struct itimerspec its;
+	struct pollfd pfd[2];
+	double last, next_stats = 0;
+	uint64_t expirations;
+	int timer, i, n;
+
+	timer = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+	if (timer < 0) {
+		perror("ffsim: timerfd_create");
+		return 1;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_interval.tv_sec = 1 / rate;
+	its.it_interval.tv_nsec = 1000000000 / rate % 1000000000;
+	its.it_value = its.it_interval;
+	if (timerfd_settime(timer, 0, &its, NULL) < 0) {
+		perror("ffsim: timerfd_settime");
+		close(timer);
+		return 1;
+	}
+
+	pfd[0].fd = sim.fd;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = timer;
+	pfd[1].events = POLLIN;
+
+	last = now_s();
+	if (stats_interval > 0)
+		next_stats = last + stats_interval;
+
+	while (!interrupted) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				goto signals;
+			perror("ffsim: poll");
+			return 1;
+		}
+
+		if (pfd[0].revents & POLLIN) {
+			n = read(sim.fd, events, sizeof(events));
+			for (i = 0; i < n / (int)sizeof(*events); i++)
+				ff_event(&events[i]);
+		}
+
+		if ((pfd[1].revents & POLLIN) &&
+		    read(timer, &expirations, sizeof(expirations)) > 0) {
+			double now = now_s();
+
+			step(now - last);
+			last = now;
+		}
+
+signals:
+		if (dump || (next_stats && now_s() >= next_stats)) {
+			print_counters();
+			dump = 0;
+			if (next_stats)
+				next_stats = now_s() + stats_interval;
+		}
+	}
+
+	close(timer);
+	return 0;
+}
+
+static void help(void)
+{
+	puts("");
+	puts("Usage: ffsim [<options>]");
+	puts("");
+	puts("Creates a virtual joystick with force feedback through uinput, and");
+	puts("plays its driver: effects are kept in slots and played, moving its");
+	puts("X axis. Counts what it was asked to do, and prints the counts on");
+	puts("SIGUSR1 and when interrupted.");
+	puts("");
+	puts("Options:");
+	puts("  -n, --name <name>       name of the device (" SIM_NAME ")");
+	puts("  -e, --effects <n>       effect slots (16)");
+	puts("  -l, --latency <us>      time taken to handle each upload (0)");
+	puts("  -r, --rate <Hz>         rate of the physics model (1000)");
+	puts("  -f, --force <a>         acceleration at full force, in ranges/s^2 (100)");
+	puts("  -d, --damping <k>       viscous friction, in 1/s (10)");
+	puts("  -s, --stats <s>         also print the counts every s seconds");
+	puts("  -v, --verbose           log each request");
+	puts("  -h, --help              this help");
+	puts("");
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{ "name",	 required_argument, NULL, 'n' },
+		{ "effects",	 required_argument, NULL, 'e' },
+		{ "latency",	 required_argument, NULL, 'l' },
+		{ "rate",	 required_argument, NULL, 'r' },
+		{ "force",	 required_argument, NULL, 'f' },
+		{ "damping",	 required_argument, NULL, 'd' },
+		{ "stats",	 required_argument, NULL, 's' },
+		{ "verbose",	 no_argument,	    NULL, 'v' },
+		{ "help",	 no_argument,	    NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	struct sigaction sa;
+	int t, ret;
+
+	while ((t = getopt_long(argc, argv, "n:e:l:r:f:d:s:vh",
+				long_options, NULL)) != -1) {
+		switch (t) {
+		case 'n': name = optarg; break;
+		case 'e': n_effects = atoi(optarg); break;
+		case 'l': latency = atoi(optarg); break;
+		case 'r': rate = atoi(optarg); break;
+		case 'f': force_scale = atof(optarg); break;
+		case 'd': damping = atof(optarg); break;
+		case 's': stats_interval = atof(optarg); break;
+		case 'v': verbose = 1; break;
+		case 'h':
+			help();
+			return 0;
+		default:
+			help();
+			return 1;
+		}
+	}
+
+	if (n_effects < 1 || n_effects > SIM_MAX_EFFECTS) {
+		fprintf(stderr, "ffsim: the number of effects must be 1 to %d\n",
+			SIM_MAX_EFFECTS);
+		return 1;
+	}
+	if (rate < 1 || rate > 1000000 || latency < 0 || damping < 0) {
+		fprintf(stderr, "ffsim: invalid option value\n");
+		return 1;
+	}
+
+	/* The device starts like most: full gain, no autocenter */
+	sim.gain = 0xffff;
+
+	if (create_device())
+		return 1;
+	print_device();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = request_dump;
+	sigaction(SIGUSR1, &sa, NULL);
+
+	ret = run();
+
+	print_counters();
+	ioctl(sim.fd, UI_DEV_DESTROY);
+	close(sim.fd);
+
+	return ret;
+}
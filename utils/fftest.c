@@ -25,17 +25,17 @@
  * Johann Deneux <deneux@ifrance.com>
  */
 
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <time.h>
 #include <linux/input.h>
 
 #include "bitmaskros.h"
+#include "ffdev.h"
+#include "histogram.h"
 
 
 #define N_EFFECTS 6
@@ -49,50 +49,365 @@ char* effect_names[] = {
 	"Weak Rumble"
 };
 
+/* Bench mode: how many times each effect type goes through the loop,
+   and how many effects at most are uploaded to find the number of
+   slots, if the device doesn't say */
+#define BENCH_LOOPS	100
+#define BENCH_SLOTS	1024
+
+static const struct {
+	int type;
+	const char *name;
+} bench_types[] = {
+	{ FF_RUMBLE, "rumble" },
+	{ FF_CONSTANT, "constant" },
+	{ FF_PERIODIC, "periodic" },
+	{ FF_RAMP, "ramp" },
+	{ FF_SPRING, "spring" },
+	{ FF_FRICTION, "friction" },
+	{ FF_DAMPER, "damper" },
+	{ FF_INERTIA, "inertia" },
+};
+#define BENCH_TYPES	(sizeof(bench_types) / sizeof(bench_types[0]))
+
+/* What the loop does to each effect, in order */
+enum { OP_UPLOAD, OP_PLAY, OP_UPDATE, OP_STOP, OP_REMOVE, OPS };
+static const char *op_names[OPS] = {
+	"upload", "play", "update", "stop", "remove"
+};
+
+/* Timing of an operation, in ns */
+struct bench_op {
+	struct histogram time;
+	unsigned long errors;
+};
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void add_time(struct bench_op *op, int64_t start, int failed)
+{
+	int64_t t = now_ns() - start;
+
+	hist_add(&op->time, t > UINT32_MAX ? UINT32_MAX : t);
+	op->errors += failed;
+}
+
+/* A weak, short effect of the given type, so that benchmarking doesn't
+   shake the device much */
+static void bench_effect(const struct ffdev *dev, int type,
+			 struct ff_effect *effect)
+{
+	int i;
+
+	memset(effect, 0, sizeof(*effect));
+	effect->type = type;
+	effect->id = -1;
+	effect->direction = 0x4000;
+	effect->replay.length = 50;
+
+	switch (type) {
+	case FF_CONSTANT:
+		effect->u.constant.level = 0x800;
+		break;
+	case FF_PERIODIC:
+		/* The first waveform the device has */
+		effect->u.periodic.waveform = FF_SINE;
+		for (i = FF_WAVEFORM_MIN; i <= FF_WAVEFORM_MAX; i++)
+			if (i != FF_CUSTOM && testBit(i, dev->ff_bits)) {
+				effect->u.periodic.waveform = i;
+				break;
+			}
+		effect->u.periodic.period = 100;
+		effect->u.periodic.magnitude = 0x800;
+		break;
+	case FF_RAMP:
+		effect->u.ramp.start_level = 0x800;
+		effect->u.ramp.end_level = -0x800;
+		break;
+	case FF_RUMBLE:
+		effect->u.rumble.strong_magnitude = 0x800;
+		effect->u.rumble.weak_magnitude = 0x800;
+		break;
+	default:
+		/* Conditions */
+		for (i = 0; i < 2; i++) {
+			effect->u.condition[i].right_saturation = 0x800;
+			effect->u.condition[i].left_saturation = 0x800;
+			effect->u.condition[i].right_coeff = 0x800;
+			effect->u.condition[i].left_coeff = 0x800;
+		}
+		break;
+	}
+}
+
+/* Changes the strength of the effect, so that the update is sent */
+static void vary_effect(struct ff_effect *effect, int n)
+{
+	int level = 0x800 + (n & 1) * 0x100;
+
+	switch (effect->type) {
+	case FF_CONSTANT:
+		effect->u.constant.level = level;
+		break;
+	case FF_PERIODIC:
+		effect->u.periodic.magnitude = level;
+		break;
+	case FF_RAMP:
+		effect->u.ramp.start_level = level;
+		break;
+	case FF_RUMBLE:
+		effect->u.rumble.strong_magnitude = level;
+		break;
+	default:
+		effect->u.condition[0].right_coeff = level;
+		break;
+	}
+}
+
+static void print_op(const char *record, const char *type, const char *op,
+		     const struct bench_op *b)
+{
+	printf("%s effect=%s op=%s count=%lu errors=%lu mean_ns=%.0f "
+	       "p50_ns=%u p90_ns=%u p99_ns=%u max_ns=%u\n",
+	       record, type, op, b->time.count, b->errors,
+	       hist_mean(&b->time), hist_percentile(&b->time, 50),
+	       hist_percentile(&b->time, 90), hist_percentile(&b->time, 99),
+	       b->time.max);
+}
+
+/* Uploads, plays, updates, stops and removes an effect of the type, the
+   given number of times. Returns the number of failed operations. */
+static unsigned long bench_loop(struct ffdev *dev, int t, int loops)
+{
+	struct bench_op ops[OPS];
+	struct ff_effect effect;
+	unsigned long errors = 0;
+	int64_t start;
+	int i, failed;
+
+	memset(ops, 0, sizeof(ops));
+	bench_effect(dev, bench_types[t].type, &effect);
+
+	for (i = 0; i < loops; i++) {
+		effect.id = -1;
+		start = now_ns();
+		failed = ffdev_upload(dev, &effect) < 0;
+		add_time(&ops[OP_UPLOAD], start, failed);
+		if (failed)
+			continue;
+
+		start = now_ns();
+		failed = ffdev_play(dev, &effect, 1) < 0 || ffdev_flush(dev) < 0;
+		add_time(&ops[OP_PLAY], start, failed);
+
+		vary_effect(&effect, i + 1);
+		start = now_ns();
+		failed = ffdev_upload(dev, &effect) < 0;
+		add_time(&ops[OP_UPDATE], start, failed);
+
+		start = now_ns();
+		failed = ffdev_stop(dev, &effect) < 0 || ffdev_flush(dev) < 0;
+		add_time(&ops[OP_STOP], start, failed);
+
+		start = now_ns();
+		failed = ffdev_remove(dev, &effect) < 0;
+		add_time(&ops[OP_REMOVE], start, failed);
+	}
+
+	for (i = 0; i < OPS; i++) {
+		print_op("op", bench_types[t].name, op_names[i], &ops[i]);
+		errors += ops[i].errors;
+	}
+	return errors;
+}
+
+/* Uploads effects of the type until the device refuses one, then plays
+   and stops them all, each in a single write, and removes them. The
+   device should hold as many as it says; once they are removed, a new
+   one should fit. Returns the number of failures. */
+static unsigned long bench_slots(struct ffdev *dev, int t)
+{
+	int max = dev->n_effects ? dev->n_effects + 1 : BENCH_SLOTS;
+	struct ff_effect *effects = calloc(max, sizeof(*effects));
+	struct bench_op full, play, stop, remove;
+	unsigned long failures = 0;
+	int64_t start, refused = 0;
+	int held, i, failed, err = 0, reuse;
+
+	if (!effects) {
+		perror("fftest");
+		exit(1);
+	}
+	memset(&full, 0, sizeof(full));
+	memset(&play, 0, sizeof(play));
+	memset(&stop, 0, sizeof(stop));
+	memset(&remove, 0, sizeof(remove));
+
+	for (held = 0; held < max; held++) {
+		bench_effect(dev, bench_types[t].type, &effects[held]);
+		start = now_ns();
+		if (ffdev_upload(dev, &effects[held]) < 0) {
+			refused = now_ns() - start;
+			err = errno;
+			break;
+		}
+		add_time(&full, start, 0);
+	}
+
+	start = now_ns();
+	failed = 0;
+	for (i = 0; i < held; i++)
+		failed |= ffdev_play(dev, &effects[i], 1) < 0;
+	failed |= ffdev_flush(dev) < 0;
+	add_time(&play, start, failed);
+
+	start = now_ns();
+	failed = 0;
+	for (i = 0; i < held; i++)
+		failed |= ffdev_stop(dev, &effects[i]) < 0;
+	failed |= ffdev_flush(dev) < 0;
+	add_time(&stop, start, failed);
+
+	for (i = 0; i < held; i++) {
+		start = now_ns();
+		add_time(&remove, start, ffdev_remove(dev, &effects[i]) < 0);
+	}
+
+	bench_effect(dev, bench_types[t].type, &effects[0]);
+	reuse = ffdev_upload(dev, &effects[0]) == 0;
+	if (reuse)
+		ffdev_remove(dev, &effects[0]);
+
+	print_op("slots", bench_types[t].name, "upload", &full);
+	print_op("slots", bench_types[t].name, "play-all", &play);
+	print_op("slots", bench_types[t].name, "stop-all", &stop);
+	print_op("slots", bench_types[t].name, "remove", &remove);
+	printf("slots effect=%s reported=%d held=%d refused_errno=%d "
+	       "refused_ns=%lld reuse=%d\n",
+	       bench_types[t].name, dev->n_effects, held, err,
+	       (long long)refused, reuse);
+
+	failures = play.errors + stop.errors + remove.errors + !reuse;
+	if (dev->n_effects && held != dev->n_effects)
+		failures++;
+
+	free(effects);
+	return failures;
+}
+
+/* Runs the bench on each effect type the device has, printing one
+   record per line as space-separated key=value pairs. Returns the exit
+   status: 0 if everything worked, 1 otherwise. */
+static int bench(struct ffdev *dev, const char *name, int loops)
+{
+	unsigned long failures = 0;
+	int t, first = -1;
+
+	printf("device path=%s effects=%d loops=%d\n", name, dev->n_effects,
+	       loops);
+
+	for (t = 0; t < BENCH_TYPES; t++) {
+		if (!testBit(bench_types[t].type, dev->ff_bits)) {
+			printf("skip effect=%s\n", bench_types[t].name);
+			continue;
+		}
+		if (first < 0)
+			first = t;
+		failures += bench_loop(dev, t, loops);
+	}
+
+	if (first < 0) {
+		printf("result status=fail failures=0 reason=no-effects\n");
+		return 1;
+	}
+
+	failures += bench_slots(dev, first);
+
+	printf("result status=%s failures=%lu\n", failures ? "fail" : "pass",
+	       failures);
+	return failures ? 1 : 0;
+}
+
 int main(int argc, char** argv)
 {
 	struct ff_effect effects[N_EFFECTS];
-	struct input_event play, stop, gain;
-	int fd;
+	struct ffdev dev;
 	const char * device_file_name = "/dev/input/event0";
-	unsigned char relFeatures[1 + REL_MAX/8/sizeof(unsigned char)];
-	unsigned char absFeatures[1 + ABS_MAX/8/sizeof(unsigned char)];
-	unsigned char ffFeatures[1 + FF_MAX/8/sizeof(unsigned char)];
-	int n_effects;	/* Number of effects the device can play at the same time */
+	unsigned char *relFeatures = dev.rel_bits;
+	unsigned char *absFeatures = dev.abs_bits;
+	unsigned char *ffFeatures = dev.ff_bits;
+	int bench_loops = 0;	/* Non-interactive bench, if set */
+	const char * trace_file_name = NULL;
 	int i;
 
-	printf("Force feedback test program.\n");
-	printf("HOLD FIRMLY YOUR WHEEL OR JOYSTICK TO PREVENT DAMAGES\n\n");
-
 	for (i=1; i<argc; ++i) {
 		if (strncmp(argv[i], "--help", 64) == 0) {
-			printf("Usage: %s /dev/input/eventXX\n", argv[0]);
+			printf("Usage: %s [--bench [--loops N]] [--record FILE] /dev/input/eventXX\n", argv[0]);
 			printf("Tests the force feedback driver\n");
+			printf("  --bench    time uploading, playing, updating and removing each\n");
+			printf("             effect type, and filling the effect slots, printing\n");
+			printf("             key=value records; exits with 1 if anything failed\n");
+			printf("  --loops N  times each effect type is benched (default %d),\n", BENCH_LOOPS);
+			printf("             implies --bench\n");
+			printf("  --record FILE  record what is sent to the device, for ffreplay\n");
 			exit(1);
 		}
+		else if (strcmp(argv[i], "--bench") == 0) {
+			if (!bench_loops)
+				bench_loops = BENCH_LOOPS;
+		}
+		else if (strcmp(argv[i], "--record") == 0) {
+			if (++i >= argc) {
+				fprintf(stderr, "Missing trace file\n");
+				exit(1);
+			}
+			trace_file_name = argv[i];
+		}
+		else if (strcmp(argv[i], "--loops") == 0) {
+			if (++i >= argc || (bench_loops = atoi(argv[i])) <= 0) {
+				fprintf(stderr, "Missing or bad loop count\n");
+				exit(1);
+			}
+		}
 		else {
 			device_file_name = argv[i];
 		}
 	}
 
-	/* Open device */
-	fd = open(device_file_name, O_RDWR);
-	if (fd == -1) {
+	/* Open and query device */
+	if (ffdev_open(&dev, device_file_name, 0) == -1) {
 		perror("Open device file");
 		exit(1);
 	}
+
+	if (trace_file_name && ffdev_record(&dev, trace_file_name) == -1) {
+		perror("Create trace");
+		exit(1);
+	}
+
+	if (bench_loops) {
+		i = bench(&dev, device_file_name, bench_loops);
+		if (ffdev_close(&dev) == -1) {
+			perror("Write trace");
+			exit(1);
+		}
+		exit(i);
+	}
+
+	printf("Force feedback test program.\n");
+	printf("HOLD FIRMLY YOUR WHEEL OR JOYSTICK TO PREVENT DAMAGES\n\n");
+
 	printf("Device %s opened\n", device_file_name);
 
-	/* Query device */
 	printf("Features:\n");
 
 	/* Absolute axes */
-	memset(absFeatures, 0, sizeof(absFeatures)*sizeof(unsigned char));
-	if (ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absFeatures)*sizeof(unsigned char)), absFeatures) == -1) {
-		perror("Ioctl absolute axes features query");
-		exit(1);
-	}
-
 	printf("  * Absolute axes: ");
 
 	if (testBit(ABS_X, absFeatures)) printf("X, ");
@@ -123,17 +438,11 @@ int main(int argc, char** argv)
 	if (testBit(ABS_MISC, absFeatures)) printf("Misc ,");
 
 	printf("\n    [");
-	for (i=0; i<sizeof(absFeatures)/sizeof(unsigned char);i++)
+	for (i=0; i<sizeof(dev.abs_bits);i++)
 	    printf("%02X ", absFeatures[i]);
 	printf("]\n");
 
 	/* Relative axes */
-	memset(relFeatures, 0, sizeof(relFeatures)*sizeof(unsigned char));
-	if (ioctl(fd, EVIOCGBIT(EV_REL, sizeof(relFeatures)*sizeof(unsigned char)), relFeatures) == -1) {
-		perror("Ioctl relative axes features query");
-		exit(1);
-	}
-
 	printf("  * Relative axes: ");
 
 	if (testBit(REL_X, relFeatures)) printf("X, ");
@@ -148,17 +457,11 @@ int main(int argc, char** argv)
 	if (testBit(REL_MISC, relFeatures)) printf("Misc, ");
 
 	printf("\n    [");
-	for (i=0; i<sizeof(relFeatures)/sizeof(unsigned char);i++)
+	for (i=0; i<sizeof(dev.rel_bits);i++)
 	    printf("%02X ", relFeatures[i]);
 	printf("]\n");
 
 	/* Force feedback effects */
-	memset(ffFeatures, 0, sizeof(ffFeatures)*sizeof(unsigned char));
-	if (ioctl(fd, EVIOCGBIT(EV_FF, sizeof(ffFeatures)*sizeof(unsigned char)), ffFeatures) == -1) {
-		perror("Ioctl force feedback features query");
-		exit(1);
-	}
-
 	printf("  * Force feedback effects types: ");
 
 	if (testBit(FF_CONSTANT, ffFeatures)) printf("Constant, ");
@@ -182,28 +485,20 @@ int main(int argc, char** argv)
 	if (testBit(FF_CUSTOM, ffFeatures)) printf("Custom, ");
 
 	printf("\n    [");
-	for (i=0; i<sizeof(ffFeatures)/sizeof(unsigned char);i++)
+	for (i=0; i<sizeof(dev.ff_bits);i++)
 	    printf("%02X ", ffFeatures[i]);
 	printf("]\n");
 
 	printf("  * Number of simultaneous effects: ");
-
-	if (ioctl(fd, EVIOCGEFFECTS, &n_effects) == -1) {
-		perror("Ioctl number of effects");
-	}
-
-	printf("%d\n\n", n_effects);
+	printf("%d\n\n", dev.n_effects);
 
 	/* Set master gain to 75% if supported */
 	if (testBit(FF_GAIN, ffFeatures)) {
-		memset(&gain, 0, sizeof(gain));
-		gain.type = EV_FF;
-		gain.code = FF_GAIN;
-		gain.value = 0xC000; /* [0, 0xFFFF]) */
-
 		printf("Setting master gain to 75%% ... ");
 		fflush(stdout);
-		if (write(fd, &gain, sizeof(gain)) != sizeof(gain)) {
+		/* [0, 0xFFFF] */
+		if (ffdev_queue(&dev, FF_GAIN, 0xC000) == -1 ||
+		    ffdev_flush(&dev) == -1) {
 		  perror("Error:");
 		} else {
 		  printf("OK\n");
@@ -231,7 +526,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #0 (Periodic sinusoidal) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[0]) == -1) {
+	if (ffdev_upload(&dev, &effects[0]) == -1) {
 		perror("Error:");
 	} else {
 		printf("OK (id %d)\n", effects[0].id);
@@ -253,7 +548,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #1 (Constant) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[1]) == -1) {
+	if (ffdev_upload(&dev, &effects[1]) == -1) {
 		perror("Error");
 	} else {
 		printf("OK (id %d)\n", effects[1].id);
@@ -276,7 +571,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #2 (Spring) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[2]) == -1) {
+	if (ffdev_upload(&dev, &effects[2]) == -1) {
 		perror("Error");
 	} else {
 		printf("OK (id %d)\n", effects[2].id);
@@ -299,7 +594,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #3 (Damper) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[3]) == -1) {
+	if (ffdev_upload(&dev, &effects[3]) == -1) {
 		perror("Error");
 	} else {
 		printf("OK (id %d)\n", effects[3].id);
@@ -315,7 +610,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #4 (Strong rumble, with heavy motor) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[4]) == -1) {
+	if (ffdev_upload(&dev, &effects[4]) == -1) {
 		perror("Error");
 	} else {
 		printf("OK (id %d)\n", effects[4].id);
@@ -331,7 +626,7 @@ int main(int argc, char** argv)
 
 	printf("Uploading effect #5 (Weak rumble, with light motor) ... ");
 	fflush(stdout);
-	if (ioctl(fd, EVIOCSFF, &effects[5]) == -1) {
+	if (ffdev_upload(&dev, &effects[5]) == -1) {
 		perror("Error");
 	} else {
 		printf("OK (id %d)\n", effects[5].id);
@@ -346,12 +641,8 @@ int main(int argc, char** argv)
 			printf("Read error\n");
 		}
 		else if (i >= 0 && i < N_EFFECTS) {
-			memset(&play,0,sizeof(play));
-			play.type = EV_FF;
-			play.code = effects[i].id;
-			play.value = 1;
-
-			if (write(fd, (const void*) &play, sizeof(play)) == -1) {
+			if (ffdev_play(&dev, &effects[i], 1) == -1 ||
+			    ffdev_flush(&dev) == -1) {
 				perror("Play effect");
 				exit(1);
 			}
@@ -368,20 +659,22 @@ int main(int argc, char** argv)
 		}
 	} while (i>=0);
 
-	/* Stop the effects */
+	/* Stop the effects, all in one write */
 	printf("Stopping effects\n");
 	for (i=0; i<N_EFFECTS; ++i) {
-		memset(&stop,0,sizeof(stop));
-		stop.type = EV_FF;
-		stop.code =  effects[i].id;
-		stop.value = 0;
-        
-		if (write(fd, (const void*) &stop, sizeof(stop)) == -1) {
+		if (ffdev_stop(&dev, &effects[i]) == -1) {
 			perror("");
 			exit(1);
 		}
 	}
-	
+	if (ffdev_flush(&dev) == -1) {
+		perror("");
+		exit(1);
+	}
 
+	if (ffdev_close(&dev) == -1) {
+		perror("Write trace");
+		exit(1);
+	}
 	exit(0);
 }
@@ -0,0 +1,323 @@
+/*
+ * Force feedback traces.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "fftrace.h"
+
+/* Records are written out in big chunks */
+#define FFTRACE_BUFFER	65536
+
+/* The most 16-bit fields an effect has */
+#define EFFECT_FIELDS	32
+
+static void put16(FILE *f, unsigned int v)
+{
+	putc(v & 0xff, f);
+	putc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, uint32_t v)
+{
+	put16(f, v & 0xffff);
+	put16(f, v >> 16);
+}
+
+static int get16(FILE *f, unsigned int *v)
+{
+	unsigned char b[2];
+
+	if (fread(b, 1, 2, f) != 2)
+		return -1;
+	*v = b[0] | b[1] << 8;
+
+	return 0;
+}
+
+static int get32(FILE *f, uint32_t *v)
+{
+	unsigned int lo, hi;
+
+	if (get16(f, &lo) || get16(f, &hi))
+		return -1;
+	*v = lo | (uint32_t)hi << 16;
+
+	return 0;
+}
+
+static int envelope_fields(struct ff_envelope *e, uint16_t **f)
+{
+	f[0] = &e->attack_length;
+	f[1] = &e->attack_level;
+	f[2] = &e->fade_length;
+	f[3] = &e->fade_level;
+	return 4;
+}
+
+/* Lists the 16-bit fields of the effect, in the order they are stored:
+   the type first, which decides the rest */
+static int effect_fields(struct ff_effect *e, uint16_t **f)
+{
+	int n = 0, i;
+
+	f[n++] = &e->type;
+	f[n++] = &e->direction;
+	f[n++] = &e->trigger.button;
+	f[n++] = &e->trigger.interval;
+	f[n++] = &e->replay.length;
+	f[n++] = &e->replay.delay;
+
+	switch (e->type) {
+	case FF_CONSTANT:
+		f[n++] = (uint16_t *)&e->u.constant.level;
+		n += envelope_fields(&e->u.constant.envelope, f + n);
+		break;
+	case FF_RAMP:
+		f[n++] = (uint16_t *)&e->u.ramp.start_level;
+		f[n++] = (uint16_t *)&e->u.ramp.end_level;
+		n += envelope_fields(&e->u.ramp.envelope, f + n);
+		break;
+	case FF_PERIODIC:
+		f[n++] = &e->u.periodic.waveform;
+		f[n++] = &e->u.periodic.period;
+		f[n++] = (uint16_t *)&e->u.periodic.magnitude;
+		f[n++] = (uint16_t *)&e->u.periodic.offset;
+		f[n++] = &e->u.periodic.phase;
+		n += envelope_fields(&e->u.periodic.envelope, f + n);
+		break;
+	case FF_SPRING:
+	case FF_FRICTION:
+	case FF_DAMPER:
+	case FF_INERTIA:
+		for (i = 0; i < 2; i++) {
+			f[n++] = &e->u.condition[i].right_saturation;
+			f[n++] = &e->u.condition[i].left_saturation;
+			f[n++] = (uint16_t *)&e->u.condition[i].right_coeff;
+			f[n++] = (uint16_t *)&e->u.condition[i].left_coeff;
+			f[n++] = &e->u.condition[i].deadband;
+			f[n++] = (uint16_t *)&e->u.condition[i].center;
+		}
+		break;
+	case FF_RUMBLE:
+		f[n++] = &e->u.rumble.strong_magnitude;
+		f[n++] = &e->u.rumble.weak_magnitude;
+		break;
+	}
+
+	return n;
+}
+
+int fftrace_create(struct fftrace *t, const char *path)
+{
+	struct timespec ts;
+	int len = strlen(t->name);
+
+	if (!(t->f = fopen(path, "wb")))
+		return -1;
+	setvbuf(t->f, NULL, _IOFBF, FFTRACE_BUFFER);
+
+	fputs(FFTRACE_MAGIC, t->f);
+	putc(FFTRACE_VERSION, t->f);
+	put16(t->f, t->n_effects);
+	fwrite(t->ff_bits, 1, FFTRACE_BITS, t->f);
+	putc(len, t->f);
+	fwrite(t->name, 1, len, t->f);
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	t->start = ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	t->time = 0;
+
+	return ferror(t->f) ? -1 : 0;
+}
+
+uint64_t fftrace_now(const struct fftrace *t)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1000000000LL + ts.tv_nsec - t->start) / 1000;
+}
+
+void fftrace_write(struct fftrace *t, const struct fftrace_record *r)
+{
+	struct ff_effect effect;
+	uint16_t *fields[EFFECT_FIELDS];
+	uint64_t delta;
+	int i, n;
+
+	/* Records are written as they happen, so in order */
+	delta = 0;
+	if (r->time > t->time) {
+		delta = r->time - t->time;
+		t->time = r->time;
+	}
+	while (delta >= 0x80) {
+		putc((delta & 0x7f) | 0x80, t->f);
+		delta >>= 7;
+	}
+	putc(delta, t->f);
+
+	putc(r->type, t->f);
+
+	switch (r->type) {
+	case FFTRACE_UPLOAD:
+		effect = r->effect;
+		put16(t->f, (uint16_t)r->id);
+		put16(t->f, (uint16_t)effect.id);
+		putc(r->error, t->f);
+		n = effect_fields(&effect, fields);
+		for (i = 0; i < n; i++)
+			put16(t->f, *fields[i]);
+		if (effect.type == FF_PERIODIC) {
+			n = effect.u.periodic.custom_data ?
+			    effect.u.periodic.custom_len : 0;
+			if (n > FFTRACE_CUSTOM)
+				n = FFTRACE_CUSTOM;
+			put16(t->f, n);
+			for (i = 0; i < n; i++)
+				put16(t->f, (uint16_t)effect.u.periodic.custom_data[i]);
+		}
+		break;
+	case FFTRACE_REMOVE:
+		put16(t->f, (uint16_t)r->id);
+		putc(r->error, t->f);
+		break;
+	case FFTRACE_EVENT:
+		put16(t->f, r->code);
+		put32(t->f, r->value);
+		putc(r->error, t->f);
+		break;
+	}
+}
+
+int fftrace_open(struct fftrace *t, const char *path)
+{
+	unsigned char hdr[5];
+	unsigned int v;
+	int len, err;
+
+	if (!(t->f = fopen(path, "rb")))
+		return -1;
+	setvbuf(t->f, NULL, _IOFBF, FFTRACE_BUFFER);
+
+	if (fread(hdr, 1, 5, t->f) != 5 || memcmp(hdr, FFTRACE_MAGIC, 4) ||
+	    hdr[4] != FFTRACE_VERSION || get16(t->f, &v) ||
+	    fread(t->ff_bits, 1, FFTRACE_BITS, t->f) != FFTRACE_BITS ||
+	    (len = getc(t->f)) == EOF || len >= FFTRACE_NAME_LENGTH ||
+	    fread(t->name, 1, len, t->f) != len)
+		goto fail;
+
+	t->n_effects = v;
+	t->name[len] = 0;
+	t->time = 0;
+
+	return 0;
+
+fail:
+	/* errno is left 0 if the file is no trace */
+	err = ferror(t->f) ? errno : 0;
+	fclose(t->f);
+	errno = err;
+	return -1;
+}
+
+int fftrace_read(struct fftrace *t, struct fftrace_record *r)
+{
+	uint16_t *fields[EFFECT_FIELDS];
+	uint64_t delta = 0;
+	unsigned int v, d;
+	uint32_t value;
+	int c, i, n, shift = 0;
+
+	do {
+		if ((c = getc(t->f)) == EOF || shift > 56)
+			return -1;
+		delta |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	memset(r, 0, sizeof(*r));
+	r->time = t->time += delta;
+
+	if ((c = getc(t->f)) == EOF)
+		return -1;
+	r->type = c;
+
+	switch (r->type) {
+	case FFTRACE_UPLOAD:
+		if (get16(t->f, &v))
+			return -1;
+		r->id = (int16_t)v;
+		if (get16(t->f, &v) || (c = getc(t->f)) == EOF)
+			return -1;
+		r->effect.id = (int16_t)v;
+		r->error = c;
+
+		/* The type comes first, and decides which fields follow */
+		if (get16(t->f, &v))
+			return -1;
+		r->effect.type = v;
+		n = effect_fields(&r->effect, fields);
+		for (i = 1; i < n; i++) {
+			if (get16(t->f, &v))
+				return -1;
+			*fields[i] = v;
+		}
+
+		if (r->effect.type == FF_PERIODIC) {
+			if (get16(t->f, &v) || v > FFTRACE_CUSTOM)
+				return -1;
+			for (i = 0; i < v; i++) {
+				if (get16(t->f, &d))
+					return -1;
+				t->custom[i] = (int16_t)d;
+			}
+			r->effect.u.periodic.custom_len = v;
+			r->effect.u.periodic.custom_data = v ? t->custom : NULL;
+		}
+		return 0;
+	case FFTRACE_REMOVE:
+		if (get16(t->f, &v) || (c = getc(t->f)) == EOF)
+			return -1;
+		r->id = (int16_t)v;
+		r->error = c;
+		return 0;
+	case FFTRACE_EVENT:
+		if (get16(t->f, &v) || get32(t->f, &value) ||
+		    (c = getc(t->f)) == EOF)
+			return -1;
+		r->code = v;
+		r->value = (int32_t)value;
+		r->error = c;
+		return 0;
+	}
+
+	return -1;
+}
+
+int fftrace_close(struct fftrace *t)
+{
+	int ret = ferror(t->f) ? -1 : 0;
+
+	if (fclose(t->f))
+		ret = -1;
+
+	return ret;
+}
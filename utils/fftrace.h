@@ -0,0 +1,99 @@
+/*
+ * Force feedback traces.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __FFTRACE_H__
+#define __FFTRACE_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <linux/input.h>
+
+/* A trace starts with the magic, a version byte, the number of effects
+   the device holds (16 bits), its force feedback bits (FFTRACE_BITS
+   bytes), and the length of its name and the name. Each record follows
+   as the time since the previous one in us, as a LEB128 varint, and its
+   type:
+   - an upload gives the id asked for (-1 for a new effect) and the id
+     the device gave (16 bits each), the error it failed with (a byte, 0
+     if none), and the effect: its type, direction, trigger button and
+     interval, replay length and delay, then the fields its type uses,
+     all 16 bits; a periodic effect's custom data follows its length
+     (16 bits);
+   - a removal gives the id (16 bits) and the error;
+   - an EV_FF event written to the device (play, stop, gain, autocenter)
+     gives its code (16 bits) and value (32 bits), and the error. Events
+     written together follow each other with no time between them.
+   All values are little endian. */
+#define FFTRACE_MAGIC	"FFTR"
+#define FFTRACE_VERSION	1
+
+#define FFTRACE_BITS		(1 + FF_MAX/8)
+#define FFTRACE_NAME_LENGTH	128
+#define FFTRACE_CUSTOM		1024
+
+enum fftrace_type {
+	FFTRACE_UPLOAD = 1,
+	FFTRACE_REMOVE,
+	FFTRACE_EVENT
+};
+
+struct fftrace_record {
+	uint64_t time;		/* us after the start of the trace */
+	enum fftrace_type type;
+	int id;			/* asked for */
+	int error;		/* 0, or the errno */
+	struct ff_effect effect; /* uploaded; its id is the one given */
+	int code, value;	/* of an event */
+};
+
+struct fftrace {
+	FILE *f;
+	uint64_t time;		/* of the previous record */
+	int64_t start;		/* when the trace was created, in ns */
+
+	int n_effects;
+	unsigned char ff_bits[FFTRACE_BITS];
+	char name[FFTRACE_NAME_LENGTH];
+
+	int16_t custom[FFTRACE_CUSTOM];	/* custom data read */
+};
+
+/* Creates a trace for the device described in the trace structure, and
+   starts its clock. Returns -1 on error. */
+int fftrace_create(struct fftrace *t, const char *path);
+
+/* Returns the time since the trace was created, in us. */
+uint64_t fftrace_now(const struct fftrace *t);
+
+/* Appends a record. */
+void fftrace_write(struct fftrace *t, const struct fftrace_record *r);
+
+/* Opens a trace for reading and fills in the description of the
+   device. Returns -1 on error. */
+int fftrace_open(struct fftrace *t, const char *path);
+
+/* Reads the next record; the custom data of a periodic effect is kept
+   in the trace structure until the next one. Returns -1 at the end of
+   the trace or on error. */
+int fftrace_read(struct fftrace *t, struct fftrace_record *r);
+
+/* Flushes and closes the trace. Returns -1 if anything failed. */
+int fftrace_close(struct fftrace *t);
+
+#endif
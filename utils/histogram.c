@@ -0,0 +1,157 @@
+/*
+ * Log-linear histograms, for timing measurements.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "histogram.h"
+
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+
+/* Size of the chart printed by hist_print() */
+#define HIST_BAR	50
+#define HIST_ROWS	24
+
+static int bucket(uint32_t v)
+{
+	int e;
+
+	if (v < HIST_SUB)
+		return v;
+
+	e = 31 - __builtin_clz(v);
+
+	return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+		((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Smallest value of a bucket */
+static uint32_t bucket_low(int b)
+{
+	int e = (b >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+
+	if (b < HIST_SUB)
+		return b;
+
+	return (uint32_t)(HIST_SUB + (b & (HIST_SUB - 1))) <<
+		(e - HIST_SUB_BITS);
+}
+
+/* Largest value of a bucket */
+static uint32_t bucket_high(int b)
+{
+	return b == HIST_BUCKETS - 1 ? UINT32_MAX : bucket_low(b + 1) - 1;
+}
+
+void hist_reset(struct histogram *h)
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void hist_add(struct histogram *h, uint32_t v)
+{
+	if (!h->count || v < h->min)
+		h->min = v;
+	if (!h->count || v > h->max)
+		h->max = v;
+	h->count++;
+	h->sum += v;
+	h->buckets[bucket(v)]++;
+}
+
+void hist_merge(struct histogram *h, const struct histogram *other)
+{
+	int i;
+
+	if (!other->count)
+		return;
+
+	if (!h->count || other->min < h->min)
+		h->min = other->min;
+	if (!h->count || other->max > h->max)
+		h->max = other->max;
+	h->count += other->count;
+	h->sum += other->sum;
+	for (i = 0; i < HIST_BUCKETS; i++)
+		h->buckets[i] += other->buckets[i];
+}
+
+uint32_t hist_percentile(const struct histogram *h, double percent)
+{
+	unsigned long rank, seen = 0;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = h->count * percent / 100.0 + 0.5;
+	if (rank < 1)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	if (i == HIST_BUCKETS || bucket_high(i) > h->max)
+		return h->max;
+	if (bucket_high(i) < h->min)
+		return h->min;
+
+	return bucket_high(i);
+}
+
+double hist_mean(const struct histogram *h)
+{
+	return h->count ? (double)h->sum / h->count : 0;
+}
+
+void hist_print(FILE *f, const struct histogram *h, double scale,
+		const char *unit)
+{
+	unsigned long count, most = 0;
+	int i, j, first, last, group;
+
+	for (first = 0; first < HIST_BUCKETS && !h->buckets[first]; first++)
+		;
+	for (last = HIST_BUCKETS - 1; last > first && !h->buckets[last]; last--)
+		;
+	if (first == HIST_BUCKETS)
+		return;
+
+	/* Merge neighbouring buckets into at most HIST_ROWS rows */
+	group = (last - first + HIST_ROWS) / HIST_ROWS;
+
+	for (i = first; i <= last; i += group) {
+		for (count = 0, j = i; j < i + group && j <= last; j++)
+			count += h->buckets[j];
+		if (count > most)
+			most = count;
+	}
+
+	for (i = first; i <= last; i += group) {
+		for (count = 0, j = i; j < i + group && j <= last; j++)
+			count += h->buckets[j];
+		if (count)
+			fprintf(f, "  %10.3f - %10.3f %s %8lu %.*s\n",
+				bucket_low(i) / scale, bucket_high(j - 1) / scale,
+				unit, count,
+				(int)((count * HIST_BAR + most - 1) / most),
+				"##################################################");
+	}
+}
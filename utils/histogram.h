@@ -0,0 +1,59 @@
+/*
+ * Log-linear histograms, for timing measurements.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Each power of two is split into 2^HIST_SUB_BITS buckets, so values
+   are kept to within 1/32nd (3%); values below 2^(HIST_SUB_BITS + 1)
+   are kept exactly. Values go up to 2^32 - 1. */
+#define HIST_SUB_BITS	5
+#define HIST_BUCKETS	((32 - HIST_SUB_BITS + 1) << HIST_SUB_BITS)
+
+struct histogram {
+	unsigned long count;
+	uint32_t min, max;
+	uint64_t sum;
+	unsigned long buckets[HIST_BUCKETS];
+};
+
+/* Empties the histogram. */
+void hist_reset(struct histogram *h);
+
+/* Adds a value. */
+void hist_add(struct histogram *h, uint32_t v);
+
+/* Adds all the values of another histogram. */
+void hist_merge(struct histogram *h, const struct histogram *other);
+
+/* Returns the value below which lies the given percentage of the
+   values (rounded up to the top of its bucket), 0 if empty. */
+uint32_t hist_percentile(const struct histogram *h, double percent);
+
+/* Returns the mean of the values, 0 if empty. */
+double hist_mean(const struct histogram *h);
+
+/* Prints a bar chart of the values, divided by scale and shown with
+   the given unit; neighbouring buckets are merged to keep it short. */
+void hist_print(FILE *f, const struct histogram *h, double scale,
+		const char *unit);
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * Device initialization script instructions, shared by the script
+ * compiler (mkinitscripts.c) and the interpreter in inputattach.c.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __INITOPS_H__
+#define __INITOPS_H__
+
+/* Each instruction is an opcode byte followed by its operands: b is a
+   byte, w a 16-bit and l a 32-bit value (little endian), s a length
+   byte and that many bytes, and t a 16-bit jump target, relative to
+   the start of the script. Timeouts are in ms, between bytes. Every
+   wait fails the script when it fails, unless the opcode is marked
+   with INIT_TRY, in which case only the result is kept for iffail /
+   ifok. Offsets are into the line's data buffer; the line reads
+   (getline, await) go to its response buffer. */
+enum {
+	INIT_DONE,	/* -		initialization succeeded */
+	INIT_FAIL,	/* -		initialization failed */
+	INIT_SEND,	/* s		write the bytes */
+	INIT_EXPECT,	/* w s		wait for exactly the bytes */
+	INIT_SCAN,	/* w s		wait for the bytes, skipping others */
+	INIT_READ,	/* w b b	read b bytes to offset b */
+	INIT_SYNC,	/* w b b b	read up to b bytes to offset 0 until
+					one matches mask b and value b */
+	INIT_CHECK,	/* b b b	fail unless the byte at offset b
+					matches mask b and value b */
+	INIT_IFEQ,	/* b b b t	jump if it matches */
+	INIT_IFNE,	/* b b b t	jump unless it matches */
+	INIT_SLEEP,	/* w		wait */
+	INIT_SETLINE,	/* l l		set the line's flags and speed */
+	INIT_DTR,	/* b		set or clear DTR, where there is one */
+	INIT_DISCARD,	/* -		drop whatever was received */
+	INIT_LINEEND,	/* b b		terminator and ignored byte of lines */
+	INIT_GETLINE,	/* w		read a line */
+	INIT_AWAIT,	/* w b s	read up to b lines until one starts
+					with the bytes */
+	INIT_IFPREFIX,	/* s t		jump if the line starts with the
+					bytes */
+	INIT_IFIPREFIX,	/* s t		same, ignoring case */
+	INIT_IFCONTAINS,/* s t		jump if the line contains them */
+	INIT_IFOK,	/* t		jump if the last try succeeded */
+	INIT_IFFAIL,	/* t		jump if it failed */
+	INIT_COUNT,	/* b		set the loop counter */
+	INIT_LOOP,	/* t		decrement it and jump unless 0 */
+	INIT_JUMP,	/* t		jump */
+	INIT_ID,	/* l		set the device id */
+	INIT_EXTRA,	/* l		set the device extra */
+	INIT_DUMP,	/* -		print everything received, forever */
+	INIT_OPS
+};
+
+#define INIT_TRY	0x80
+
+/* Operands, as emitted by the compiler from C constant expressions */
+#define INIT_B(x)	((x) & 0xff)
+#define INIT_W(x)	((x) & 0xff), (((x) >> 8) & 0xff)
+#define INIT_L(x)	((x) & 0xff), (((x) >> 8) & 0xff), \
+			(((x) >> 16) & 0xff), (((x) >> 24) & 0xff)
+
+#endif
@@ -32,36 +32,113 @@
  * 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/serial.h>
 #include <linux/serio.h>
 #include "serio-ids.h"
+#include "initops.h"
+#include "serbuf.h"
+#include "serlog.h"
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <syslog.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
-static int readchar(int fd, unsigned char *c, int timeout)
-{
-	struct timeval tv;
-	fd_set set;
+/* palmed wisdom from http://stackoverflow.com/questions/1674162/ */
+#define RETRY_ERROR(x) (x == EAGAIN || x == EWOULDBLOCK || x == EINTR)
 
-	tv.tv_sec = 0;
-	tv.tv_usec = timeout * 1000;
+struct input_types;
+
+/* Phases of bringing a line up, timed for the statistics */
+enum { PHASE_OPEN, PHASE_FLUSH, PHASE_INIT, PHASE_LDISC, PHASE_TYPE,
+       PHASES };
+
+struct line_stats {
+	unsigned long attempts, failures, hangups;
+	long long mark;			/* end of the previous phase, us */
+	long long phase[PHASES];	/* durations in the last bring-up, us */
+	unsigned long init_rx, init_tx;	/* bytes in the last bring-up */
+	long long attached;		/* when, in us; 0 if not attached */
+	int icount;			/* the driver counts the traffic */
+	unsigned long base_rx, base_tx;	/* its counts when attached */
+	unsigned long rx, tx;		/* bytes since attached */
+	long long last_rx;		/* when rx last changed, in us */
+};
+
+/*
+ * A serial line being brought up. The device initialization scripts
+ * never block: they run on top of the buffered I/O in serbuf.c, and
+ * everything they need to keep across a wait lives here, so that any
+ * number of lines can be initialized concurrently from a single event
+ * loop.
+ */
+struct serline {
+	const char *device;
+	struct input_types *type;
+	int baud;
+	int speed;
+	int flags;
+	int ignore_init_res;
+	int no_init;
 
-	FD_ZERO(&set);
-	FD_SET(fd, &set);
+	struct serbuf io;
+	int state;
+	unsigned long id, extra;
 
-	if (!select(fd + 1, &set, NULL, NULL, &tv))
-		return -1;
+	/* Initialization script state */
+	const unsigned char *script;
+	const unsigned char *ip;	/* next instruction */
+	int waiting;		/* its wait has been armed */
+	int tries;		/* bytes or lines it has seen */
+	int res;		/* result of the last try */
+	int count;		/* loop counter */
+	int term, skip;		/* line ending */
+	unsigned char data[16];
+	char r[64];
 
-	if (read(fd, c, 1) != 1)
-		return -1;
+	/* Supervisor state */
+	pid_t holder;
+	int backoff;		/* ms */
+	int events;		/* registered with epoll */
 
-	return 0;
+	struct line_stats stats;
+};
+
+enum { LINE_CLOSED, LINE_FLUSH, LINE_INIT, LINE_READY, LINE_ATTACHED,
+       LINE_RETRY };
+
+#define INIT_PENDING	SER_PENDING
+
+static long long stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/* Ends a phase of the bring-up, which started where the last one ended */
+static void stats_phase(struct serline *l, int phase)
+{
+	long long now = stats_now();
+
+	l->stats.phase[phase] = now - l->stats.mark;
+	l->stats.mark = now;
 }
 
 static void setline(int fd, int flags, int speed)
@@ -83,84 +160,14 @@ static void setline(int fd, int flags, int speed)
 	tcsetattr(fd, TCSANOW, &t);
 }
 
-static int logitech_command(int fd, char *c)
-{
-	int i;
-	unsigned char d;
-
-	for (i = 0; c[i]; i++) {
-		if (write(fd, c + i, 1) != 1)
-			return -1;
-		if (readchar(fd, &d, 1000))
-			return -1;
-		if (c[i] != d)
-			return -1;
-	}
-	return 0;
-}
-
-static int magellan_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	if (write(fd, "m3\rpBB\rz\r", 9) != 9)
-		return -1;
-	return 0;
-}
-
-static int warrior_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	if (logitech_command(fd, "*S"))
-		return -1;
-
-	setline(fd, CS8, B4800);
-	return 0;
-}
-
-static int spaceball_waitchar(int fd, unsigned char c, char *d,
-				int timeout)
-{
-	unsigned char b = 0;
-
-	while (!readchar(fd, &b, timeout)) {
-		if (b == 0x0a)
-			continue;
-		*d++ = b;
-		if (b == c)
-			break;
-	}
-
-	*d = 0;
-
-	return -(b != c);
-}
-
-static int spaceball_waitcmd(int fd, char c, char *d)
-{
-	int i;
-
-	for (i = 0; i < 8; i++) {
-		if (spaceball_waitchar(fd, 0x0d, d, 1000))
-			return -1;
-		if (d[0] == c)
-			return 0;
-	}
-
-	return -1;
-}
-
-static int spaceball_cmd(int fd, char *c, char *d)
-{
-	int i;
-
-	for (i = 0; c[i]; i++)
-		if (write(fd, c + i, 1) != 1)
-			return -1;
-	if (write(fd, "\r", 1) != 1)
-		return -1;
-
-	i = spaceball_waitcmd(fd, toupper(c[0]), d);
-
-	return i;
-}
+/*
+ * Device initialization. The handshake of each mode is a script in
+ * initscripts.txt, which mkinitscripts compiles into the bytecode table
+ * below (see initops.h for the instructions) at build time. Scripts are
+ * run by script_step(), which never blocks: an instruction waiting on
+ * the line returns INIT_PENDING and is resumed where it left off, so
+ * that any number of lines can be initialized from one event loop.
+ */
 
 #define SPACEBALL_1003		1
 #define SPACEBALL_2003B		3
@@ -169,471 +176,265 @@ static int spaceball_cmd(int fd, char *c, char *d)
 #define SPACEBALL_4000FLX	8
 #define SPACEBALL_4000FLX_L	9
 
-static int spaceball_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	char r[64];
-
-	if (spaceball_waitchar(fd, 0x11, r, 4000) ||
-	    spaceball_waitchar(fd, 0x0d, r, 1000))
-		return -1;
-
-	if (spaceball_waitcmd(fd, '@', r))
-		return -1;
-
-	if (strncmp("@1 Spaceball alive", r, 18))
-		return -1;
-
-	if (spaceball_waitcmd(fd, '@', r))
-		return -1;
-
-	if (spaceball_cmd(fd, "hm", r))
-		return -1;
-
-	if (!strncmp("Hm2003B", r, 7))
-		*id = SPACEBALL_2003B;
-	if (!strncmp("Hm2003C", r, 7))
-		*id = SPACEBALL_2003C;
-	if (!strncmp("Hm3003C", r, 7))
-		*id = SPACEBALL_3003C;
-
-	/* spaceball 4000 returns 'HVFirmware' with v2.4.3 */
-	if (!strncasecmp("HvFirmware", r, 10)) {
-
-		if (spaceball_cmd(fd, "\"", r))
-			return -1;
-
-		if (strncmp("\"1 Spaceball 4000 FLX", r, 21))
-			return -1;
-
-		if (spaceball_waitcmd(fd, '"', r))
-			return -1;
-
-		if (strstr(r, " L "))
-			*id = SPACEBALL_4000FLX_L;
-		else
-			*id = SPACEBALL_4000FLX;
-
-		if (spaceball_waitcmd(fd, '"', r))
-			return -1;
-
-		if (spaceball_cmd(fd, "YS", r))
-			return -1;
-
-		if (spaceball_cmd(fd, "M", r))
-			return -1;
+#define TSC40_CMD_DATA1	0x01
+#define TSC40_CMD_RATE	0x05
+#define TSC40_CMD_ID	0x15
+#define TSC40_CMD_RESET	0x55
 
-		return 0;
-	}
+#define TSC40_RATE_150	0x45
+#define TSC40_NACK	0x15
 
-	if (spaceball_cmd(fd, "P@A@A", r) ||
-	    spaceball_cmd(fd, "FT@", r)   ||
-	    spaceball_cmd(fd, "MSS", r))
-		return -1;
+#include "initscripts.h"
 
-	return 0;
+static int get16(const unsigned char *p)
+{
+	return p[0] | p[1] << 8;
 }
 
-static int stinger_init(int fd, unsigned long *id, unsigned long *extra)
+static unsigned long get32(const unsigned char *p)
 {
-	int i;
-	unsigned char c;
-	unsigned char *response = (unsigned char *)"\r\n0600520058C272";
-
-	if (write(fd, " E5E5", 5) != 5)		/* Enable command */
-		return -1;
-
-	for (i = 0; i < 16; i++)		/* Check for Stinger */
-		if (readchar(fd, &c, 200) || c != response[i])
-			return -1;
-
-	return 0;
+	return p[0] | p[1] << 8 | p[2] << 16 | (unsigned long)p[3] << 24;
 }
 
-static int mzp_init(int fd, unsigned long *id, unsigned long *extra)
+static void script_start(struct serline *l, const unsigned char *script)
 {
-	if (logitech_command(fd, "*X*q"))
-		return -1;
-
-	setline(fd, CS8, B9600);
-	return 0;
+	l->script = l->ip = script;
+	l->waiting = 0;
+	l->term = '\n';
+	l->skip = -1;
 }
 
-static int newton_init(int fd, unsigned long *id, unsigned long *extra)
+/* Arms the timeout of a wait when the instruction starts it */
+static void script_wait(struct serline *l, int timeout)
 {
-	int i;
-	unsigned char c;
-	unsigned char response[35] = {
-		0x16, 0x10, 0x02, 0x64, 0x5f, 0x69, 0x64, 0x00,
-		0x00, 0x00, 0x0c, 0x6b, 0x79, 0x62, 0x64, 0x61,
-		0x70, 0x70, 0x6c, 0x00, 0x00, 0x00, 0x01, 0x6e,
-		0x6f, 0x66, 0x6d, 0x00, 0x00, 0x00, 0x00, 0x10,
-		0x03, 0xdd, 0xe7
-	};
-
-	for (i = 0; i < sizeof(response); i++)
-		if (readchar(fd, &c, 400) || c != response[i])
-			return -1;
-
-	return 0;
+	if (!l->waiting) {
+		ser_timeout(&l->io, timeout);
+		l->waiting = 1;
+		l->tries = 0;
+	}
 }
 
-static int twiddler_init(int fd, unsigned long *id, unsigned long *extra)
+/*
+ * Runs the script of a line as far as possible without blocking.
+ * Returns 0 once it succeeded, -1 if it failed, or INIT_PENDING.
+ */
+static int script_step(struct serline *l)
 {
-	unsigned char c[10];
-	int count, line;
-
-	/* Turn DTR off, otherwise the Twiddler won't send any data. */
-	if (ioctl(fd, TIOCMGET, &line) < 0)
-		return -1;
-	line &= ~TIOCM_DTR;
-	if (ioctl(fd, TIOCMSET, &line) < 0)
-		return -1;
+	const unsigned char *base = l->script, *p, *next;
+	int op, ret, len, line;
 
-	/*
-	 * Check whether the device on the serial line is the Twiddler.
-	 *
-	 * The Twiddler sends data packets of 5 bytes which have the following
-	 * properties: the MSB is 0 on the first and 1 on all other bytes, and
-	 * the high order nibble of the last byte is always 0x8.
-	 *
-	 * We read and check two of those 5 byte packets to be sure that we
-	 * are indeed talking to a Twiddler.
-	 */
-
-	/* Read at most 5 bytes until we find one with the MSB set to 0 */
-	for (count = 0; count < 5; count++) {
-		if (readchar(fd, c, 500))
-			return -1;
-		if ((c[0] & 0x80) == 0)
-			break;
-	}
-
-	if (count == 5) {
-		/* Could not find header byte in data stream */
-		return -1;
-	}
+	for (;;) {
+		p = l->ip;
+		op = p[0] & ~INIT_TRY;
+		ret = 0;
 
-	/* Read remaining 4 bytes plus the full next data packet */
-	for (count = 1; count < 10; count++)
-		if (readchar(fd, c + count, 500))
-			return -1;
+		switch (op) {
+		case INIT_DONE:
+			return 0;
 
-	/* Check whether the bytes of both data packets obey the rules */
-	for (count = 1; count < 10; count++) {
-		if ((count % 5 == 0 && (c[count] & 0x80) != 0x00) ||
-		    (count % 5 == 4 && (c[count] & 0xF0) != 0x80) ||
-		    (count % 5 != 0 && (c[count] & 0x80) != 0x80)) {
-			/* Invalid byte in data packet */
+		case INIT_FAIL:
 			return -1;
-		}
-	}
-
-	return 0;
-}
 
-static int pm6k_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	int i = 0;
-	unsigned char cmd[6] = {0xF1, 0x00, 0x00, 0x00, 0x00, 0x0E};
-	unsigned char data[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-	/* Enable the touchscreen */
-	if (write(fd, cmd, sizeof(cmd)) != sizeof(cmd))
-		return -1;
+		case INIT_SEND:
+			ret = ser_write(&l->io, p + 2, p[1]);
+			next = p + 2 + p[1];
+			break;
 
-	/* Read ACK */
-	for(i=0;i<sizeof(data);i++)
-		if (readchar(fd, &data[i], 100)<0)
-			break ;
+		case INIT_EXPECT:
+			script_wait(l, get16(p + 1));
+			ret = ser_expect(&l->io, p + 4, p[3]);
+			next = p + 4 + p[3];
+			break;
 
-	return 0;
-}
+		case INIT_SCAN:
+			script_wait(l, get16(p + 1));
+			ret = ser_scan(&l->io, p + 4, p[3]);
+			next = p + 4 + p[3];
+			break;
 
-static int fujitsu_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	unsigned char cmd, data;
+		case INIT_READ:
+			if (p[3] + p[4] > sizeof(l->data))
+				return -1;
+			script_wait(l, get16(p + 1));
+			ret = ser_read(&l->io, l->data + p[3], p[4]);
+			next = p + 5;
+			break;
 
-	/* Wake up the touchscreen */
-	cmd = 0xff; /* Dummy data */;
-	if (write(fd, &cmd, 1) != 1)
-		return -1;
+		case INIT_SYNC:
+			script_wait(l, get16(p + 1));
+			while (!(ret = ser_getc(&l->io, l->data)) &&
+			       (l->data[0] & p[4]) != p[5]) {
+				if (++l->tries == p[3]) {
+					ret = -1;
+					break;
+				}
+				ser_timeout(&l->io, get16(p + 1));
+			}
+			next = p + 6;
+			break;
 
-	/* Wait to settle down */
-	usleep(100 * 1000); /* 100 ms */
+		case INIT_CHECK:
+			if (p[1] >= sizeof(l->data) ||
+			    (l->data[p[1]] & p[2]) != p[3])
+				return -1;
+			next = p + 4;
+			break;
 
-	/* Reset the touchscreen */
-	cmd = 0x81; /* Cold reset */
-	if (write(fd, &cmd, 1) != 1)
-		return -1;
+		case INIT_IFEQ:
+		case INIT_IFNE:
+			if (p[1] >= sizeof(l->data))
+				return -1;
+			next = p + 6;
+			if (((l->data[p[1]] & p[2]) == p[3]) == (op == INIT_IFEQ))
+				next = base + get16(p + 4);
+			break;
 
-	/* Read ACK */
-	if (readchar(fd, &data, 100) || (data & 0xbf) != 0x90)
-		return -1;
+		case INIT_SLEEP:
+			script_wait(l, get16(p + 1));
+			ret = ser_sleep(&l->io);
+			next = p + 3;
+			break;
 
-	/* Read status */
-	if (readchar(fd, &data, 100) || data != 0x00)
-		return -1;
+		case INIT_SETLINE:
+			setline(l->io.fd, get32(p + 1), get32(p + 5));
+			next = p + 9;
+			break;
 
-	return 0;
-}
+		case INIT_DTR:
+			/* Lines without modem control (such as ptys) have
+			   no DTR */
+			if (ioctl(l->io.fd, TIOCMGET, &line) < 0) {
+				if (errno != EINVAL && errno != ENOTTY)
+					ret = -1;
+			} else {
+				line = p[1] ? line | TIOCM_DTR : line & ~TIOCM_DTR;
+				if (ioctl(l->io.fd, TIOCMSET, &line) < 0)
+					ret = -1;
+			}
+			next = p + 2;
+			break;
 
-static int tsc40_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	unsigned char cmd[2], data;
-	unsigned int eeprom;
+		case INIT_DISCARD:
+			ser_fill(&l->io);
+			ser_discard(&l->io);
+			next = p + 1;
+			break;
 
-	/* Datasheet can be found here:
-	 * http://www.distec.de/PDF/Drivers/DMC/TSC40_Protocol_Description.pdf
-	 */
+		case INIT_LINEEND:
+			l->term = p[1];
+			l->skip = p[2];
+			next = p + 3;
+			break;
 
-#define TSC40_CMD_DATA1	0x01
-#define TSC40_CMD_RATE	0x05
-#define TSC40_CMD_ID	0x15
-#define TSC40_CMD_RESET	0x55
+		case INIT_GETLINE:
+			script_wait(l, get16(p + 1));
+			ret = ser_getline(&l->io, l->term, l->skip,
+					  l->r, sizeof(l->r));
+			next = p + 3;
+			break;
 
-#define TSC40_RATE_150	0x45
-#define TSC40_NACK	0x15
+		case INIT_AWAIT:
+			script_wait(l, get16(p + 1));
+			while (!(ret = ser_getline(&l->io, l->term, l->skip,
+						   l->r, sizeof(l->r))) &&
+			       strncmp(l->r, (const char *)p + 5, p[4])) {
+				if (++l->tries == p[3]) {
+					ret = -1;
+					break;
+				}
+				ser_timeout(&l->io, get16(p + 1));
+			}
+			next = p + 5 + p[4];
+			break;
 
-	/* trigger a software reset to get into a well known state */
-	cmd[0] = TSC40_CMD_RESET;
-	if (write(fd, cmd, 1) != 1)
-		return -1;
-	
-	/* wait to settle down */
-	usleep(15 * 1000); /* 15 ms */	
-	
-	/* read panel ID to check if an EEPROM is used */
-	cmd[0] = TSC40_CMD_ID;
-	if (write(fd, cmd, 1) != 1)
-		return -1;
-	
-	if (readchar(fd, &data, 100))
-		return -1;
+		case INIT_IFPREFIX:
+		case INIT_IFIPREFIX:
+		case INIT_IFCONTAINS:
+			len = p[1];
+			next = p + 4 + len;
+			if (op == INIT_IFPREFIX ?
+			    !strncmp(l->r, (const char *)p + 2, len) :
+			    op == INIT_IFIPREFIX ?
+			    !strncasecmp(l->r, (const char *)p + 2, len) :
+			    !!memmem(l->r, strlen(l->r), p + 2, len))
+				next = base + get16(p + 2 + len);
+			break;
 
-	/* if bit7 is not set --> EEPROM is used */
-	eeprom = !((data & 0x80) >> 7);
-	
-	/* ignore 2nd byte of ID cmd */
-	if (readchar(fd, &data, 100))
-		return -1;
-	
-	/* set coordinate oupt rate setting */
-	cmd[0] = TSC40_CMD_RATE;
-	cmd[1] = TSC40_RATE_150;
-	if (write(fd, cmd, 2) != 2)
-		return -1;
-	
-	/* read response */
-	if (readchar(fd, &data, 100))
-		return -1;
-	
-	if ((data == TSC40_NACK) && (eeprom == 1)) {
-		/* get detailed failure information */
-		if (readchar(fd, &data, 100))
-			return -1;
+		case INIT_IFOK:
+		case INIT_IFFAIL:
+			next = p + 3;
+			if (!l->res == (op == INIT_IFOK))
+				next = base + get16(p + 1);
+			break;
 
-		switch (data) {
-		case 0x02:	/* EEPROM data abnormal */
-		case 0x04:	/* EEPROM write error */
-		case 0x08:	/* Touch screen not connected */
-			return -1;
+		case INIT_COUNT:
+			l->count = p[1];
+			next = p + 2;
 			break;
-			
-		default:
-			/* 0x01: EEPROM data empty */
+
+		case INIT_LOOP:
+			next = p + 3;
+			if (--l->count > 0)
+				next = base + get16(p + 1);
 			break;
-		}
-	}
 
-	/* start sending coordinate informations */
-	cmd[0] = TSC40_CMD_DATA1;
-	if (write(fd, cmd, 1) != 1)
-		return -1;
+		case INIT_JUMP:
+			next = base + get16(p + 1);
+			break;
 
-	return 0;
-}
+		case INIT_ID:
+			l->id = get32(p + 1);
+			next = p + 5;
+			break;
 
-static int t213_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	char cmd[]={0x0a,1,'A'};
-	int count=10;
-	int state=0;
-	unsigned char data;
+		case INIT_EXTRA:
+			l->extra = get32(p + 1);
+			next = p + 5;
+			break;
 
-	/*
-	 * In case the controller is in "ELO-mode" send a few times
-	 * the check active packet to force it into the documented
-	 * touchkit mode.
-	 */
-	while (count>0) {
-		if (write(fd, &cmd, 3) != 3)
-			return -1;
-		while (!readchar(fd, &data, 100)) {
-			switch (state) {
-			case 0:
-				if (data==0x0a) {
-					state=1;
-				}
-				break;
-			case 1:
-				if (data==1) {
-					state=2;
-				} else if (data!=0x0a) {
-					state=0;
+		case INIT_DUMP:
+			script_wait(l, 1);
+			while ((ret = ser_getc(&l->io, l->data)) != INIT_PENDING) {
+				if (!ret) {
+					printf("%02x (%c) ", l->data[0],
+					       ((l->data[0] > 32) && (l->data[0] < 127)) ?
+					       l->data[0] : 'x');
+					l->tries = 1;
+				} else if (l->tries) {
+					printf("\n");
+					l->tries = 0;
 				}
-				break;
-			case 2:
-				if (data=='A') {
-					return 0;
-				} else if (data==0x0a) {
-					state=1;
-				} else {
-					state=0;
-				}
-				break;
+				ser_timeout(&l->io, 1);
 			}
-					
-		}
-		count--;
-	}
-	return -1;
-}
-
-static int zhenhua_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	/* Zhen Hua 5 byte protocol: first (synchronization) byte allways
-	 * contain 0xF7, next four bytes are axis of controller with values
-	 * between 50-200.
-	 * Incoming data (each byte) have reversed bits (lowest bit is
-	 * highest bit) - something like little-endian but on bit level.
-	 * Synchronization byte without reversing bits have (raw) value:
-	 * 0xEF
-	 *
-	 * Initialization is almost same as twiddler_init */
-
-	unsigned char c[10];
-	int count;
+			return INIT_PENDING;
 
-	for (count=0 ; count < 5 ; count++) {
-		if(readchar(fd, c+0, 500)) return -1;
-		if(c[0] == 0xef) break;
-	}
+		default:
+			return -1;
+		}
 
-	if (count == 5) {
-		/* Could not find header byte in data stream */
-		return -1;
-	}
+		if (ret == INIT_PENDING)
+			return INIT_PENDING;
+		if (ret && !(p[0] & INIT_TRY))
+			return -1;
 
-	/* Read remaining 4 bytes plus the full next data packet */
-	for (count = 1; count < 10; count++) {
-		if (readchar(fd, c+count, 500)) return -1;
+		l->res = ret;
+		l->waiting = 0;
+		l->ip = next;
 	}
-
-	/* check if next sync byte exists */
-	if (c[5] != 0xef)
-		return -1;
-
-	return 0;
-		
 }
 
-#define EP_PROMPT_MODE  "B"     /* Prompt mode */
-#define EP_ABSOLUTE     "F"     /* Absolute Mode */
-#define EP_UPPER_ORIGIN "b"     /* Origin upper left */
-#define EP_STREAM_MODE  "@"     /* Stream mode */
-
-static int easypen_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	char buf[256];
-
-	/* reset */
-	write(fd, 0, 1);
-	usleep(400000);
-
-	/* set prompt mode */
-	if (write(fd, EP_PROMPT_MODE, 1) == -1)
-		return -1;
-
-	/* clear buffer */
-	while (read(fd, buf, sizeof(buf)) == sizeof(buf));
-
-	/* set options */
-	if (write(fd, EP_ABSOLUTE EP_STREAM_MODE EP_UPPER_ORIGIN, 3) == -1)
-		return -1;
-
-	return 0;
-}
-
-static int dump_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	unsigned char c, o = 0;
-
-	c = 0x80;
-
-	if (write(fd, &c, 1) != 1)         /* Enable command */
-                return -1;
-
-	while (1)
-		if (!readchar(fd, &c, 1)) {
-			printf("%02x (%c) ", c, ((c > 32) && (c < 127)) ? c : 'x');
-			o = 1;
-		} else {
-			if (o) {
-				printf("\n");
-				o = 0;
-			}
-		}
-}
-
-#define WACOM_IV_RESET_BAUD "\r$"
-#define WACOM_IV_RESET "\r#"
-#define WACOM_IV_STOP "SP\r"
-enum { WACOM_IV_RESET_BAUD_LEN = 2, WACOM_IV_RESET_LEN = 2, WACOM_IV_STOP_LEN = 3 };
-
-static int wacom_iv_init(int fd, unsigned long *id, unsigned long *extra)
-{
-	setline(fd, CS8 | CRTSCTS, B38400);
-	if (write(fd, WACOM_IV_RESET_BAUD, WACOM_IV_RESET_BAUD_LEN) != WACOM_IV_RESET_BAUD_LEN)
-		return -1;
-	usleep(250 * 1000);
-	if (write(fd, WACOM_IV_RESET, WACOM_IV_RESET_LEN) != WACOM_IV_RESET_LEN)
-		return -1;
-	usleep(75 * 1000);
-
-	setline(fd, CS8 | CRTSCTS, B19200);
-	if (write(fd, WACOM_IV_RESET_BAUD, WACOM_IV_RESET_BAUD_LEN) != WACOM_IV_RESET_BAUD_LEN)
-		return -1;
-	usleep(250 * 1000);
-	if (write(fd, WACOM_IV_RESET, WACOM_IV_RESET_LEN) != WACOM_IV_RESET_LEN)
-		return -1;
-	usleep(75 * 1000);
-
-	setline(fd, CS8 | CRTSCTS, B9600);
-	if (write(fd, WACOM_IV_RESET_BAUD, WACOM_IV_RESET_BAUD_LEN) != WACOM_IV_RESET_BAUD_LEN)
-		return -1;
-	usleep(250 * 1000);
-	if (write(fd, WACOM_IV_RESET, WACOM_IV_RESET_LEN) != WACOM_IV_RESET_LEN)
-		return -1;
-	usleep(75 * 1000);
-	if (write(fd, WACOM_IV_STOP, WACOM_IV_STOP_LEN) != WACOM_IV_STOP_LEN)
-		return -1;
-	usleep(30 * 1000);
-
-	return 0;
-}
-
-struct input_types {
-	const char *name;
-	const char *name2;
-	const char *desc;
-	int speed;
-	int flags;
-	unsigned long type;
-	unsigned long id;
-	unsigned long extra;
-	int flush;
-	int (*init)(int fd, unsigned long *id, unsigned long *extra);
-};
+struct input_types {
+	const char *name;
+	const char *name2;
+	const char *desc;
+	int speed;
+	int flags;
+	unsigned long type;
+	unsigned long id;
+	unsigned long extra;
+	int flush;
+	const unsigned char *init;
+};
 
 static struct input_types input_types[] = {
 { "--sunkbd",		"-skb",		"Sun Type 4 and Type 5 keyboards",
@@ -651,16 +452,16 @@ static struct input_types input_types[] = {
 	SERIO_SPACEORB,		0x00,	0x00,	1,	NULL },
 { "--spaceball",	"-sbl",		"SpaceBall 2003 / 3003 / 4000 FLX",
 	B9600, CS8,
-	SERIO_SPACEBALL,	0x00,	0x00,	0,	spaceball_init },
+	SERIO_SPACEBALL,	0x00,	0x00,	0,	INIT_SCRIPT_SPACEBALL },
 { "--magellan",		"-mag",		"Magellan / SpaceMouse",
 	B9600, CS8 | CSTOPB | CRTSCTS,
-	SERIO_MAGELLAN,		0x00,	0x00,	1,	magellan_init },
+	SERIO_MAGELLAN,		0x00,	0x00,	1,	INIT_SCRIPT_MAGELLAN },
 { "--warrior",		"-war",		"WingMan Warrior",
 	B1200, CS7 | CSTOPB,
-	SERIO_WARRIOR,		0x00,	0x00,	1,	warrior_init },
+	SERIO_WARRIOR,		0x00,	0x00,	1,	INIT_SCRIPT_WARRIOR },
 { "--stinger",		"-sting",	"Gravis Stinger",
 	B1200, CS8,
-	SERIO_STINGER,		0x00,	0x00,	1,	stinger_init },
+	SERIO_STINGER,		0x00,	0x00,	1,	INIT_SCRIPT_STINGER },
 { "--mousesystems",	"-msc",		"3-button Mouse Systems mouse",
 	B1200, CS8,
 	SERIO_MSC,		0x00,	0x01,	1,	NULL },
@@ -685,13 +486,13 @@ static struct input_types input_types[] = {
 { "--mmwheel",		"-mmw",
 			"Logitech mouse with 4-5 buttons or a wheel",
 	B1200, CS7 | CSTOPB,
-	SERIO_MZP,		0x00,	0x13,	1,	mzp_init },
+	SERIO_MZP,		0x00,	0x13,	1,	INIT_SCRIPT_MMWHEEL },
 { "--iforce",		"-ifor",	"I-Force joystick or wheel",
 	B38400, CS8,
 	SERIO_IFORCE,		0x00,	0x00,	0,	NULL },
 { "--newtonkbd",	"-newt",	"Newton keyboard",
 	B9600, CS8,
-	SERIO_NEWTON,		0x00,	0x00,	1,	newton_init },
+	SERIO_NEWTON,		0x00,	0x00,	1,	INIT_SCRIPT_NEWTONKBD },
 { "--h3600ts",		"-ipaq",	"Ipaq h3600 touchscreen",
 	B115200, CS8,
 	SERIO_H3600,		0x00,	0x00,	0,	NULL },
@@ -703,10 +504,10 @@ static struct input_types input_types[] = {
 	SERIO_PS2SER,		0x00,	0x00,	1,	NULL },
 { "--twiddler",		"-twid",	"Handykey Twiddler chording keyboard",
 	B2400, CS8,
-	SERIO_TWIDKBD,		0x00,	0x00,	0,	twiddler_init },
+	SERIO_TWIDKBD,		0x00,	0x00,	0,	INIT_SCRIPT_TWIDDLER },
 { "--twiddler-joy",	"-twidjoy",	"Handykey Twiddler used as a joystick",
 	B2400, CS8,
-	SERIO_TWIDJOY,		0x00,	0x00,	0,	twiddler_init },
+	SERIO_TWIDJOY,		0x00,	0x00,	0,	INIT_SCRIPT_TWIDDLER },
 { "--elotouch",		"-elo",		"ELO touchscreen, 10-byte mode",
 	B9600, CS8,
 	SERIO_ELO,		0x00,	0x00,	0,	NULL },
@@ -725,11 +526,11 @@ static struct input_types input_types[] = {
 #ifdef SERIO_TSC40
 { "--tsc",		"-tsc",		"TSC-10/25/40 serial touchscreen",
 	B9600, CS8,
-	SERIO_TSC40,		0x00,	0x00,	0,	tsc40_init },
+	SERIO_TSC40,		0x00,	0x00,	0,	INIT_SCRIPT_TSC40 },
 #endif
 { "--touchit213",	"-t213",	"Sahara Touch-iT213 Tablet PC",
 	B9600, CS8,
-	SERIO_TOUCHIT213,	0x00,	0x00,	0,	t213_init },
+	SERIO_TOUCHIT213,	0x00,	0x00,	0,	INIT_SCRIPT_TOUCHIT213 },
 { "--touchright",	"-tr",	"Touchright serial touchscreen",
 	B9600, CS8 | CRTSCTS,
 	SERIO_TOUCHRIGHT,	0x00,	0x00,	0,	NULL },
@@ -741,7 +542,7 @@ static struct input_types input_types[] = {
 	SERIO_PENMOUNT,		0x00,	0x00,	0,	NULL },
 { "--penmount6000",		"-pm6k",	"PenMount 6000 touchscreen",
 	B19200, CS8,
-	SERIO_PENMOUNT,		0x01,	0x00,	0,	pm6k_init },
+	SERIO_PENMOUNT,		0x01,	0x00,	0,	INIT_SCRIPT_PENMOUNT6000 },
 { "--penmount3000",		"-pm3k",	"PenMount 3000 touchscreen",
 	B38400, CS8,
 	SERIO_PENMOUNT,		0x02,	0x00,	0,	NULL },
@@ -750,16 +551,16 @@ static struct input_types input_types[] = {
 	SERIO_PENMOUNT,		0x03,	0x00,	0,	NULL },
 { "--fujitsu",		"-fjt",	"Fujitsu serial touchscreen",
 	B9600, CS8,
-	SERIO_FUJITSU,		0x00,	0x00,	1,	fujitsu_init },
+	SERIO_FUJITSU,		0x00,	0x00,	1,	INIT_SCRIPT_FUJITSU },
 { "--ps2mult",	"-ps2m",	"PS/2 serial multiplexer",
 	B57600, CS8,
 	SERIO_PS2MULT,		0x00,	0x00,	1,	NULL },
 { "--zhen-hua",		"-zhen",	"Zhen Hua 5-byte protocol",
 	B19200, CS8,
-	SERIO_ZHENHUA,		0x00,	0x00,	0,	zhenhua_init },
+	SERIO_ZHENHUA,		0x00,	0x00,	0,	INIT_SCRIPT_ZHEN_HUA },
 { "--easypen",		"-ep",		"Genius EasyPen 3x4 tablet",
 	B9600, CS8|CREAD|CLOCAL|HUPCL|PARENB|PARODD,
-	SERIO_EASYPEN,		0x00,	0x00,	0,	easypen_init },
+	SERIO_EASYPEN,		0x00,	0x00,	0,	INIT_SCRIPT_EASYPEN },
 #ifdef SERIO_TAOSEVM
 { "--taos-evm",		"-taos",	"TAOS evaluation module",
 	B1200, CS8,
@@ -767,22 +568,73 @@ static struct input_types input_types[] = {
 #endif
 { "--dump",		"-dump",	"Just enable device",
 	B2400, CS8,
-	0,			0x00,	0x00,	0,	dump_init },
+	0,			0x00,	0x00,	0,	INIT_SCRIPT_DUMP },
 { "--w8001",		"-w8001",	"Wacom W8001",
 	B38400, CS8,
 	SERIO_W8001,		0x00,	0x00,	0,	NULL },
 { "--wacom_iv",		"-wacom_iv",	"Wacom protocol 4 tablet",
 	B9600, CS8 | CRTSCTS,
-	SERIO_WACOM_IV,		0x00,	0x00,	0,	wacom_iv_init },
+	SERIO_WACOM_IV,		0x00,	0x00,	0,	INIT_SCRIPT_WACOM_IV },
 { NULL, NULL, NULL, 0, 0, 0, 0, 0, 0, NULL }
 };
 
+static const struct {
+	int baud;
+	int speed;
+} bauds[] = {
+	{ 1200, B1200 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+	{ 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 },
+	{ 115200, B115200 },
+	{ 0, 0 }
+};
+
+static struct input_types *find_type(const char *name)
+{
+	struct input_types *type;
+
+	for (type = input_types; type->name; type++)
+		if (!strcasecmp(name, type->name) ||
+		    !strcasecmp(name, type->name2))
+			return type;
+
+	return NULL;
+}
+
+/* Returns the termios speed of a baud rate, -1 if it isn't one */
+static int baud_speed(int baud)
+{
+	int i;
+
+	for (i = 0; bauds[i].baud; i++)
+		if (bauds[i].baud == baud)
+			return bauds[i].speed;
+
+	return -1;
+}
+
+/* Returns the baud rate of a termios speed, 0 if unknown */
+static int speed_baud(int speed)
+{
+	int i;
+
+	for (i = 0; bauds[i].baud; i++)
+		if (bauds[i].speed == speed)
+			break;
+
+	return bauds[i].baud;
+}
+
 static void show_help(void)
 {
 	struct input_types *type;
 
 	puts("");
-	puts("Usage: inputattach [--daemon] [--baud <baud>] [--always] [--noinit] <mode> <device>");
+	puts("Usage: inputattach [--daemon] [--stats] [--stats-socket <path>] [--baud <baud>] [--always] [--noinit] <mode> <device>");
+	puts("       inputattach --noattach [--baud <baud>] [--always] [--noinit] <mode> <device>");
+	puts("       inputattach [--daemon] [--always] [--noinit] --autodetect <device>");
+	puts("       inputattach [--daemon] [--stats-socket <path>] --supervise <config>");
+	puts("       inputattach --record <file> [--baud <baud>] <mode> <device>");
+	puts("       inputattach [--replay-speed <factor>] --replay <file>");
 	puts("");
 	puts("Modes:");
 
@@ -793,143 +645,218 @@ static void show_help(void)
 	puts("");
 }
 
-/* palmed wisdom from http://stackoverflow.com/questions/1674162/ */
-#define RETRY_ERROR(x) (x == EAGAIN || x == EWOULDBLOCK || x == EINTR)
-
-int main(int argc, char **argv)
+/*
+ * Handles the options which apply to a single line, from the command
+ * line or from a line of a --supervise configuration file. *i is moved
+ * past any argument consumed.
+ */
+static int parse_line_arg(struct serline *l, int argc, char **argv, int *i)
 {
-	unsigned long devt;
-	int ldisc;
-	struct input_types *type = NULL;
-	const char *device = NULL;
-	int daemon_mode = 0;
-	int need_device = 0;
-	unsigned long id, extra;
-	int fd;
-	int i;
-	unsigned char c;
-	int retval;
-	int baud = -1;
-	int ignore_init_res = 0;
-	int no_init = 0;
-
-	for (i = 1; i < argc; i++) {
-		if (!strcasecmp(argv[i], "--help")) {
+	char *end;
+
+	if (!strcasecmp(argv[*i], "--always")) {
+		l->ignore_init_res = 1;
+	} else if (!strcasecmp(argv[*i], "--noinit")) {
+		l->no_init = 1;
+	} else if (l->type && !l->device) {
+		l->device = argv[*i];
+	} else if (!strcasecmp(argv[*i], "--baud")) {
+		if (argc <= *i + 1) {
 			show_help();
-			return EXIT_SUCCESS;
-		} else if (!strcasecmp(argv[i], "--daemon")) {
-			daemon_mode = 1;
-		} else if (!strcasecmp(argv[i], "--always")) {
-			ignore_init_res = 1;
-		} else if (!strcasecmp(argv[i], "--noinit")) {
-			no_init = 1;
-		} else if (need_device) {
-			device = argv[i];
-			need_device = 0;
-		} else if (!strcasecmp(argv[i], "--baud")) {
-			if (argc <= i + 1) {
-				show_help();
-				fprintf(stderr,
-					"inputattach: require baud rate\n");
-				return EXIT_FAILURE;
-			}
+			fprintf(stderr,
+				"inputattach: require baud rate\n");
+			return -1;
+		}
 
-			baud = atoi(argv[++i]);
-		} else {
-			if (type && type->name) {
-				fprintf(stderr,
-					"inputattach: '%s' - "
-					"only one mode allowed\n", argv[i]);
-				return EXIT_FAILURE;
-			}
-			for (type = input_types; type->name; type++) {
-				if (!strcasecmp(argv[i], type->name) ||
-				    !strcasecmp(argv[i], type->name2)) {
-					break;
-				}
-			}
-			if (!type->name) {
-				fprintf(stderr,
-					"inputattach: invalid mode '%s'\n",
-					argv[i]);
-				return EXIT_FAILURE;
-			}
-			need_device = 1;
+		/* 0 would hang the line up */
+		l->baud = strtol(argv[++*i], &end, 10);
+		if (*end || end == argv[*i] || baud_speed(l->baud) < 0) {
+			fprintf(stderr, "inputattach: invalid baud rate '%s'\n",
+				argv[*i]);
+			return -1;
+		}
+	} else {
+		if (l->type) {
+			fprintf(stderr,
+				"inputattach: '%s' - "
+				"only one mode allowed\n", argv[*i]);
+			return -1;
+		}
+		l->type = find_type(argv[*i]);
+		if (!l->type) {
+			fprintf(stderr,
+				"inputattach: invalid mode '%s'\n",
+				argv[*i]);
+			return -1;
 		}
 	}
 
-	if (!type || !type->name) {
+	return 0;
+}
+
+/* Checks that a line is fully specified and works out its settings */
+static int check_line(struct serline *l)
+{
+	if (!l->type || !l->type->name) {
 		fprintf(stderr, "inputattach: must specify mode\n");
-		return EXIT_FAILURE;
-        }
+		return -1;
+	}
 
-	if (need_device) {
+	if (!l->device) {
 		fprintf(stderr, "inputattach: must specify device\n");
-		return EXIT_FAILURE;
+		return -1;
+	}
+
+	l->flags = l->type->flags;
+	l->speed = l->type->speed;
+
+	if (l->baud) {
+		if (baud_speed(l->baud) < 0) {
+			fprintf(stderr, "inputattach: invalid baud rate '%d'\n",
+					l->baud);
+			return -1;
+		}
+		l->speed = baud_speed(l->baud);
 	}
 
-	fd = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	ser_init(&l->io, -1);
+
+	return 0;
+}
+
+static int line_open(struct serline *l)
+{
+	int fd;
+
+	l->stats.attempts++;
+	l->stats.attached = 0;
+	memset(l->stats.phase, 0, sizeof(l->stats.phase));
+	l->stats.mark = stats_now();
+
+	fd = open(l->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
 	if (fd < 0) {
 		fprintf(stderr, "inputattach: '%s' - %s\n",
-			device, strerror(errno));
-		return 1;
-	}
-
-	switch(baud) {
-	case -1: break;
-	case 2400: type->speed = B2400; break;
-	case 4800: type->speed = B4800; break;
-	case 9600: type->speed = B9600; break;
-	case 19200: type->speed = B19200; break;
-	case 38400: type->speed = B38400; break;
-	default:
-		fprintf(stderr, "inputattach: invalid baud rate '%d'\n",
-				baud);
-		return EXIT_FAILURE;
+			l->device, strerror(errno));
+		return -1;
 	}
 
-	setline(fd, type->flags, type->speed);
+	setline(fd, l->flags, l->speed);
+	stats_phase(l, PHASE_OPEN);
 
-	if (type->flush)
-		while (!readchar(fd, &c, 100))
-			/* empty */;
+	ser_init(&l->io, fd);
+	l->id = l->type->id;
+	l->extra = l->type->extra;
+	script_start(l, l->type->init);
 
-	id = type->id;
-	extra = type->extra;
+	l->state = LINE_FLUSH;
+	ser_timeout(&l->io, 100);
 
-	if (type->init && !no_init) {
-		if (type->init(fd, &id, &extra)) {
-			if (ignore_init_res) {
-				fprintf(stderr, "inputattach: ignored device initialization failure\n");
-			} else {
-				fprintf(stderr, "inputattach: device initialization failed\n");
-				return EXIT_FAILURE;
+	return 0;
+}
+
+/*
+ * Takes an open line through flushing and device initialization as far
+ * as possible without blocking. Returns 0 once the line is ready to be
+ * attached, -1 on failure, or INIT_PENDING if more input or
+ * the line's deadline is awaited.
+ */
+static int line_step(struct serline *l)
+{
+	int ret;
+
+	if (ser_flush(&l->io) < 0)
+		return -1;
+
+	switch (l->state) {
+	case LINE_FLUSH:
+		if (l->type->flush) {
+			if (ser_avail(&l->io)) {
+				/* Wait for 100 ms of silence */
+				ser_discard(&l->io);
+				ser_timeout(&l->io, 100);
+			}
+			if (ser_sleep(&l->io) == INIT_PENDING)
+				return INIT_PENDING;
+		}
+		stats_phase(l, PHASE_FLUSH);
+		l->state = LINE_INIT;
+		/* fall through */
+
+	case LINE_INIT:
+		if (l->type->init && !l->no_init) {
+			ret = script_step(l);
+			if (ret == INIT_PENDING)
+				return INIT_PENDING;
+			if (ret) {
+				if (!l->ignore_init_res) {
+					fprintf(stderr, "inputattach: '%s' - device initialization failed\n",
+						l->device);
+					return -1;
+				}
+				fprintf(stderr, "inputattach: '%s' - ignored device initialization failure\n",
+					l->device);
 			}
 		}
+		stats_phase(l, PHASE_INIT);
+		l->stats.init_rx = l->io.rx_bytes;
+		l->stats.init_tx = l->io.tx_bytes;
+		l->state = LINE_READY;
+		/* fall through */
+
+	case LINE_READY:
+		return 0;
 	}
 
+	return -1;
+}
+
+static int line_attach(struct serline *l)
+{
+	struct serial_icounter_struct ic;
+	unsigned long devt;
+	int ldisc;
+
 	ldisc = N_MOUSE;
-	if (ioctl(fd, TIOCSETD, &ldisc) < 0) {
-		fprintf(stderr, "inputattach: can't set line discipline\n");
-		return EXIT_FAILURE;
+	if (ioctl(l->io.fd, TIOCSETD, &ldisc) < 0) {
+		fprintf(stderr, "inputattach: '%s' - can't set line discipline\n",
+			l->device);
+		return -1;
 	}
+	stats_phase(l, PHASE_LDISC);
 
-	devt = type->type | (id << 8) | (extra << 16);
+	devt = l->type->type | (l->id << 8) | (l->extra << 16);
 
-	if (ioctl(fd, SPIOCSTYPE, &devt) < 0) {
-		fprintf(stderr, "inputattach: can't set device type\n");
-		return EXIT_FAILURE;
+	if (ioctl(l->io.fd, SPIOCSTYPE, &devt) < 0) {
+		fprintf(stderr, "inputattach: '%s' - can't set device type\n",
+			l->device);
+		return -1;
 	}
+	stats_phase(l, PHASE_TYPE);
 
-	retval = EXIT_SUCCESS;
-	if (daemon_mode && daemon(0, 0) < 0) {
-		perror("inputattach");
-		retval = EXIT_FAILURE;
-	}
+	/* From now on, only the serial driver sees the traffic */
+	l->stats.attached = l->stats.last_rx = stats_now();
+	l->stats.icount = !ioctl(l->io.fd, TIOCGICOUNT, &ic);
+	l->stats.base_rx = l->stats.icount ? ic.rx : 0;
+	l->stats.base_tx = l->stats.icount ? ic.tx : 0;
+	l->stats.rx = l->stats.tx = 0;
+
+	l->state = LINE_ATTACHED;
+
+	return 0;
+}
+
+/*
+ * The serial port only exists on the input side for as long as somebody
+ * sits in read() on the line, so this blocks until the line hangs up.
+ */
+static void line_hold(int fd)
+{
+	int ldisc;
 
 	errno = 0;
 	do {
-		i = read(fd, NULL, 0);
+		if (read(fd, NULL, 0) < 0)
+			continue;
 	} while (RETRY_ERROR(errno));
 
 	ldisc = 0;
@@ -939,6 +866,1269 @@ int main(int argc, char **argv)
 		ioctl(fd, TIOCSETD, &ldisc);
 	}
 	close(fd);
+}
+
+/*
+ * Autodetection. Most devices only make themselves known by the framing
+ * of the data they stream, so the line is first listened to at each
+ * setting used by such a protocol, and what was heard is scored against
+ * every protocol sharing that framing at once. Devices which stay quiet
+ * until spoken to are then tried by running their initialization
+ * handshake, cheapest first. Last, the streaming protocols are listened
+ * to at the other baud rates, in case the device was set to one of them.
+ */
+
+#define PROBE_LISTEN		500	/* ms spent listening per setting */
+#define PROBE_BYTES		160	/* a few of the longest packets */
+#define PROBE_MIN_PACKETS	4
+#define PROBE_THRESHOLD		90	/* % of well-formed packets */
+#define PROBE_HANDSHAKE		3000	/* ms allowed per handshake */
+
+/* The part of the line settings that matters for receiving */
+#define PROBE_FRAMING		(CSIZE | CSTOPB | PARENB | PARODD)
+
+struct signature {
+	const char *name;		/* mode */
+	int size;			/* packet size, 0 for text lines */
+	unsigned char sync_mask, sync;	/* first byte of a packet */
+	unsigned char mask, value;	/* following bytes */
+	int (*check)(const unsigned char *packet);
+	const char *lead;		/* first characters of text lines */
+};
+
+static int elo_check(const unsigned char *packet)
+{
+	unsigned char csum = 0xaa;
+	int i;
+
+	for (i = 0; i < 9; i++)
+		csum += packet[i];
+
+	return csum == packet[9];
+}
+
+static const struct signature signatures[] = {
+	{ "--microsoft",	3, 0x40, 0x40, 0x40, 0x00, NULL, NULL },
+	{ "--intellimouse",	4, 0x40, 0x40, 0x40, 0x00, NULL, NULL },
+	{ "--mousesystems",	5, 0xf8, 0x80, 0x00, 0x00, NULL, NULL },
+	{ "--sunmouse",		3, 0xf8, 0x80, 0x00, 0x00, NULL, NULL },
+	{ "--zhen-hua",		5, 0xff, 0xef, 0x00, 0x00, NULL, NULL },
+	{ "--elotouch",		10, 0xff, 0x55, 0x00, 0x00, elo_check, NULL },
+	{ "--mtouch",		5, 0x80, 0x80, 0x80, 0x00, NULL, NULL },
+	{ "--spaceball",	0, 0, 0, 0, 0, NULL, "@DK.EMNP\"" },
+	{ "--magellan",		0, 0, 0, 0, 0, NULL, "dkvmnqzbpe" },
+	{ NULL, 0, 0, 0, 0, 0, NULL, NULL }
+};
+
+/* Devices which only answer when spoken to, cheapest handshake first */
+static const char *handshakes[] = {
+	"--fujitsu", "--stinger", "--twiddler", "--touchit213", NULL
+};
+
+static struct {
+	int flags, speed;
+} probed[sizeof(signatures) / sizeof(*signatures) *
+	 sizeof(bauds) / sizeof(*bauds)];
+static int num_probed;
+
+/* Percentage of lines in buf starting like those of the protocol */
+static int text_score(const struct signature *sig,
+		      const unsigned char *buf, int len)
+{
+	int i, start, lines = 0, good = 0;
+
+	/* Skip to the first complete line */
+	for (i = 0; i < len && buf[i] != '\r'; i++)
+		;
+
+	for (start = ++i; i < len; i++) {
+		if (buf[i] != '\r')
+			continue;
+		while (start < i && buf[start] == '\n')
+			start++;
+		lines++;
+		if (start < i && strchr(sig->lead, buf[start]))
+			good++;
+		start = i + 1;
+	}
+
+	return lines >= PROBE_MIN_PACKETS ? good * 100 / lines : 0;
+}
+
+/* Percentage of well-formed packets in buf, at the best alignment */
+static int signature_score(const struct signature *sig,
+			   const unsigned char *buf, int len)
+{
+	const unsigned char *p;
+	int offset, i, ok, good, bad, best = 0;
+
+	if (!sig->size)
+		return text_score(sig, buf, len);
+
+	for (offset = 0; offset < sig->size; offset++) {
+		good = bad = 0;
+		for (p = buf + offset; p + sig->size <= buf + len;
+		     p += sig->size) {
+			ok = (p[0] & sig->sync_mask) == sig->sync;
+			for (i = 1; ok && i < sig->size; i++)
+				ok = (p[i] & sig->mask) == sig->value;
+			if (ok && sig->check)
+				ok = sig->check(p);
+			if (ok)
+				good++;
+			else
+				bad++;
+		}
+		if (good >= PROBE_MIN_PACKETS &&
+		    good * 100 / (good + bad) > best)
+			best = good * 100 / (good + bad);
+	}
+
+	return best;
+}
+
+/* Collects up to PROBE_BYTES of whatever the line sends at a setting */
+static int probe_listen(struct serline *l, int flags, int speed,
+			unsigned char *buf)
+{
+	int len;
+
+	setline(l->io.fd, flags, speed);
+	tcflush(l->io.fd, TCIFLUSH);
+	ser_discard(&l->io);
+
+	ser_timeout(&l->io, PROBE_LISTEN);
+	while (ser_avail(&l->io) < PROBE_BYTES &&
+	       ser_sleep(&l->io) == SER_PENDING)
+		if (ser_wait(&l->io))
+			return -1;
+
+	for (len = 0; len < PROBE_BYTES && !ser_getc(&l->io, buf + len); len++)
+		;
+
+	return len;
+}
+
+/*
+ * Listens at a setting, unless already done, and picks the best scoring
+ * protocol with the same framing, and the same speed unless any_speed
+ * is set. Returns 1 if one was recognized.
+ */
+static int probe_setting(struct serline *l, int flags, int speed,
+			 int any_speed)
+{
+	const struct signature *sig;
+	struct input_types *type;
+	unsigned char buf[PROBE_BYTES];
+	int i, len, score, best = 0;
+
+	flags &= PROBE_FRAMING;
+
+	for (i = 0; i < num_probed; i++)
+		if (probed[i].flags == flags && probed[i].speed == speed)
+			return 0;
+	probed[num_probed].flags = flags;
+	probed[num_probed].speed = speed;
+	num_probed++;
+
+	len = probe_listen(l, flags, speed, buf);
+	if (len < 0)
+		return -1;
+
+	for (sig = signatures; sig->name; sig++) {
+		type = find_type(sig->name);
+		if ((type->flags & PROBE_FRAMING) != flags ||
+		    (!any_speed && type->speed != speed))
+			continue;
+
+		score = signature_score(sig, buf, len);
+		if (score > best) {
+			best = score;
+			l->type = type;
+			l->speed = speed;
+		}
+	}
+
+	return best >= PROBE_THRESHOLD;
+}
+
+/* Returns 0 if the device completed the handshake of the given type */
+static int probe_handshake(struct serline *l, struct input_types *type)
+{
+	int line = TIOCM_DTR | TIOCM_RTS;
+	long end = ser_now() + PROBE_HANDSHAKE;
+	int ret;
+
+	setline(l->io.fd, type->flags, type->speed);
+	ioctl(l->io.fd, TIOCMBIS, &line);
+	tcflush(l->io.fd, TCIOFLUSH);
+
+	ser_init(&l->io, l->io.fd);
+	l->id = type->id;
+	l->extra = type->extra;
+	script_start(l, type->init);
+
+	/* Some handshakes only give up once the line goes quiet */
+	while ((ret = script_step(l)) == INIT_PENDING)
+		if (ser_now() >= end || ser_wait(&l->io))
+			return -1;
+
+	if (!ret) {
+		l->type = type;
+		l->speed = type->speed;
+	}
+
+	return ret;
+}
+
+/*
+ * Works out the mode and baud rate of the device on l->device and
+ * stores them in the line.
+ */
+static int autodetect(struct serline *l)
+{
+	const struct signature *sig;
+	struct input_types *type;
+	int fd, i, ret = 0;
+
+	fd = open(l->device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (fd < 0) {
+		fprintf(stderr, "inputattach: '%s' - %s\n",
+			l->device, strerror(errno));
+		return -1;
+	}
+	ser_init(&l->io, fd);
+
+	/* Streaming protocols, at their own settings */
+	for (sig = signatures; sig->name && !ret; sig++) {
+		type = find_type(sig->name);
+		ret = probe_setting(l, type->flags, type->speed, 0);
+	}
+
+	/* Quiet devices */
+	for (i = 0; handshakes[i] && !ret; i++)
+		if ((type = find_type(handshakes[i])))
+			ret = !probe_handshake(l, type);
+
+	/* Streaming protocols, at the other baud rates */
+	for (sig = signatures; sig->name && !ret; sig++)
+		for (i = 0; bauds[i].baud && !ret; i++) {
+			type = find_type(sig->name);
+			ret = probe_setting(l, type->flags, bauds[i].speed, 1);
+		}
+
+	close(fd);
+	ser_init(&l->io, -1);
+
+	if (ret <= 0) {
+		fprintf(stderr, "inputattach: '%s' - %s\n", l->device,
+			ret < 0 ? "hung up during autodetection" :
+				  "no known device detected");
+		return -1;
+	}
+
+	l->baud = speed_baud(l->speed);
+
+	printf("inputattach: '%s' - detected %s (%s) at %d baud\n",
+		l->device, l->type->name, l->type->desc, l->baud);
+	fflush(stdout);
+
+	return 0;
+}
+
+/*
+ * Session recording and replay. A recorded session covers everything
+ * read from and written to the line from the moment it is opened, through
+ * device initialization and then whatever the device streams until
+ * inputattach is interrupted; the line is not attached. A replay plays
+ * the device side of such a session on a pseudo-terminal, from a child
+ * process, and attaches that as if it were the real line.
+ */
+
+#define REPLAY_LINGER	500	/* ms before hanging up at the end */
+
+/* The pty slave, held open while the replay runs: once it has been
+   opened, the master reads EIO whenever nobody holds it */
+static int replay_slave = -1;
+
+static volatile sig_atomic_t interrupted;
+
+static void interrupt_signal(int sig)
+{
+	interrupted = 1;
+}
+
+/* Makes SIGINT and SIGTERM interrupt blocking calls and set the flag */
+static void catch_interrupts(void)
+{
+	struct sigaction sa;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+}
+
+/* Records whatever the device sends until interrupted or hung up */
+static void line_record(struct serline *l)
+{
+	while (!interrupted) {
+		ser_timeout(&l->io, 1000);
+		if (ser_wait(&l->io))
+			break;
+		ser_discard(&l->io);
+	}
+}
+
+/*
+ * Plays the device side of a session on the pty master. What the device
+ * sent is written with the recorded delays divided by speed (no delays
+ * if 0), what the host sent is waited for and compared to the recording,
+ * so the replay keeps in step with the host whatever its timing. Returns
+ * the number of host writes which differ from the recording, or -1 if
+ * the host went away first.
+ */
+static int replay_feed(struct serlog *log, int master, double speed)
+{
+	unsigned char buf[SERBUF_RX_SIZE], in[SERBUF_RX_SIZE];
+	struct timespec ts;
+	long delay;
+	int dir, len, got, n, diverged = 0;
+
+	while (!interrupted &&
+	       (len = serlog_next(log, &dir, &delay, buf, sizeof(buf))) >= 0) {
+		if (dir == SERLOG_TX) {
+			for (got = 0; got < len && !interrupted; got += n) {
+				n = read(master, in + got, len - got);
+				if (n < 0 && errno == EINTR)
+					n = 0;
+				else if (n <= 0)
+					return -1;
+			}
+			if (interrupted)
+				break;
+			if (memcmp(in, buf, len))
+				diverged++;
+			continue;
+		}
+
+		if (speed > 0) {
+			delay /= speed;
+			ts.tv_sec = delay / 1000000;
+			ts.tv_nsec = delay % 1000000 * 1000;
+			while (nanosleep(&ts, &ts) && errno == EINTR &&
+			       !interrupted)
+				;
+		}
+
+		for (got = 0; got < len && !interrupted; got += n) {
+			n = write(master, buf + got, len - got);
+			if (n < 0 && errno == EINTR)
+				n = 0;
+			else if (n <= 0)
+				return -1;
+		}
+	}
+
+	return diverged;
+}
+
+/*
+ * Sets the line up from the log header, creates the pty and starts the
+ * child playing the device. Returns the child's pid, -1 on error.
+ */
+static pid_t replay_start(struct serline *l, const char *path, double speed)
+{
+	struct serlog log;
+	char mode[32];
+	struct termios t;
+	int baud, master, ret;
+	pid_t pid;
+
+	if (serlog_open(&log, path, mode, sizeof(mode), &baud)) {
+		fprintf(stderr, "inputattach: '%s' - not a session log\n",
+			path);
+		return -1;
+	}
+	serlog_close(&log);
+
+	if (!(l->type = find_type(mode))) {
+		fprintf(stderr, "inputattach: '%s' - invalid mode '%s'\n",
+			path, mode);
+		return -1;
+	}
+	l->baud = baud;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (master < 0 || grantpt(master) || unlockpt(master) ||
+	    !ptsname(master)) {
+		perror("inputattach: pty");
+		return -1;
+	}
+	l->device = strdup(ptsname(master));
+
+	/*
+	 * The child writes as soon as it starts, before the line is opened
+	 * and set up: until then the default line discipline would echo
+	 * the bytes back, to be taken for the host's.
+	 */
+	replay_slave = open(l->device, O_RDWR | O_NOCTTY);
+	if (replay_slave < 0 || tcgetattr(replay_slave, &t))
+		goto fail;
+	cfmakeraw(&t);
+	if (tcsetattr(replay_slave, TCSANOW, &t))
+		goto fail;
+
+	pid = fork();
+	if (pid < 0) {
+		perror("inputattach: fork");
+		close(replay_slave);
+		close(master);
+		return -1;
+	}
+
+	if (pid == 0) {
+		close(replay_slave);
+		/* The log is read again so as not to share its offset */
+		if (serlog_open(&log, path, mode, sizeof(mode), &baud))
+			_exit(2);
+		catch_interrupts();
+		ret = replay_feed(&log, master, speed);
+		if (!interrupted)
+			usleep(REPLAY_LINGER * 1000);
+		_exit(ret < 0 ? 2 : ret > 0);
+	}
+
+	close(master);
+
+	return pid;
+
+fail:
+	perror("inputattach: pty");
+	if (replay_slave >= 0)
+		close(replay_slave);
+	close(master);
+	return -1;
+}
+
+/* Stops the replay if still running and reports how it went */
+static int replay_finish(struct serline *l, pid_t pid)
+{
+	int status;
+
+	kill(pid, SIGTERM);
+	close(replay_slave);
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status))
+		return 0;
+
+	switch (WEXITSTATUS(status)) {
+	case 1:
+		fprintf(stderr, "inputattach: '%s' - replay diverged from the recording\n",
+			l->device);
+		return -1;
+	case 2:
+		fprintf(stderr, "inputattach: '%s' - replay ended early\n",
+			l->device);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Statistics. Every line keeps counts of its bring-up attempts and the
+ * time each phase of the last one took; once the line is attached, the
+ * bytes the serial driver has handled since then, and how long ago the
+ * last one came in. In supervisor mode (or single line mode with
+ * --stats), SIGUSR1 dumps them to stderr, or to syslog when running as
+ * a daemon, and --stats-socket streams them as JSON to whoever connects
+ * to a Unix socket.
+ */
+
+#define STATS_INTERVAL		1000	/* ms between samples */
+#define STATS_MAX_CLIENTS	8
+
+static struct serline *lines;
+static int num_lines;
+static int daemonized;
+
+static struct {
+	const char *path;
+	int fd;
+	int clients[STATS_MAX_CLIENTS];
+	int num_clients;
+} stats_socket = { NULL, -1 };
+
+static const char *state_names[] = {
+	"closed", "flush", "init", "ready", "attached", "retry"
+};
+
+static const char *phase_names[PHASES] = {
+	"open", "flush", "init", "ldisc", "type"
+};
+
+/* Picks up the counts of the serial driver for an attached line */
+static void stats_sample(struct serline *l)
+{
+	struct serial_icounter_struct ic;
+
+	if (!l->stats.attached || !l->stats.icount ||
+	    ioctl(l->io.fd, TIOCGICOUNT, &ic) < 0)
+		return;
+
+	if (ic.rx - l->stats.base_rx != l->stats.rx)
+		l->stats.last_rx = stats_now();
+	l->stats.rx = ic.rx - l->stats.base_rx;
+	l->stats.tx = ic.tx - l->stats.base_tx;
+}
+
+static long long stats_total(struct serline *l)
+{
+	long long total = 0;
+	int i;
+
+	for (i = 0; i < PHASES; i++)
+		total += l->stats.phase[i];
+
+	return total;
+}
+
+static void stats_text(FILE *f, struct serline *l)
+{
+	struct line_stats *st = &l->stats;
+	long long now = stats_now();
+	int i;
+
+	fprintf(f, "inputattach: '%s' - %s %s, %lu attempts, %lu failures, %lu hangups\n",
+		l->device, l->type->name, state_names[l->state],
+		st->attempts, st->failures, st->hangups);
+
+	fprintf(f, "inputattach: '%s' - bring-up", l->device);
+	for (i = 0; i < PHASES; i++)
+		fprintf(f, " %s %.1f", phase_names[i], st->phase[i] / 1000.0);
+	fprintf(f, " total %.1f ms, %lu bytes in, %lu out\n",
+		stats_total(l) / 1000.0, st->init_rx, st->init_tx);
+
+	if (!st->attached)
+		return;
+
+	fprintf(f, "inputattach: '%s' - attached for %.1f s", l->device,
+		(now - st->attached) / 1000000.0);
+	if (st->icount)
+		fprintf(f, ", %lu bytes in, %lu out, idle for %.1f s",
+			st->rx, st->tx, (now - st->last_rx) / 1000000.0);
+	fputc('\n', f);
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", *s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+static void stats_json(FILE *f, struct serline *l)
+{
+	struct line_stats *st = &l->stats;
+	long long now = stats_now();
+	int i;
+
+	fputs("{\"device\":", f);
+	json_string(f, l->device);
+	fprintf(f, ",\"mode\":\"%s\",\"state\":\"%s\"",
+		l->type->name, state_names[l->state]);
+	fprintf(f, ",\"attempts\":%lu,\"failures\":%lu,\"hangups\":%lu",
+		st->attempts, st->failures, st->hangups);
+
+	fputs(",\"bringup_us\":{", f);
+	for (i = 0; i < PHASES; i++)
+		fprintf(f, "\"%s\":%lld,", phase_names[i], st->phase[i]);
+	fprintf(f, "\"total\":%lld}", stats_total(l));
+	fprintf(f, ",\"init_rx\":%lu,\"init_tx\":%lu", st->init_rx, st->init_tx);
+
+	if (st->attached)
+		fprintf(f, ",\"attached_ms\":%lld", (now - st->attached) / 1000);
+	else
+		fputs(",\"attached_ms\":null", f);
+
+	if (st->attached && st->icount)
+		fprintf(f, ",\"rx\":%lu,\"tx\":%lu,\"idle_ms\":%lld}",
+			st->rx, st->tx, (now - st->last_rx) / 1000);
+	else
+		fputs(",\"rx\":null,\"tx\":null,\"idle_ms\":null}", f);
+}
+
+static void stats_dump(void)
+{
+	char *buf, *line, *save;
+	size_t size;
+	FILE *f;
+	int i;
+
+	if (!(f = open_memstream(&buf, &size)))
+		return;
+	for (i = 0; i < num_lines; i++) {
+		stats_sample(&lines[i]);
+		stats_text(f, &lines[i]);
+	}
+	fclose(f);
+
+	if (daemonized) {
+		for (line = strtok_r(buf, "\n", &save); line;
+		     line = strtok_r(NULL, "\n", &save))
+			syslog(LOG_INFO, "%s", line + strlen("inputattach: "));
+	} else {
+		fputs(buf, stderr);
+	}
+
+	free(buf);
+}
+
+static int stats_listen(const char *path)
+{
+	struct sockaddr_un addr;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "inputattach: '%s' - path too long\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	unlink(path);
+	stats_socket.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (stats_socket.fd < 0 ||
+	    bind(stats_socket.fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(stats_socket.fd, STATS_MAX_CLIENTS) < 0) {
+		fprintf(stderr, "inputattach: '%s' - %s\n",
+			path, strerror(errno));
+		return -1;
+	}
+	stats_socket.path = path;
+
+	return 0;
+}
+
+static void stats_accept(void)
+{
+	int fd;
+
+	while ((fd = accept(stats_socket.fd, NULL, NULL)) >= 0) {
+		if (stats_socket.num_clients == STATS_MAX_CLIENTS) {
+			close(fd);
+			continue;
+		}
+		stats_socket.clients[stats_socket.num_clients++] = fd;
+	}
+}
+
+/* Samples every line and sends the lot to the socket's clients */
+static void stats_tick(void)
+{
+	char *buf;
+	size_t size;
+	FILE *f;
+	int i;
+
+	for (i = 0; i < num_lines; i++)
+		stats_sample(&lines[i]);
+
+	if (!stats_socket.num_clients || !(f = open_memstream(&buf, &size)))
+		return;
+
+	fprintf(f, "{\"time_ms\":%lld,\"lines\":[", stats_now() / 1000);
+	for (i = 0; i < num_lines; i++) {
+		if (i)
+			fputc(',', f);
+		stats_json(f, &lines[i]);
+	}
+	fputs("]}\n", f);
+	fclose(f);
+
+	/* Clients which can't keep up are dropped */
+	for (i = 0; i < stats_socket.num_clients; i++)
+		if (send(stats_socket.clients[i], buf, size,
+			 MSG_NOSIGNAL | MSG_DONTWAIT) != size) {
+			close(stats_socket.clients[i]);
+			stats_socket.clients[i] =
+				stats_socket.clients[--stats_socket.num_clients];
+			i--;
+		}
+
+	free(buf);
+}
+
+static void stats_close(void)
+{
+	int i;
+
+	for (i = 0; i < stats_socket.num_clients; i++)
+		close(stats_socket.clients[i]);
+	if (stats_socket.fd >= 0)
+		close(stats_socket.fd);
+}
+
+/*
+ * Supervisor mode: brings up every line listed in a configuration file
+ * concurrently from a single epoll loop, then parks each attached line
+ * in a minimal child process (see line_hold()) and re-attaches it when
+ * that child reports a hangup. A single line attached with --stats is
+ * parked the same way, so that the loop can serve the statistics.
+ */
+
+#define SUPERVISE_MIN_BACKOFF	1000
+#define SUPERVISE_MAX_BACKOFF	30000
+
+static int read_config(const char *config)
+{
+	FILE *f;
+	char buf[512], *argv[16], *p;
+	struct serline *l;
+	int argc, i, lineno = 0;
+
+	if (!(f = fopen(config, "r"))) {
+		fprintf(stderr, "inputattach: '%s' - %s\n",
+			config, strerror(errno));
+		return -1;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		lineno++;
+
+		if ((p = strchr(buf, '#')))
+			*p = 0;
+
+		argc = 0;
+		for (p = strtok(buf, " \t\r\n"); p && argc < 16;
+		     p = strtok(NULL, " \t\r\n"))
+			argv[argc++] = p;
+		if (!argc)
+			continue;
+
+		lines = realloc(lines, (num_lines + 1) * sizeof(*lines));
+		if (!lines) {
+			perror("inputattach");
+			fclose(f);
+			return -1;
+		}
+		l = &lines[num_lines];
+		memset(l, 0, sizeof(*l));
+
+		for (i = 0; i < argc; i++)
+			if (parse_line_arg(l, argc, argv, &i))
+				break;
+		if (i < argc || check_line(l)) {
+			fprintf(stderr, "inputattach: %s:%d: invalid line\n",
+				config, lineno);
+			fclose(f);
+			return -1;
+		}
+
+		l->device = strdup(l->device);
+		l->state = LINE_RETRY;
+		l->backoff = SUPERVISE_MIN_BACKOFF;
+		num_lines++;
+	}
+
+	fclose(f);
+
+	if (!num_lines) {
+		fprintf(stderr, "inputattach: '%s' - no lines configured\n",
+			config);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void supervise_retry(int epfd, struct serline *l)
+{
+	if (l->io.fd >= 0) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, l->io.fd, NULL);
+		close(l->io.fd);
+		l->io.fd = -1;
+	}
+
+	l->state = LINE_RETRY;
+	l->stats.attached = 0;
+	ser_timeout(&l->io, l->backoff);
+
+	l->backoff *= 2;
+	if (l->backoff > SUPERVISE_MAX_BACKOFF)
+		l->backoff = SUPERVISE_MAX_BACKOFF;
+}
+
+static void supervise_start(int epfd, struct serline *l)
+{
+	struct epoll_event ev;
+
+	if (line_open(l)) {
+		l->stats.failures++;
+		supervise_retry(epfd, l);
+		return;
+	}
+
+	l->events = EPOLLIN;
+	ev.events = l->events;
+	ev.data.ptr = l;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, l->io.fd, &ev) < 0) {
+		perror("inputattach: epoll");
+		supervise_retry(epfd, l);
+	}
+}
+
+/*
+ * Starts the child holding an attached line. The line stays open here
+ * too, for the statistics.
+ */
+static int supervise_hold(int epfd, int sfd, sigset_t *oldmask,
+			  struct serline *l)
+{
+	int i;
+
+	l->holder = fork();
+	if (l->holder < 0) {
+		perror("inputattach: fork");
+		return -1;
+	}
+
+	if (l->holder == 0) {
+		/* Keep nothing open but our own line */
+		close(epfd);
+		close(sfd);
+		stats_close();
+		for (i = 0; i < num_lines; i++)
+			if (&lines[i] != l && lines[i].io.fd >= 0)
+				close(lines[i].io.fd);
+
+		/*
+		 * Any signal we catch ends the read() holding the port, so
+		 * make sure stray requests for statistics can't.
+		 */
+		signal(SIGUSR1, SIG_IGN);
+		sigprocmask(SIG_SETMASK, oldmask, NULL);
+
+		line_hold(l->io.fd);
+		_exit(EXIT_SUCCESS);
+	}
+
+	l->backoff = SUPERVISE_MIN_BACKOFF;
+
+	return 0;
+}
+
+static void supervise_attach(int epfd, int sfd, sigset_t *oldmask,
+			     struct serline *l)
+{
+	epoll_ctl(epfd, EPOLL_CTL_DEL, l->io.fd, NULL);
+
+	if (line_attach(l)) {
+		l->stats.failures++;
+		supervise_retry(epfd, l);
+		return;
+	}
+
+	if (supervise_hold(epfd, sfd, oldmask, l))
+		supervise_retry(epfd, l);
+}
+
+/* Returns 0 when asked to terminate, or once the line hangs up if once */
+static int supervise_signal(int epfd, int sfd, int once)
+{
+	struct signalfd_siginfo si;
+	pid_t pid;
+	int i;
+
+	while (read(sfd, &si, sizeof(si)) == sizeof(si)) {
+		if (si.ssi_signo == SIGUSR1) {
+			stats_dump();
+			continue;
+		}
+
+		if (si.ssi_signo != SIGCHLD)
+			return 0;
+
+		while ((pid = waitpid(-1, NULL, WNOHANG)) > 0)
+			for (i = 0; i < num_lines; i++)
+				if (lines[i].holder == pid) {
+					lines[i].holder = 0;
+					lines[i].stats.hangups++;
+					if (once)
+						return 0;
+					fprintf(stderr, "inputattach: '%s' - hung up, re-attaching\n",
+						lines[i].device);
+					supervise_retry(epfd, &lines[i]);
+				}
+	}
+
+	return 1;
+}
+
+/*
+ * Runs the loop over lines[]. Lines which are attached already are
+ * handed to their holder right away; with once, the loop ends when one
+ * hangs up instead of bringing it up again.
+ */
+static int supervise(int once)
+{
+	struct epoll_event ev, events[16];
+	sigset_t mask, oldmask;
+	struct serline *l;
+	int epfd, sfd, i, n, ret, ticking;
+	long now, timeout, tick;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGHUP);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGUSR1);
+	sigprocmask(SIG_BLOCK, &mask, &oldmask);
+
+	sfd = signalfd(-1, &mask, SFD_NONBLOCK);
+	epfd = epoll_create1(0);
+	if (sfd < 0 || epfd < 0) {
+		perror("inputattach");
+		return EXIT_FAILURE;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, sfd, &ev);
+
+	if (stats_socket.fd >= 0) {
+		ev.data.ptr = &stats_socket;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, stats_socket.fd, &ev);
+	}
+
+	for (i = 0; i < num_lines; i++)
+		if (lines[i].state == LINE_ATTACHED &&
+		    supervise_hold(epfd, sfd, &oldmask, &lines[i])) {
+			if (once)
+				goto out;
+			supervise_retry(epfd, &lines[i]);
+		}
+
+	/*
+	 * The counts are sampled every second only when they are watched:
+	 * with --stats, or for the clients of --stats-socket. Otherwise
+	 * SIGUSR1 samples them, and nothing wakes the supervisor up but
+	 * its lines.
+	 */
+	ticking = once || stats_socket.fd >= 0;
+	tick = ser_now() + STATS_INTERVAL;
+
+	for (;;) {
+		now = ser_now();
+		timeout = -1;
+		if (ticking) {
+			if (now >= tick) {
+				stats_tick();
+				tick = now + STATS_INTERVAL;
+			}
+			timeout = tick - now;
+		}
+
+		for (i = 0; i < num_lines; i++) {
+			l = &lines[i];
+			now = ser_now();
+
+			if (l->state == LINE_RETRY && now >= l->io.deadline)
+				supervise_start(epfd, l);
+
+			if (l->state == LINE_FLUSH || l->state == LINE_INIT) {
+				ret = line_step(l);
+				if (ret == 0)
+					supervise_attach(epfd, sfd, &oldmask, l);
+				else if (ret < 0)
+					supervise_retry(epfd, l);
+				else if (ser_events(&l->io) != l->events) {
+					l->events = ser_events(&l->io);
+					ev.events = l->events;
+					ev.data.ptr = l;
+					epoll_ctl(epfd, EPOLL_CTL_MOD, l->io.fd, &ev);
+				}
+			}
+
+			if (l->state == LINE_FLUSH || l->state == LINE_INIT ||
+			    l->state == LINE_RETRY) {
+				now = l->io.deadline - ser_now();
+				if (now < 0)
+					now = 0;
+				if (timeout < 0 || now < timeout)
+					timeout = now;
+			}
+		}
+
+		n = epoll_wait(epfd, events, 16, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("inputattach: epoll");
+			break;
+		}
+
+		for (i = 0; i < n; i++) {
+			l = events[i].data.ptr;
+			if (!l) {
+				if (!supervise_signal(epfd, sfd, once))
+					goto out;
+			} else if ((void *)l == &stats_socket) {
+				stats_accept();
+			} else if (((events[i].events & EPOLLOUT) &&
+				    ser_flush(&l->io) < 0) ||
+				   ser_fill(&l->io)) {
+				fprintf(stderr, "inputattach: '%s' - hung up during initialization\n",
+					l->device);
+				supervise_retry(epfd, l);
+			}
+		}
+	}
+
+out:
+	for (i = 0; i < num_lines; i++)
+		if (lines[i].holder > 0)
+			kill(lines[i].holder, SIGTERM);
+
+	stats_close();
+	if (stats_socket.path)
+		unlink(stats_socket.path);
+
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+	struct serline line;
+	struct serlog log;
+	const char *config = NULL;
+	const char *record = NULL;
+	const char *replay = NULL;
+	const char *stats_path = NULL;
+	double replay_speed = 1.0;
+	pid_t replay_pid = 0;
+	int daemon_mode = 0;
+	int autodetect_mode = 0;
+	int noattach = 0;
+	int stats = 0;
+	int i, ret;
+	int retval;
+	long start;
+
+	memset(&line, 0, sizeof(line));
+
+	for (i = 1; i < argc; i++) {
+		if (!strcasecmp(argv[i], "--help")) {
+			show_help();
+			return EXIT_SUCCESS;
+		} else if (!strcasecmp(argv[i], "--daemon")) {
+			daemon_mode = 1;
+		} else if (!strcasecmp(argv[i], "--noattach")) {
+			noattach = 1;
+		} else if (!strcasecmp(argv[i], "--stats")) {
+			stats = 1;
+		} else if (!strcasecmp(argv[i], "--stats-socket") &&
+			   !(line.type && !line.device)) {
+			if (argc <= i + 1) {
+				show_help();
+				fprintf(stderr,
+					"inputattach: require socket path\n");
+				return EXIT_FAILURE;
+			}
+
+			stats_path = argv[++i];
+			stats = 1;
+		} else if (!strcasecmp(argv[i], "--supervise") &&
+			   !(line.type && !line.device)) {
+			if (argc <= i + 1) {
+				show_help();
+				fprintf(stderr,
+					"inputattach: require configuration file\n");
+				return EXIT_FAILURE;
+			}
+
+			config = argv[++i];
+		} else if (!strcasecmp(argv[i], "--autodetect") &&
+			   !(line.type && !line.device)) {
+			if (argc <= i + 1) {
+				show_help();
+				fprintf(stderr,
+					"inputattach: require device\n");
+				return EXIT_FAILURE;
+			}
+
+			line.device = argv[++i];
+			autodetect_mode = 1;
+		} else if ((!strcasecmp(argv[i], "--record") ||
+			    !strcasecmp(argv[i], "--replay")) &&
+			   !(line.type && !line.device)) {
+			if (argc <= i + 1) {
+				show_help();
+				fprintf(stderr,
+					"inputattach: require log file\n");
+				return EXIT_FAILURE;
+			}
+
+			if (!strcasecmp(argv[i], "--record"))
+				record = argv[++i];
+			else
+				replay = argv[++i];
+		} else if (!strcasecmp(argv[i], "--replay-speed") &&
+			   !(line.type && !line.device)) {
+			if (argc <= i + 1) {
+				show_help();
+				fprintf(stderr,
+					"inputattach: require replay speed\n");
+				return EXIT_FAILURE;
+			}
+
+			replay_speed = atof(argv[++i]);
+		} else if (parse_line_arg(&line, argc, argv, &i)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (config) {
+		if (line.type) {
+			fprintf(stderr, "inputattach: --supervise takes its modes from the configuration file\n");
+			return EXIT_FAILURE;
+		}
+
+		if (read_config(config))
+			return EXIT_FAILURE;
+
+		if (stats_path && stats_listen(stats_path))
+			return EXIT_FAILURE;
+
+		if (daemon_mode && daemon(0, 0) < 0) {
+			perror("inputattach");
+			return EXIT_FAILURE;
+		}
+		if (daemon_mode) {
+			openlog("inputattach", LOG_PID, LOG_DAEMON);
+			daemonized = 1;
+		}
+
+		return supervise(0);
+	}
+
+	if (stats && (record || noattach)) {
+		fprintf(stderr, "inputattach: --stats needs a line to attach\n");
+		return EXIT_FAILURE;
+	}
+
+	if (replay) {
+		if (line.type || line.device) {
+			fprintf(stderr, "inputattach: --replay takes its mode and device from the log\n");
+			return EXIT_FAILURE;
+		}
+
+		replay_pid = replay_start(&line, replay, replay_speed);
+		if (replay_pid < 0)
+			return EXIT_FAILURE;
+	}
+
+	if (autodetect_mode) {
+		if (line.type) {
+			fprintf(stderr, "inputattach: --autodetect does not take a mode\n");
+			return EXIT_FAILURE;
+		}
+
+		if (autodetect(&line))
+			return EXIT_FAILURE;
+	}
+
+	retval = EXIT_FAILURE;
+
+	if (check_line(&line))
+		goto out;
+
+	if (stats_path && stats_listen(stats_path))
+		goto out;
+
+	if (record) {
+		if (serlog_create(&log, record, line.type->name,
+				  line.baud ? line.baud : speed_baud(line.speed))) {
+			fprintf(stderr, "inputattach: '%s' - %s\n",
+				record, strerror(errno));
+			record = NULL;
+			goto out;
+		}
+		line.io.log = &log;
+		catch_interrupts();
+	}
+
+	start = ser_now();
+
+	if (line_open(&line))
+		goto out;
+
+	while ((ret = line_step(&line)) == INIT_PENDING) {
+		if (interrupted)
+			goto out;
+		if (ser_wait(&line.io)) {
+			fprintf(stderr, "inputattach: '%s' - hung up during initialization\n",
+				line.device);
+			goto out;
+		}
+	}
+
+	if (!ret && (record || replay))
+		fprintf(stderr, "inputattach: '%s' - initialized in %ld ms\n",
+			line.device, ser_now() - start);
+
+	if (record) {
+		/* Keep recording instead of attaching */
+		if (!ret) {
+			line_record(&line);
+			retval = EXIT_SUCCESS;
+		}
+		goto out;
+	}
+
+	if (noattach) {
+		if (!ret)
+			retval = EXIT_SUCCESS;
+		goto out;
+	}
+
+	if (ret || line_attach(&line))
+		goto out;
+
+	retval = EXIT_SUCCESS;
+	if (daemon_mode && daemon(0, 0) < 0) {
+		perror("inputattach");
+		retval = EXIT_FAILURE;
+	} else if (daemon_mode) {
+		openlog("inputattach", LOG_PID, LOG_DAEMON);
+		daemonized = 1;
+	}
+
+	if (stats) {
+		/* Hold the line from a child, so we can answer SIGUSR1 */
+		lines = &line;
+		num_lines = 1;
+		supervise(1);
+		goto out;
+	}
+
+	line_hold(line.io.fd);
+
+out:
+	if (record && serlog_close(&log)) {
+		fprintf(stderr, "inputattach: '%s' - can't write log\n",
+			record);
+		retval = EXIT_FAILURE;
+	}
+
+	if (replay_pid > 0 && replay_finish(&line, replay_pid))
+		retval = EXIT_FAILURE;
 
 	return retval;
 }
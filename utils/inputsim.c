@@ -0,0 +1,481 @@
+/*
+ * inputsim.c
+ *
+ * Serial input device simulator for inputattach
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301 USA.
+ */
+
+/*
+ * Each run creates a pseudo-terminal, starts "inputattach --noattach"
+ * on its slave side and plays the device on its master side: a greeting
+ * once the line is opened, replies to the commands the device knows,
+ * and a stream of packets for the devices which send data on their own.
+ * Replies can be delayed, jittered and corrupted. The time inputattach
+ * takes to get the device ready and how often it fails are reported for
+ * each protocol.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <linux/serio.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serio-ids.h"
+
+#define SIM_POWERUP	150	/* ms from the line opening to a greeting */
+#define SIM_STREAM	10	/* ms between streamed packets */
+#define SIM_QUEUE	32	/* chunks queued at first */
+#define SIM_RETRY	1	/* ms before writing again to a full pty */
+
+/* A byte string with embedded NULs */
+#define S(x)	x, sizeof(x) - 1
+
+struct exchange {
+	const char *cmd;
+	int cmd_len;
+	const char *reply;
+	int reply_len;
+};
+
+struct protocol {
+	const char *mode;
+	const char *greeting;
+	int greeting_len;
+	const char *packet;		/* streamed every SIM_STREAM ms */
+	int packet_len;
+	struct exchange exchanges[4];
+};
+
+static const struct protocol protocols[] = {
+	{ "--sunkbd" },
+	{ "--lkkbd" },
+	{ "--vsxxx-aa" },
+	{ "--spaceorb" },
+	{ "--spaceball",
+	  S("\x11\r@1 Spaceball alive and well after a poweron reset.\r"
+	    "@2 Firmware version 2.42 created on 24-Oct-1991.\r"),
+	  NULL, 0,
+	  { { S("hm\r"), S("Hm2003C\r") },
+	    { S("P@A@A\r"), S("P@A@A\r") },
+	    { S("FT@\r"), S("FT@\r") },
+	    { S("MSS\r"), S("MSS\r") } } },
+	{ "--magellan" },
+	{ "--warrior", NULL, 0, NULL, 0,
+	  { { S("*S"), S("*S") } } },
+	{ "--stinger", NULL, 0, NULL, 0,
+	  { { S(" E5E5"), S("\r\n0600520058C272") } } },
+	{ "--mousesystems" },
+	{ "--sunmouse" },
+	{ "--microsoft" },
+	{ "--mshack" },
+	{ "--mouseman" },
+	{ "--mouseman4" },
+	{ "--intellimouse" },
+	{ "--mmwheel", NULL, 0, NULL, 0,
+	  { { S("*X*q"), S("*X*q") } } },
+	{ "--iforce" },
+	{ "--newtonkbd",
+	  S("\x16\x10\x02\x64\x5f\x69\x64\x00\x00\x00\x0c\x6b\x79\x62\x64\x61"
+	    "\x70\x70\x6c\x00\x00\x00\x01\x6e\x6f\x66\x6d\x00\x00\x00\x00\x10"
+	    "\x03\xdd\xe7") },
+	{ "--h3600ts" },
+	{ "--stowawaykbd" },
+	{ "--ps2serkbd" },
+	{ "--twiddler", NULL, 0, S("\x00\x80\x80\x80\x80") },
+	{ "--twiddler-joy", NULL, 0, S("\x00\x80\x80\x80\x80") },
+	{ "--elotouch" },
+	{ "--elo4002" },
+	{ "--elo271-140" },
+	{ "--elo261-280" },
+	{ "--mtouch" },
+#ifdef SERIO_TSC40
+	{ "--tsc", NULL, 0, NULL, 0,
+	  { { S("\x15"), S("\x80\x00") },
+	    { S("\x05\x45"), S("\x06") } } },
+#endif
+	{ "--touchit213", NULL, 0, NULL, 0,
+	  { { S("\x0a\x01" "A"), S("\x0a\x01" "A") } } },
+	{ "--touchright" },
+	{ "--touchwin" },
+	{ "--penmount9000" },
+	{ "--penmount6000", NULL, 0, NULL, 0,
+	  { { S("\xf1\x00\x00\x00\x00\x0e"), S("\xf1\x00\x00\x00\x00\x0e") } } },
+	{ "--penmount3000" },
+	{ "--penmount6250" },
+	{ "--fujitsu", NULL, 0, NULL, 0,
+	  { { S("\x81"), S("\x90\x00") } } },
+	{ "--ps2mult" },
+	{ "--zhen-hua", NULL, 0, S("\xef\x80\x80\x80\x80") },
+	{ "--easypen" },
+#ifdef SERIO_TAOSEVM
+	{ "--taos-evm" },
+#endif
+	{ "--w8001" },
+	{ "--wacom_iv" },
+	{ NULL }
+};
+
+/* Options */
+static const char *inputattach = "inputattach";
+static int runs = 10;
+static int delay;		/* ms */
+static int jitter;		/* ms */
+static double corrupt;		/* % of bytes */
+static int timeout = 10000;	/* ms */
+static int verbose;
+
+/* Output waiting for its time to be sent */
+struct chunk {
+	long long due;		/* us */
+	int len;
+	int sent;		/* of len, by a short write */
+	unsigned char data[64];
+};
+
+struct sim {
+	int master;
+	struct chunk *queue;
+	int queued, size;
+	unsigned char history[16];	/* last bytes from the host */
+	int history_len;
+};
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+/*
+ * Queues bytes to be sent after ms, plus jitter, but never out of order.
+ * The queue grows as needed: dropping bytes would make the device look
+ * broken to inputattach.
+ */
+static void sim_send(struct sim *s, const char *buf, int len, int ms)
+{
+	struct chunk *c;
+	long long due;
+	int n, i;
+
+	due = now_us() + ms * 1000LL;
+	if (jitter)
+		due += random() % (jitter * 1000LL);
+
+	for (; len > 0; buf += n, len -= n) {
+		if (s->queued && due < s->queue[s->queued - 1].due)
+			due = s->queue[s->queued - 1].due;
+
+		if (s->queued == s->size) {
+			s->size = s->size ? 2 * s->size : SIM_QUEUE;
+			s->queue = realloc(s->queue, s->size * sizeof(*s->queue));
+			if (!s->queue) {
+				perror("inputsim: queue");
+				exit(1);
+			}
+		}
+
+		c = &s->queue[s->queued++];
+		n = len < sizeof(c->data) ? len : sizeof(c->data);
+		c->due = due;
+		c->len = n;
+		c->sent = 0;
+		memcpy(c->data, buf, n);
+
+		for (i = 0; i < n; i++)
+			if (random() < corrupt / 100 * RAND_MAX)
+				c->data[i] ^= 1 << (random() % 8);
+	}
+}
+
+/*
+ * Sends whatever is due, keeping what the pty doesn't take for later;
+ * returns the time until the next chunk in ms.
+ */
+static int sim_flush(struct sim *s)
+{
+	struct chunk *c = s->queue;
+	long long now = now_us();
+	ssize_t n;
+
+	while (s->queued && c->due <= now) {
+		n = write(s->master, c->data + c->sent, c->len - c->sent);
+		if (n < 0)
+			return errno == EAGAIN ? SIM_RETRY : -1;
+		c->sent += n;
+		if (c->sent < c->len)
+			return SIM_RETRY;
+		memmove(s->queue, s->queue + 1,
+			--s->queued * sizeof(*s->queue));
+	}
+
+	return s->queued ? (c->due - now + 999) / 1000 : -1;
+}
+
+/* Looks for a known command at the end of what the host has sent */
+static void sim_input(struct sim *s, const struct protocol *p, unsigned char b)
+{
+	const struct exchange *e;
+	int i;
+
+	if (s->history_len == sizeof(s->history)) {
+		memmove(s->history, s->history + 1, --s->history_len);
+	}
+	s->history[s->history_len++] = b;
+
+	for (i = 0; i < 4; i++) {
+		e = &p->exchanges[i];
+		if (!e->cmd || e->cmd_len > s->history_len)
+			continue;
+		if (!memcmp(s->history + s->history_len - e->cmd_len,
+			    e->cmd, e->cmd_len)) {
+			sim_send(s, e->reply, e->reply_len, delay);
+			s->history_len = 0;
+			return;
+		}
+	}
+}
+
+static pid_t start_inputattach(const char *mode, const char *device)
+{
+	pid_t pid;
+	int null;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	if (!verbose && (null = open("/dev/null", O_WRONLY)) >= 0) {
+		dup2(null, STDOUT_FILENO);
+		dup2(null, STDERR_FILENO);
+	}
+
+	execlp(inputattach, "inputattach", "--noattach", mode, device, NULL);
+	_exit(127);
+}
+
+/*
+ * Plays the device for one run of inputattach. Returns 0 if the device
+ * was brought up, with the time it took in *elapsed (us).
+ */
+static int sim_run(const struct protocol *p, long long *elapsed)
+{
+	struct sim s;
+	struct pollfd pfd;
+	unsigned char buf[256];
+	long long start, next_packet = 0;
+	int opened = 0, status = -1, wait, n, i;
+	pid_t pid;
+
+	memset(&s, 0, sizeof(s));
+
+	s.master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if (s.master < 0 || grantpt(s.master) || unlockpt(s.master)) {
+		perror("inputsim: pty");
+		exit(1);
+	}
+
+	start = now_us();
+	pid = start_inputattach(p->mode, ptsname(s.master));
+	if (pid < 0) {
+		perror("inputsim: fork");
+		exit(1);
+	}
+
+	for (;;) {
+		if (waitpid(pid, &status, WNOHANG) == pid)
+			break;
+
+		if (now_us() - start > timeout * 1000LL) {
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			status = -1;
+			break;
+		}
+
+		pfd.fd = s.master;
+		pfd.events = POLLIN;
+
+		/* The master hangs up until the slave is opened */
+		if (!opened) {
+			poll(&pfd, 1, 0);
+			if (pfd.revents & POLLHUP) {
+				usleep(1000);
+				continue;
+			}
+			opened = 1;
+			if (p->greeting)
+				sim_send(&s, p->greeting, p->greeting_len,
+					 SIM_POWERUP + delay);
+			next_packet = now_us();
+		}
+
+		if (p->packet && now_us() >= next_packet) {
+			sim_send(&s, p->packet, p->packet_len, 0);
+			next_packet += SIM_STREAM * 1000;
+		}
+
+		wait = sim_flush(&s);
+		if (wait < 0 || wait > SIM_STREAM)
+			wait = SIM_STREAM;
+
+		if (poll(&pfd, 1, wait) > 0 && (pfd.revents & POLLIN)) {
+			n = read(s.master, buf, sizeof(buf));
+			for (i = 0; i < n; i++)
+				sim_input(&s, p, buf[i]);
+		}
+	}
+
+	*elapsed = now_us() - start;
+	close(s.master);
+	free(s.queue);
+
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static void bench(const struct protocol *p)
+{
+	long long elapsed, min = 0, max = 0, total = 0;
+	int i, ok = 0;
+
+	for (i = 0; i < runs; i++) {
+		if (sim_run(p, &elapsed))
+			continue;
+		if (!ok || elapsed < min)
+			min = elapsed;
+		if (elapsed > max)
+			max = elapsed;
+		total += elapsed;
+		ok++;
+	}
+
+	printf("%-16s %5d %6.1f%%", p->mode, runs,
+		100.0 * (runs - ok) / runs);
+	if (ok)
+		printf(" %8.1f %8.1f %8.1f\n", min / 1000.0,
+			total / 1000.0 / ok, max / 1000.0);
+	else
+		printf(" %8s %8s %8s\n", "-", "-", "-");
+	fflush(stdout);
+}
+
+static void help(void)
+{
+	const struct protocol *p;
+
+	puts("");
+	puts("Usage: inputsim [<options>] [<mode> ...]");
+	puts("");
+	puts("Simulates serial input devices on pseudo-terminals and measures how");
+	puts("long inputattach takes to bring them up, and how often it fails.");
+	puts("");
+	puts("Options:");
+	puts("  -n, --runs <n>          runs per mode (10)");
+	puts("  -d, --delay <ms>        delay of the device replies (0)");
+	puts("  -j, --jitter <ms>       random extra delay of everything sent (0)");
+	puts("  -c, --corrupt <pct>     percentage of bytes sent with a bit flipped (0)");
+	puts("  -t, --timeout <ms>      time after which a run fails (10000)");
+	puts("  -s, --seed <n>          random seed");
+	puts("  -i, --inputattach <path> inputattach to run (from the PATH)");
+	puts("  -v, --verbose           show the output of inputattach");
+	puts("  -h, --help              this help");
+	puts("");
+	puts("Modes, as given to inputattach without the dashes (all by default):");
+	for (p = protocols; p->mode; p++)
+		printf("  %s\n", p->mode + 2);
+	puts("");
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{ "runs",	 required_argument, NULL, 'n' },
+		{ "delay",	 required_argument, NULL, 'd' },
+		{ "jitter",	 required_argument, NULL, 'j' },
+		{ "corrupt",	 required_argument, NULL, 'c' },
+		{ "timeout",	 required_argument, NULL, 't' },
+		{ "seed",	 required_argument, NULL, 's' },
+		{ "inputattach", required_argument, NULL, 'i' },
+		{ "verbose",	 no_argument,	    NULL, 'v' },
+		{ "help",	 no_argument,	    NULL, 'h' },
+		{ NULL, 0, NULL, 0 }
+	};
+	const struct protocol *p;
+	int i, t;
+
+	srandom(time(NULL));
+
+	while ((t = getopt_long(argc, argv, "n:d:j:c:t:s:i:vh",
+				long_options, NULL)) != -1) {
+		switch (t) {
+		case 'n': runs = atoi(optarg); break;
+		case 'd': delay = atoi(optarg); break;
+		case 'j': jitter = atoi(optarg); break;
+		case 'c': corrupt = atof(optarg); break;
+		case 't': timeout = atoi(optarg); break;
+		case 's': srandom(atoi(optarg)); break;
+		case 'i': inputattach = optarg; break;
+		case 'v': verbose = 1; break;
+		case 'h':
+			help();
+			return 0;
+		default:
+			help();
+			return 1;
+		}
+	}
+
+	if (runs < 1) {
+		fprintf(stderr, "inputsim: invalid number of runs\n");
+		return 1;
+	}
+
+	printf("%-16s %5s %7s %8s %8s %8s  (ms)\n",
+		"Mode", "Runs", "Failed", "Min", "Avg", "Max");
+
+	if (optind == argc) {
+		for (p = protocols; p->mode; p++)
+			bench(p);
+		return 0;
+	}
+
+	for (i = optind; i < argc; i++) {
+		for (p = protocols; p->mode; p++)
+			if (!strcmp(argv[i], p->mode + 2))
+				break;
+		if (!p->mode) {
+			fprintf(stderr, "inputsim: unknown mode '%s'\n",
+				argv[i]);
+			return 1;
+		}
+		bench(p);
+	}
+
+	return 0;
+}
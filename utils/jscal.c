@@ -27,8 +27,12 @@
  * 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <time.h>
+#include <poll.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdio.h>
@@ -37,15 +41,30 @@
 #include <string.h>
 #include <fcntl.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <glob.h>
+#include <limits.h>
 
 #include <asm/param.h>
 #include <linux/joystick.h>
 
+#include "axbtnmap.h"
+#include "caldb.h"
+#include "codenames.h"
+
 #define PIT_HZ 1193180L
 
 #define NUM_POS 3
 #define MAX_CORR 1
 
+#define SAMPLE_PERIOD 10	/* ms between samples when calibrating by --auto */
+#define REST_MIN 50		/* samples before the noise is trusted */
+#define REST_MAX 500		/* samples before settling for a noisy stick */
+#define SWEEP_VISITS 2		/* visits needed to each end of an axis */
+#define SWEEP_SETTLE 500	/* ms the ends must stay put */
+
+#define EVENT_BATCH 64		/* events read at once */
+
 const char *pos_name[] = {"minimum", "center", "maximum"};
 const char *corr_name[] = {"none (raw)", "broken line"};
 const char corr_coef_num[] = {0,4};
@@ -55,19 +74,52 @@ struct correction_data {
 	int cmax[NUM_POS];
 };
 
-int fd;
-struct js_corr corr[ABS_MAX + 1];
-__u8 axmap[ABS_MAX + 1];
-__u8 axmap2[ABS_MAX + 1];
-__u16 buttonmap[(KEY_MAX - BTN_MISC + 1)];
-char axes, buttons, fuzz;
-int version;
-struct correction_data corda[ABS_MAX + 1];
-
 struct js_info {
 	int buttons;
 	int axis[ABS_MAX + 1];
-	} js;
+	int amin[ABS_MAX + 1];		/* reached since reset_range() */
+	int amax[ABS_MAX + 1];
+	};
+
+/* What --auto knows of an axis */
+struct auto_axis {
+	double mean, m2;		/* of the values at rest, Welford's way */
+	int rmin, rmax;			/* at rest */
+	int cmin, cmax;			/* center dead band */
+	int prec;
+	int lo, hi;			/* ends reached */
+	int lo_visits, hi_visits;
+	int side;			/* end last visited, or 0 */
+};
+
+enum { AUTO_REST, AUTO_SWEEP, AUTO_DONE, AUTO_STOPPED, AUTO_GONE };
+
+/*
+ * A joystick being worked on. Everything about it is kept here, so that
+ * several can be calibrated at once.
+ */
+struct jsdev {
+	int fd;
+	const char *name;
+	char label[32];			/* before its messages, when several */
+	int gone;
+	int version;
+	char axes, buttons;
+	struct js_corr corr[ABS_MAX + 1];
+	__u8 axmap[ABS_MAX + 1];
+	__u8 axmap2[ABS_MAX + 1];
+	__u16 buttonmap[BTNMAP_SIZE];
+	struct correction_data corda[ABS_MAX + 1];
+	struct js_info js;
+
+	/* --auto */
+	struct auto_axis autocal[ABS_MAX + 1];
+	int phase;
+	int samples;			/* at rest so far */
+	int b;				/* buttons when the sweep began */
+	long long grown;		/* when an end last moved */
+	long long start, end;
+};
 
 void print_position(int i, int a)
 {
@@ -76,42 +128,83 @@ void print_position(int i, int a)
 
 }
 
-int get_time(void)
+/* In ms, from a clock which the time of day being set doesn't move */
+long long get_time(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+void reset_range(struct js_info *s)
+{
+	int i;
+
+	for (i = 0; i < ABS_MAX + 1; i++)
+		s->amin[i] = s->amax[i] = s->axis[i];
+}
+
+/*
+ * Reads all the events waiting, a batch at a time, into the state. Every
+ * value an axis goes through widens its range, so that none is missed
+ * when several come in between two looks at the state. Joysticks are
+ * open in nonblocking mode. Returns -1 once the joystick is gone.
+ */
+int read_events(int d, struct js_info *s)
 {
-	struct timeval tv;
+	struct js_event ev[EVENT_BATCH];
+	int i, n;
 
-	gettimeofday(&tv, NULL);
+	do {
+		n = read(d, ev, sizeof(ev));
+		if (n < 0)
+			return errno == EAGAIN ? 0 : -1;
+		if (n == 0)
+			return -1;
+		n /= sizeof(struct js_event);
+
+		for (i = 0; i < n; i++) {
+			switch (ev[i].type & ~JS_EVENT_INIT) {
+			case JS_EVENT_AXIS:
+				if (ev[i].number > ABS_MAX)
+					break;
+				s->axis[ev[i].number] = ev[i].value;
+				if (ev[i].value < s->amin[ev[i].number])
+					s->amin[ev[i].number] = ev[i].value;
+				if (ev[i].value > s->amax[ev[i].number])
+					s->amax[ev[i].number] = ev[i].value;
+				break;
+			case JS_EVENT_BUTTON:
+				if (ev[i].number < 31)
+					s->buttons = (s->buttons & ~(1 << ev[i].number)) |
+						(!!ev[i].value << ev[i].number);
+			}
+		}
+	} while (n == EVENT_BATCH);
 
-	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	return 0;
 }
 
 void wait_for_event(int d, struct js_info *s)
 {
-	struct js_event ev;
-	struct timeval tv;
+	struct pollfd pfd[2];
 	char buf;
-	fd_set set;
-
-	tv.tv_sec = 0;
-	tv.tv_usec = 100000;
 
-	FD_ZERO(&set);
-	FD_SET(0, &set);
-	FD_SET(d, &set);
+	pfd[0].fd = d;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = 0;
+	pfd[1].events = POLLIN;
 
-	if (select(d+1, &set, NULL, NULL, &tv)) {
+	if (poll(pfd, 2, 100) > 0) {
 
-		if (FD_ISSET(d, &set)) {
-			if (read(d, &ev, sizeof(struct js_event)) == sizeof(struct js_event))
-			switch (ev.type & ~JS_EVENT_INIT) {
-				case JS_EVENT_AXIS:
-					s->axis[ev.number] = ev.value; break;
-				case JS_EVENT_BUTTON:
-					s->buttons = (s->buttons & ~(1 << ev.number)) | (ev.value << ev.number);
-			}
+		if (pfd[0].revents && read_events(d, s)) {
+			perror("jscal: error reading");
+			exit(1);
 		}
 
-		if (FD_ISSET(0, &set)) {
+		if (pfd[1].revents) {
 			read(0, &buf, 1);
 			s->buttons |= (1 << 31);
 		}
@@ -121,6 +214,48 @@ void wait_for_event(int d, struct js_info *s)
 	}
 }
 
+/*
+ * Keeps the state of the joysticks up to date until the given time,
+ * reading all the events that come in meanwhile from all of them. Enter
+ * on stdin sets bit 31 of their buttons until the next call; stdin is
+ * given up on once at its end, and joysticks once they fail.
+ */
+void sample_until(struct jsdev *devs, int n, long long until)
+{
+	static int no_stdin;
+	struct pollfd pfd[n + 1];
+	int left, i;
+	char buf;
+
+	for (i = 0; i < n; i++)
+		devs[i].js.buttons &= ~(1 << 31);
+
+	while ((left = until - get_time()) > 0) {
+		for (i = 0; i < n; i++) {
+			pfd[i].fd = devs[i].gone ? -1 : devs[i].fd;
+			pfd[i].events = POLLIN;
+		}
+		pfd[n].fd = no_stdin ? -1 : 0;
+		pfd[n].events = POLLIN;
+
+		if (poll(pfd, n + 1, left) <= 0)
+			continue;
+
+		for (i = 0; i < n; i++)
+			if (pfd[i].revents && read_events(devs[i].fd, &devs[i].js))
+				devs[i].gone = 1;
+
+		if (pfd[n].revents) {
+			if (read(0, &buf, 1) == 1) {
+				for (i = 0; i < n; i++)
+					devs[i].js.buttons |= (1 << 31);
+			} else {
+				no_stdin = 1;
+			}
+		}
+	}
+}
+
 void putcs(char *s)
 {
 	int i;
@@ -152,7 +287,13 @@ void help(void)
 {
 	putchar('\n');
 	puts("Usage: jscal <device>");
+	puts("       jscal --auto <device>...");
+	puts("       jscal --auto --all");
+	puts("       jscal --apply-profile <file> [<device>...]");
 	putchar('\n');
+	puts("  -a             --auto              Calibrate the joystick from the way");
+	puts("                                       it moves, without questions");
+	puts("  -A             --all               Work on all the joysticks, with --auto");
 	puts("  -c             --calibrate         Calibrate the joystick");
 	puts("  -h             --help              Display this help");
 	puts("  -s <x,y,z...>  --set-correction    Sets correction to specified values");
@@ -167,36 +308,47 @@ void help(void)
 	puts("  -u <n_of_axes,axmap1,axmap2,...,");
   puts("      n_of_buttons,btnmap1,btnmap2,");
   puts("      ...>       --set-mappings      Sets axis and button mappings to the");
-  puts("                                        specified values");
+  puts("                                        specified values, codes or names");
+  puts("                                        (ABS_X, BTN_TRIGGER...)");
+	puts("                 --store-to-db       Stores the mappings and correction in");
+	puts("                                       the calibration database");
+	puts("                 --restore-from-db   Sets the mappings and correction stored");
+	puts("                                       in the calibration database");
+	puts("                 --database <file>   Uses another calibration database than");
+	puts("                                       " CALDB_PATH);
+	puts("                 --apply-profile <file>");
+	puts("                                     Sets the mappings and correction of the");
+	puts("                                       joysticks the profile names, or of");
+	puts("                                       those given");
 	putchar('\n');
 }
 
-void print_info()
+void print_info(struct jsdev *dev)
 {
 	int i,j;
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
+	if (ioctl(dev->fd, JSIOCGAXES, &dev->axes) < 0) {
 		perror("jscal: error getting axes");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGBUTTONS, &buttons) < 0) {
+	if (ioctl(dev->fd, JSIOCGBUTTONS, &dev->buttons) < 0) {
 		perror("jscal: error getting buttons");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGCORR, &corr) < 0) {
+	if (ioctl(dev->fd, JSIOCGCORR, &dev->corr) < 0) {
 		perror("jscal: error getting correction");
 		exit(1);
 	}
 
-	printf("Joystick has %d axes and %d buttons.\n", axes, buttons);
-	for (i = 0; i < axes; i++) {
+	printf("Joystick has %d axes and %d buttons.\n", dev->axes, dev->buttons);
+	for (i = 0; i < dev->axes; i++) {
 		printf("Correction for axis %d is %s, precision is %d.\n",
-			i, corr_name[(int)corr[i].type], corr[i].prec);
-		if (corr_coef_num[(int)corr[i].type]) {
+			i, corr_name[(int)dev->corr[i].type], dev->corr[i].prec);
+		if (corr_coef_num[(int)dev->corr[i].type]) {
 			printf("Coeficients are:");
-			for(j = 0; j < corr_coef_num[(int)corr[i].type]; j++) {
-				printf(" %d", corr[i].coef[j]);
-				if (j < corr_coef_num[(int)corr[i].type] - 1) putchar(',');
+			for(j = 0; j < corr_coef_num[(int)dev->corr[i].type]; j++) {
+				printf(" %d", dev->corr[i].coef[j]);
+				if (j < corr_coef_num[(int)dev->corr[i].type] - 1) putchar(',');
 			}
 		putchar('\n');
 		}
@@ -204,17 +356,20 @@ void print_info()
 	putchar('\n');
 }
 
-void calibrate()
+void set_calibration(struct jsdev *dev);
+
+void calibrate(struct jsdev *dev)
 {
-	int i, j, t, b;
+	int i, j, b;
 	int axis, pos;
+	long long t;
 
 	for (i=0; i<ABS_MAX + 1; i++) {
-		corr[i].type = JS_CORR_NONE;
-		corr[i].prec = 0;
+		dev->corr[i].type = JS_CORR_NONE;
+		dev->corr[i].prec = 0;
 	}
 
-	if (ioctl(fd, JSIOCSCORR, &corr) < 0) {
+	if (ioctl(dev->fd, JSIOCSCORR, &dev->corr) < 0) {
 		perror("jscal: error setting correction");
 		exit(1);
 	}
@@ -226,24 +381,25 @@ void calibrate()
 
 		puts("Calibrating precision: wait and don't touch the joystick.");
 
-		wait_for_event(fd, &js);
+		wait_for_event(dev->fd, &dev->js);
 		t = get_time();
-		while (get_time() < t+50) wait_for_event(fd, &js);
+		while (get_time() < t+50) wait_for_event(dev->fd, &dev->js);
 
-		wait_for_event(fd, &js);
+		wait_for_event(dev->fd, &dev->js);
 		t = get_time();
-		for(i=0; i < axes; i++)
-			amin[i] = amax[i] = js.axis[i];
+		reset_range(&dev->js);
+		for(i=0; i < dev->axes; i++)
+			amin[i] = amax[i] = dev->js.axis[i];
 
 		do {
-			wait_for_event(fd, &js);
-			for(i=0; i < axes; i++) {
-				if (amin[i] > js.axis[i]) {
-					amin[i] = js.axis[i];
+			wait_for_event(dev->fd, &dev->js);
+			for(i=0; i < dev->axes; i++) {
+				if (amin[i] > dev->js.amin[i]) {
+					amin[i] = dev->js.amin[i];
 					t = get_time();
 				}
-				if (amax[i] < js.axis[i]) {
-					amax[i] = js.axis[i];
+				if (amax[i] < dev->js.amax[i]) {
+					amax[i] = dev->js.amax[i];
 					t = get_time();
 				}
 				printf("Axis %d:%5d,%5d ", i, amin[i], amax[i]);
@@ -254,9 +410,9 @@ void calibrate()
 
 		printf("Done. Precision is:                                             \n");
 
-		for (i=0; i < axes; i++) {
-			corr[i].prec = amax[i] - amin[i];
-			printf("Axis: %d: %5d\n", i, corr[i].prec);
+		for (i=0; i < dev->axes; i++) {
+			dev->corr[i].prec = amax[i] - amin[i];
+			printf("Axis: %d: %5d\n", i, dev->corr[i].prec);
 		}
 
 		puts("");
@@ -264,55 +420,63 @@ void calibrate()
 	}
 
 
-	b = js.buttons;
+	b = dev->js.buttons;
 
-	for (axis = 0; axis < axes; axis++)
+	for (axis = 0; axis < dev->axes; axis++)
 		for (pos = 0; pos < NUM_POS; pos++) {
-			while(b ^ js.buttons) wait_for_event(fd, &js);
+			while(b ^ dev->js.buttons) wait_for_event(dev->fd, &dev->js);
 			printf("Move axis %d to %s position and push any button.\n", axis, pos_name[pos]);
 
-			while (!(b ^ js.buttons)) {
-				print_position(axis, js.axis[axis]);
-				wait_for_event(fd, &js);
+			while (!(b ^ dev->js.buttons)) {
+				print_position(axis, dev->js.axis[axis]);
+				wait_for_event(dev->fd, &dev->js);
 			}
 
 			putcs("Hold ... ");
 
-			corda[axis].cmin[pos] = js.axis[axis];
-			corda[axis].cmax[pos] = js.axis[axis];
+			dev->corda[axis].cmin[pos] = dev->js.axis[axis];
+			dev->corda[axis].cmax[pos] = dev->js.axis[axis];
 
 			t = get_time();
+			reset_range(&dev->js);
 
-			while (get_time() < t + 2000 && (b ^ js.buttons)) {
-				if (js.axis[axis] < corda[axis].cmin[pos]) {
-					corda[axis].cmin[pos] = js.axis[axis];
+			while (get_time() < t + 2000 && (b ^ dev->js.buttons)) {
+				if (dev->js.amin[axis] < dev->corda[axis].cmin[pos]) {
+					dev->corda[axis].cmin[pos] = dev->js.amin[axis];
 					t = get_time();
 				}
-				if (js.axis[axis] > corda[axis].cmax[pos]) {
-					corda[axis].cmax[pos] = js.axis[axis];
+				if (dev->js.amax[axis] > dev->corda[axis].cmax[pos]) {
+					dev->corda[axis].cmax[pos] = dev->js.amax[axis];
 					t = get_time();
 				}
-				wait_for_event(fd, &js);
+				wait_for_event(dev->fd, &dev->js);
 			}
 			puts("OK.");
 		}
 
 	puts("");
 
-	for (j = 0; j < axes; j++) {
-		solve_broken(corr[j].coef, corda[j]);
-		corr[j].type = JS_CORR_BROKEN;
+	for (j = 0; j < dev->axes; j++) {
+		solve_broken(dev->corr[j].coef, dev->corda[j]);
+		dev->corr[j].type = JS_CORR_BROKEN;
 	}
 
-	puts("Setting correction to:");
-	for (i = 0; i < axes; i++) {
+	set_calibration(dev);
+}
+
+void set_calibration(struct jsdev *dev)
+{
+	int i, j;
+
+	printf("%sSetting correction to:\n", dev->label);
+	for (i = 0; i < dev->axes; i++) {
 		printf("Correction for axis %d: %s, precision: %d.\n",
-			i, corr_name[(int)corr[i].type], corr[i].prec);
-		if (corr_coef_num[(int)corr[i].type]) {
+			i, corr_name[(int)dev->corr[i].type], dev->corr[i].prec);
+		if (corr_coef_num[(int)dev->corr[i].type]) {
 			printf("Coeficients:");
-			for(j = 0; j < corr_coef_num[(int)corr[i].type]; j++) {
-				printf(" %d", corr[i].coef[j]);
-				if (j < corr_coef_num[(int)corr[i].type] - 1) putchar(',');
+			for(j = 0; j < corr_coef_num[(int)dev->corr[i].type]; j++) {
+				printf(" %d", dev->corr[i].coef[j]);
+				if (j < corr_coef_num[(int)dev->corr[i].type] - 1) putchar(',');
 			}
 		putchar('\n');
 		}
@@ -320,59 +484,418 @@ void calibrate()
 
 	putchar('\n');
 
-	if (ioctl(fd, JSIOCSCORR, &corr) < 0) {
+	if (ioctl(dev->fd, JSIOCSCORR, &dev->corr) < 0) {
 		perror("jscal: error setting correction");
 		exit(1);
 	}
 }
 
-void print_version()
+/*
+ * Calibrates all the axes of joysticks at once from what they do, without
+ * being told where they are. The noise of each axis is measured while the
+ * joystick is left alone, until its center is known to within half a
+ * unit; its spread gives the precision and the center dead band. The
+ * operator then sweeps the axes; the ends of each are taken as the
+ * extremes reached, once each end was visited a few times and none moved
+ * further for a while, and the broken line is fitted to them as to the
+ * positions held when calibrating by hand, the noise giving the width of
+ * each. All the joysticks are sampled together, each going through these
+ * steps at its own pace.
+ */
+
+void auto_start(struct jsdev *dev)
+{
+	int i;
+
+	for (i = 0; i < dev->axes; i++) {
+		dev->autocal[i].mean = dev->autocal[i].m2 = 0;
+		dev->autocal[i].rmin = dev->autocal[i].rmax = dev->js.axis[i];
+	}
+	dev->samples = 0;
+	dev->phase = AUTO_REST;
+}
+
+/* Takes a sample while at rest; returns 1 once the noise is known */
+int auto_rest(struct jsdev *dev)
+{
+	struct auto_axis *a;
+	double sd, delta;
+	int i, n, v, settled;
+
+	n = ++dev->samples;
+	settled = n >= REST_MIN;
+
+	for (i = 0; i < dev->axes; i++) {
+		a = &dev->autocal[i];
+		v = dev->js.axis[i];
+		sd = n > 1 ? sqrt(a->m2 / (n - 1)) : 0;
+
+		/* Far outside the noise, even in between samples: somebody
+		   touched it */
+		if (n > REST_MIN &&
+		    (fabs(dev->js.amin[i] - a->mean) > 6 * sd + 2 ||
+		     fabs(dev->js.amax[i] - a->mean) > 6 * sd + 2)) {
+			putcs("");
+			printf("%sDon't touch the joystick, starting over ...\n",
+				dev->label);
+			auto_start(dev);
+			return 0;
+		}
+
+		delta = v - a->mean;
+		a->mean += delta / n;
+		a->m2 += delta * (v - a->mean);
+		if (dev->js.amin[i] < a->rmin)
+			a->rmin = dev->js.amin[i];
+		if (dev->js.amax[i] > a->rmax)
+			a->rmax = dev->js.amax[i];
+
+		if (n < 2 || sqrt(a->m2 / (n - 1) / n) > 0.5)
+			settled = 0;
+	}
+
+	if (!settled && n < REST_MAX)
+		return 0;
+
+	/* The dead band holds what was seen and three sigmas about the
+	   mean, which the noise stays within nearly always */
+	for (i = 0; i < dev->axes; i++) {
+		a = &dev->autocal[i];
+		sd = n > 1 ? sqrt(a->m2 / (n - 1)) : 0;
+		a->cmin = floor(a->mean - 3 * sd);
+		a->cmax = ceil(a->mean + 3 * sd);
+		if (a->cmin > a->rmin)
+			a->cmin = a->rmin;
+		if (a->cmax < a->rmax)
+			a->cmax = a->rmax;
+		a->prec = a->cmax - a->cmin;
+	}
+
+	return 1;
+}
+
+/* Whether an axis went far enough, enough times, to know its ends */
+int auto_swept(const struct auto_axis *a)
+{
+	return a->hi - a->lo > 16 * (a->prec + 1) &&
+		a->lo_visits >= SWEEP_VISITS && a->hi_visits >= SWEEP_VISITS;
+}
+
+void auto_sweep_start(struct jsdev *dev, long long t)
+{
+	struct auto_axis *a;
+	int i;
+
+	for (i = 0; i < dev->axes; i++) {
+		a = &dev->autocal[i];
+		a->lo = a->cmin;
+		a->hi = a->cmax;
+		a->lo_visits = a->hi_visits = 0;
+		a->side = 0;
+	}
+
+	dev->b = dev->js.buttons & ~(1 << 31);
+	dev->grown = t;
+	dev->phase = AUTO_SWEEP;
+}
+
+/* Takes a sample while the axes are swept; returns the next phase */
+int auto_sweep(struct jsdev *dev, long long t)
+{
+	struct auto_axis *a;
+	int i, v, lo, hi, margin, swept = 0;
+
+	if (dev->b ^ dev->js.buttons)
+		return AUTO_STOPPED;
+
+	for (i = 0; i < dev->axes; i++) {
+		a = &dev->autocal[i];
+		v = dev->js.axis[i];
+		lo = dev->js.amin[i];
+		hi = dev->js.amax[i];
+		margin = a->prec + 1 + (a->hi - a->lo) / 50;
+
+		/* Going well past an end moves it, and only this visit
+		   counts for it then */
+		if (lo < a->lo) {
+			if (lo < a->lo - margin && a->side == -1)
+				a->lo_visits = 1;
+			a->lo = lo;
+			dev->grown = t;
+		}
+		if (hi > a->hi) {
+			if (hi > a->hi + margin && a->side == 1)
+				a->hi_visits = 1;
+			a->hi = hi;
+			dev->grown = t;
+		}
+
+		if (a->hi - a->lo > 16 * (a->prec + 1)) {
+			if (lo <= a->lo + margin && a->side != -1) {
+				a->lo_visits++;
+				a->side = -1;
+			} else if (hi >= a->hi - margin && a->side != 1) {
+				a->hi_visits++;
+				a->side = 1;
+			} else if (v > a->lo + 2 * margin &&
+				   v < a->hi - 2 * margin) {
+				a->side = 0;
+			}
+		}
+
+		swept += auto_swept(a);
+	}
+
+	if (swept == dev->axes && t - dev->grown >= SWEEP_SETTLE)
+		return AUTO_DONE;
+
+	return AUTO_SWEEP;
+}
+
+/* Counts the visits still wanted to the ends of the axes */
+int auto_visits(const struct jsdev *dev, int i)
+{
+	const struct auto_axis *a = &dev->autocal[i];
+
+	return (a->lo_visits < SWEEP_VISITS ? a->lo_visits : SWEEP_VISITS) +
+		(a->hi_visits < SWEEP_VISITS ? a->hi_visits : SWEEP_VISITS);
+}
+
+void auto_status(struct jsdev *devs, int n)
+{
+	int i, k, visits;
+
+	if (n == 1 && devs[0].phase != AUTO_SWEEP)
+		return;
+
+	printf("\r%s", n == 1 ? "Ends visited:" : "");
+
+	for (i = 0; i < n; i++) {
+		if (n == 1) {
+			for (k = 0; k < devs[0].axes; k++)
+				printf(" %d:%d/%d", k, auto_visits(&devs[0], k),
+					2 * SWEEP_VISITS);
+			break;
+		}
+
+		printf("%s", devs[i].label);
+		switch (devs[i].phase) {
+		case AUTO_REST:
+			printf("still  ");
+			break;
+		case AUTO_SWEEP:
+			for (k = visits = 0; k < devs[i].axes; k++)
+				visits += auto_visits(&devs[i], k);
+			printf("%d/%d  ", visits, 2 * SWEEP_VISITS * devs[i].axes);
+			break;
+		case AUTO_DONE:
+		case AUTO_STOPPED:
+			printf("done  ");
+			break;
+		case AUTO_GONE:
+			printf("gone  ");
+			break;
+		}
+	}
+
+	fflush(stdout);
+}
+
+/* Fits the broken line to what was seen, and sets it */
+void auto_finish(struct jsdev *dev)
+{
+	struct auto_axis *a;
+	int i;
+
+	for (i = 0; i < dev->axes; i++) {
+		a = &dev->autocal[i];
+		dev->corr[i].prec = a->prec;
+
+		if (!auto_swept(a)) {
+			printf("%sAxis %d was not moved enough, leaving it uncorrected.\n",
+				dev->label, i);
+			dev->corr[i].type = JS_CORR_NONE;
+			continue;
+		}
+
+		/* Axes which rest at an end, such as throttles, or far
+		   from the middle, get their center in the middle */
+		if (a->cmin - a->lo < 8 * (a->prec + 1) ||
+		    a->hi - a->cmax < 8 * (a->prec + 1))
+			a->cmin = a->cmax = (a->lo + a->hi) / 2;
+
+		dev->corda[i].cmin[0] = a->lo;
+		dev->corda[i].cmax[0] = a->lo + a->prec;
+		dev->corda[i].cmin[1] = a->cmin;
+		dev->corda[i].cmax[1] = a->cmax;
+		dev->corda[i].cmin[2] = a->hi - a->prec;
+		dev->corda[i].cmax[2] = a->hi;
+
+		solve_broken(dev->corr[i].coef, dev->corda[i]);
+		dev->corr[i].type = JS_CORR_BROKEN;
+	}
+
+	printf("%sCalibrated in %.1f s.\n\n", dev->label,
+		(dev->end - dev->start) / 1000.0);
+
+	set_calibration(dev);
+}
+
+void auto_calibrate(struct jsdev *devs, int n)
+{
+	struct jsdev *dev;
+	int i, k, left, swept = 0;
+	long long t, shown = 0;
+
+	for (k = 0; k < n; k++) {
+		dev = &devs[k];
+
+		for (i=0; i<ABS_MAX + 1; i++) {
+			dev->corr[i].type = JS_CORR_NONE;
+			dev->corr[i].prec = 0;
+		}
+
+		if (ioctl(dev->fd, JSIOCSCORR, &dev->corr) < 0) {
+			perror("jscal: error setting correction");
+			exit(1);
+		}
+	}
+
+	puts(n == 1 ? "Calibrating precision: leave the joystick centered and don't touch it." :
+		"Calibrating precision: leave the joysticks centered and don't touch them.");
+
+	/* Let the initial state come in */
+	sample_until(devs, n, get_time() + 50);
+
+	t = get_time();
+	for (k = 0; k < n; k++) {
+		reset_range(&devs[k].js);
+		auto_start(&devs[k]);
+		devs[k].start = t;
+	}
+
+	for (left = n; left; ) {
+		t += SAMPLE_PERIOD;
+		sample_until(devs, n, t);
+
+		for (k = 0; k < n; k++) {
+			dev = &devs[k];
+
+			if (dev->gone && dev->phase <= AUTO_SWEEP) {
+				putcs("");
+				printf("%sJoystick gone, not calibrated.\n",
+					dev->label);
+				dev->phase = AUTO_GONE;
+				left--;
+				continue;
+			}
+
+			switch (dev->phase) {
+			case AUTO_REST:
+				if (!auto_rest(dev))
+					break;
+
+				putcs("");
+				printf("%sDone after %d samples. Precision is:\n",
+					dev->label, dev->samples);
+				for (i = 0; i < dev->axes; i++)
+					printf("%sAxis: %d: %5d, center %d to %d\n",
+						dev->label, i, dev->autocal[i].prec,
+						dev->autocal[i].cmin,
+						dev->autocal[i].cmax);
+				puts("");
+
+				if (!swept++) {
+					puts("Move each axis to both of its ends and back, a few times.");
+					puts("Push any button or press Enter to stop early.");
+				}
+
+				auto_sweep_start(dev, t);
+				break;
+
+			case AUTO_SWEEP:
+				dev->phase = auto_sweep(dev, t);
+				if (dev->phase == AUTO_SWEEP)
+					break;
+
+				dev->end = t;
+				left--;
+				putcs("");
+				printf("%s%s\n", dev->label,
+					dev->phase == AUTO_DONE ? "Done." : "Stopped early.");
+				break;
+			}
+
+			reset_range(&dev->js);
+		}
+
+		if (t - shown >= 100) {
+			auto_status(devs, n);
+			shown = t;
+		}
+	}
+
+	putcs("");
+	puts("");
+
+	for (k = 0; k < n; k++)
+		if (devs[k].phase != AUTO_GONE)
+			auto_finish(&devs[k]);
+}
+
+void print_version(struct jsdev *dev)
 {
 	printf("JsCal was compiled for driver version: %d.%d.%d\n", JS_VERSION >> 16,
 		(JS_VERSION >> 8) & 0xff, JS_VERSION & 0xff);
-	printf("Current running driver version: %d.%d.%d\n", version >> 16,
-		(version >> 8) & 0xff, version & 0xff);
+	printf("Current running driver version: %d.%d.%d\n", dev->version >> 16,
+		(dev->version >> 8) & 0xff, dev->version & 0xff);
 }
 
-void print_mappings(char *devicename)
+/* Writes the current mappings as the argument of --set-mappings */
+void write_mappings(struct jsdev *dev, FILE *f)
 {
 	int i;
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
+	if (ioctl(dev->fd, JSIOCGAXES, &dev->axes) < 0) {
 		perror("jscal: error getting axes");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGBUTTONS, &buttons) < 0) {
+	if (ioctl(dev->fd, JSIOCGBUTTONS, &dev->buttons) < 0) {
 		perror("jscal: error getting buttons");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGAXMAP, &axmap) < 0) {
+	if (ioctl(dev->fd, JSIOCGAXMAP, &dev->axmap) < 0) {
 		perror("jscal: error getting axis map");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGBTNMAP, &buttonmap) < 0) {
-	        buttons=0;
+	if (getbtnmap(dev->fd, dev->buttonmap) < 0) {
+	        dev->buttons=0;
 	}
 
-	printf("jscal -u %d", axes);
-	for (i = 0; i < axes; i++)
+	fprintf(f, "%d", dev->axes);
+	for (i = 0; i < dev->axes; i++)
   {
-		printf( ",%d", axmap[i]);
+		fprintf(f, ",%d", dev->axmap[i]);
 	}
 
-  printf(",%d", buttons);
-	for (i = 0; i < buttons; i++)
+  fprintf(f, ",%d", dev->buttons);
+	for (i = 0; i < dev->buttons; i++)
   {
-		printf( ",%d", buttonmap[i]);
+		fprintf(f, ",%d", dev->buttonmap[i]);
 	}
+}
 
-	printf(" %s\n",devicename);
+void print_mappings(struct jsdev *dev)
+{
+	printf("jscal -u ");
+	write_mappings(dev, stdout);
+	printf(" %s\n",dev->name);
 }
 
 
-void get_axmap2(void)
+void get_axmap2(struct jsdev *dev)
 {
-        if (ioctl(fd, JSIOCGAXMAP, &axmap2) < 0) {
+        if (ioctl(dev->fd, JSIOCGAXMAP, &dev->axmap2) < 0) {
 		perror("jscal: error getting axis map");
 		exit(1);
 	}
@@ -382,64 +905,94 @@ void get_axmap2(void)
  * Remap the calibration data to fit the (potentially) new axis map.
  * axmap2 stores the original axis map, axmap the new one.
  */
-void correct_axes(void)
+void correct_axes(struct jsdev *dev)
 {
         int axmes[ABS_MAX + 1];
         struct js_corr corr_tmp[ABS_MAX + 1];
         int i;
-        int ax[axes];
+        int ax[dev->axes];
 	//Create remapping table
-        for(i=0;i<axes;++i){
-	        axmes[(axmap2[i])]=i;
+        for(i=0;i<dev->axes;++i){
+	        axmes[(dev->axmap2[i])]=i;
 	}
-	for(i=0;i<axes;++i){
-	        ax[i]=axmes[(axmap[i])];
+	for(i=0;i<dev->axes;++i){
+	        ax[i]=axmes[(dev->axmap[i])];
 	}
 	//Read again current callibration settings
-	if (ioctl(fd, JSIOCGCORR, &corr) < 0) {
+	if (ioctl(dev->fd, JSIOCGCORR, &dev->corr) < 0) {
 		perror("jscal: error getting correction");
 		exit(1);
 	}
 	//Remap callibration settings
-	for (i = 0; i < axes; i++) {
-	        corr_tmp[i]=corr[(ax[i])];
+	for (i = 0; i < dev->axes; i++) {
+	        corr_tmp[i]=dev->corr[(ax[i])];
 	}
-	if (ioctl(fd, JSIOCSCORR, &corr_tmp) < 0) {
+	if (ioctl(dev->fd, JSIOCSCORR, &corr_tmp) < 0) {
 		perror("jscal: error setting correction");
 		exit(1);
 	}
 
 }
 
-void print_settings(char *devicename)
+/* Writes the current correction as the argument of --set-correction */
+void write_settings(struct jsdev *dev, FILE *f)
 {
 	int i,j;
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
+	if (ioctl(dev->fd, JSIOCGAXES, &dev->axes) < 0) {
 		perror("jscal: error getting axes");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGBUTTONS, &buttons) < 0) {
+	if (ioctl(dev->fd, JSIOCGBUTTONS, &dev->buttons) < 0) {
 		perror("jscal: error getting buttons");
 		exit(1);
 	}
-	if (ioctl(fd, JSIOCGCORR, &corr) < 0) {
+	if (ioctl(dev->fd, JSIOCGCORR, &dev->corr) < 0) {
 		perror("jscal: error getting correction");
 		exit(1);
 	}
 
-	printf("jscal -s %d", axes);
-	for (i = 0; i < axes; i++) {
-		printf( ",%d,%d", corr[i].type, corr[i].prec);
-		for (j = 0; j < corr_coef_num[(int)corr[i].type]; j++)
-			printf(",%d", corr[i].coef[j]);
+	fprintf(f, "%d", dev->axes);
+	for (i = 0; i < dev->axes; i++) {
+		fprintf(f, ",%d,%d", dev->corr[i].type, dev->corr[i].prec);
+		for (j = 0; j < corr_coef_num[(int)dev->corr[i].type]; j++)
+			fprintf(f, ",%d", dev->corr[i].coef[j]);
 	}
-	printf(" %s\n",devicename);
+}
+
+void print_settings(struct jsdev *dev)
+{
+	printf("jscal -s ");
+	write_settings(dev, stdout);
+	printf(" %s\n",dev->name);
+}
+
+/*
+ * Reads a mapping at p: a code, or the name of one of the given type
+ * (ABS_X, BTN_TRIGGER...), in any case. Returns -1 if it is neither.
+ */
+static int parse_code(const char *p, int type)
+{
+	const struct codename *c;
+	char name[64];
+	int code;
+
+	if (sscanf(p, "%d", &code) == 1)
+		return code;
+	if (sscanf(p, "%63[^,]", name) == 1 &&
+	    (c = codename_lookup(name)) && c->type == type)
+		return c->code;
+
+	return -1;
 }
 
 // n axes                      n buttons
 // 10,0,1,2,5,6,16,17,40,41,42:13,288,289,290,291,292,293,294,295,296,297,298,299,300
-void set_mappings(char *p)
+/*
+ * Reads the mappings into axmap and buttonmap, and returns the number of
+ * buttons given: 0 leaves the buttons alone. Returns -1 on error.
+ */
+int parse_mappings(struct jsdev *dev, char *p)
 {
 	int i;
 	int axes_on_cl = 0;
@@ -447,58 +1000,51 @@ void set_mappings(char *p)
   int axis_mapping = 0;
   int btn_mapping = 0;
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
-		perror("jscal: error getting axes");
-		exit(1);
-	}
-	if (ioctl(fd, JSIOCGBUTTONS, &buttons) < 0) {
-		perror("jscal: error getting buttons");
-		exit(1);
-	}
-
-	if (axes > ABS_MAX + 1) axes = ABS_MAX + 1;
-
 	if (!p) {
 		fprintf(stderr, "jscal: missing argument for --set-mappings\n");
-		exit(1);
+		return -1;
 	}
 
    //axes
 	sscanf(p, "%d", &axes_on_cl);
 	p = strstr(p, ",");
 
-	if (axes_on_cl != axes) {
+	if (axes_on_cl != dev->axes) {
 		fprintf(stderr, "jscal: joystick has %d axes and not %d as specified on command line\n", 
-			axes, axes_on_cl);
-		exit(1);
+			dev->axes, axes_on_cl);
+		return -1;
 	}
 
 
-	for (i = 0; i < axes; i++)
+	for (i = 0; i < dev->axes; i++)
   {
 		if (!p) {
 			fprintf(stderr, "jscal: missing mapping for axis %d\n", i);
-			exit(1);
+			return -1;
 		}
-		sscanf(++p, "%d", &axis_mapping);
+		axis_mapping = parse_code(++p, EV_ABS);
 		p = strstr(p, ",");
 
 
+		if (axis_mapping < 0) {
+			fprintf(stderr, "jscal: unknown axis mapping for axis %d\n", i);
+			return -1;
+		}
 		if (axis_mapping > ABS_MAX + 1) {
 			fprintf(stderr, "jscal: invalid axis mapping for axis %d (max is %d)\n", i, ABS_MAX + 1);
-			exit(1);
+			return -1;
 		}
-		axmap[i] = axis_mapping;
+		dev->axmap[i] = axis_mapping;
 	}
 
   //buttons
 	sscanf(++p, "%d", &btns_on_cl);
 	p = strstr(p, ",");
 
-	if ((btns_on_cl != buttons)&&(btns_on_cl!=0)) {
+	if ((btns_on_cl != dev->buttons)&&(btns_on_cl!=0)) {
 		fprintf(stderr, "jscal: joystick has %d buttons and not %d as specified on command line\n", 
-			buttons, btns_on_cl);
-		exit(1);
+			dev->buttons, btns_on_cl);
+		return -1;
 	}
 
 
@@ -506,79 +1052,98 @@ void set_mappings(char *p)
 	  {
 		if (!p) {
 			fprintf(stderr, "jscal: missing mapping for button %d\n", i);
-			exit(1);
+			return -1;
 		}
-		sscanf(++p, "%d", &btn_mapping);
+		btn_mapping = parse_code(++p, EV_KEY);
 		p = strstr(p, ",");
 
+		if (btn_mapping < 0) {
+			fprintf(stderr, "jscal: unknown button mapping for button %d\n", i);
+			return -1;
+		}
 
 		if (btn_mapping > KEY_MAX) {
 			fprintf(stderr, "jscal: invalid button mapping for button %d (max is %d)\n", i, KEY_MAX);
-			exit(1);
+			return -1;
 		}
 		if (btn_mapping < BTN_MISC) {
 			fprintf(stderr, "jscal: invalid button mapping for button %d (min is %d)\n", i, BTN_MISC);
-			exit(1);
+			return -1;
 		}
-		buttonmap[i] = btn_mapping;
+		dev->buttonmap[i] = btn_mapping;
 	  }
 
 	if (p) {
 		fprintf(stderr, "jscal: too many values\n");
-		exit(1);
+		return -1;
 	}
 
+	return btns_on_cl;
+}
+
+/*
+ * Applies the mappings parse_mappings() read. The correction follows the
+ * axes around, unless a new one is about to be set anyway. Returns -1 on
+ * error.
+ */
+int apply_mappings(struct jsdev *dev, int buttons, int keep_correction)
+{
 	// Save the current axis map
-	get_axmap2();
+	if (keep_correction)
+		get_axmap2(dev);
 	
 	// Apply the new axis map
-	if (ioctl(fd, JSIOCSAXMAP, &axmap) < 0) {
+	if (ioctl(dev->fd, JSIOCSAXMAP, &dev->axmap) < 0) {
 		perror("jscal: error setting axis map");
-		exit(1);
+		return -1;
 	}
 
 	// Move the calibration data accordingly
-	correct_axes();
+	if (keep_correction)
+		correct_axes(dev);
 
-	if (btns_on_cl!=0){
-		if (ioctl(fd, JSIOCSBTNMAP, &buttonmap) < 0) {
+	if (buttons!=0){
+		if (setbtnmap(dev->fd, dev->buttonmap) < 0) {
 		       perror("jscal: error setting button map");
-	               exit(1);
+	               return -1;
 		}
        }
+	return 0;
 }
 
-void set_correction(char *p)
+void set_mappings(struct jsdev *dev, char *p)
 {
-	int i,j;
-	int t = 0;
+	int buttons = parse_mappings(dev, p);
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
-		perror("jscal: error getting axes");
+	if (buttons < 0 || apply_mappings(dev, buttons, 1) < 0)
 		exit(1);
-	}
+}
 
-	if (axes > ABS_MAX + 1) axes = ABS_MAX + 1;
+/* Reads the correction into corr; returns -1 on error */
+int parse_correction(struct jsdev *dev, char *p)
+{
+	int i,j;
+	int t = 0;
 
 	if (!p) {
 		fprintf(stderr, "jscal: missing number of axes\n");
-		exit(1);
+		return -1;
 	}
 	sscanf(p, "%d", &t);
 	p = strstr(p, ",");
 
-	if (t != axes) {
+	if (t != dev->axes) {
 		fprintf(stderr, "jscal: joystick has different number of axes (%d) than specified in command line (%d)\n", 
-			axes, t);
-		exit(1);
+			dev->axes, t);
+		return -1;
 	}
 
 
-	for (i = 0; i < axes; i++) {
+	for (i = 0; i < dev->axes; i++) {
 
 		if (!p) {
 			fprintf(stderr, "jscal: missing correction type for axis %d\n", i);
-			exit(1);
+			return -1;
 		}
 		sscanf(++p, "%d", &t);
 		p = strstr(p, ",");
@@ -586,90 +1151,421 @@ void set_correction(char *p)
 
 		if (t > MAX_CORR) {
 			fprintf(stderr, "jscal: unknown correction type for axis %d\n", i);
-			exit(1);
+			return -1;
 		}
-		corr[i].type = t;
+		dev->corr[i].type = t;
 
 		if (!p) {
 			fprintf(stderr, "jscal: missing precision for axis %d\n", i);
-			exit(1);
+			return -1;
 		}
 		sscanf(++p, "%d", &t);
 		p = strstr(p, ",");
 
-		corr[i].prec = t;
+		dev->corr[i].prec = t;
 
-		for(j = 0; j < corr_coef_num[corr[i].type]; j++) {
+		for(j = 0; j < corr_coef_num[dev->corr[i].type]; j++) {
 			if (!p) {
 				fprintf(stderr, "jscal: missing coefficient %d for axis %d\n", j, i);
-				exit(1);
+				return -1;
 			}
-			sscanf(++p, "%d", (int*) &corr[i].coef[j]);
+			sscanf(++p, "%d", (int*) &dev->corr[i].coef[j]);
 			p = strstr(p, ",");
 		}
 	}
 
 	if (p) {
 		fprintf(stderr, "jscal: too many values\n");
-		exit(1);
+		return -1;
 	}
-	
-	if (ioctl(fd, JSIOCSCORR, &corr) < 0) {
+	return 0;
+}
+
+int apply_correction(struct jsdev *dev)
+{
+	if (ioctl(dev->fd, JSIOCSCORR, &dev->corr) < 0) {
 		perror("jscal: error setting correction");
-		exit(1);
+		return -1;
 	}
+	return 0;
 }
 
-void test_center()
+void set_correction(struct jsdev *dev, char *p)
+{
+	if (parse_correction(dev, p) < 0 || apply_correction(dev) < 0)
+		exit(1);
+}
+
+void test_center(struct jsdev *dev)
 {
 	int i;
-	struct js_event ev;
 
-	if (ioctl(fd, JSIOCGAXES, &axes) < 0) {
+	if (ioctl(dev->fd, JSIOCGAXES, &dev->axes) < 0) {
 		perror("jscal: error getting axes");
 		exit(1);
 	}
 
-	if (ioctl(fd, JSIOCGBUTTONS, &buttons) < 0) {
+	if (ioctl(dev->fd, JSIOCGBUTTONS, &dev->buttons) < 0) {
 		perror("jscal: error getting buttons");
 		exit(1);
 	}
 
-	if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
-		perror("jscal: cannot set nonblocking mode");
+	read_events(dev->fd, &dev->js);
+
+	for (i = 0; i < dev->axes; i++) if (dev->js.axis[i]) {
+		fprintf(stderr, "jscal: axes not calibrated\n");
+		exit(2);
+	}
+	if (dev->js.buttons) {
+		fprintf(stderr, "jscal: buttons pressed\n");
+		exit(3);
+	}
+}
+
+/*
+ * Opens the calibration database. The text file jscal-store used to
+ * keep next to it is brought in when the database is first created,
+ * which restoring does too if it finds nothing else.
+ */
+void open_db(struct caldb *db, const char *path, int create)
+{
+	char state[PATH_MAX];
+	const char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	FILE *f;
+	int n;
+
+	snprintf(state, sizeof(state), "%.*sjoystick.state",
+		 (int)(base - path), path);
+	if (!create && access(path, F_OK) && !access(state, F_OK))
+		create = 1;
+
+	if ((n = caldb_open(db, path, create)) < 0) {
+		fprintf(stderr, "jscal: can't open calibration database %s: %s\n",
+			path, strerror(errno));
 		exit(1);
 	}
 
-	while (read(fd, &ev, sizeof(struct js_event)) == sizeof(struct js_event)) {
-		switch (ev.type & ~JS_EVENT_INIT) {
-			case JS_EVENT_AXIS:
-				js.axis[ev.number] = ev.value; break;
-			case JS_EVENT_BUTTON:
-				js.buttons = (js.buttons & ~(1 << ev.number)) | (ev.value << ev.number);
+	if (n && (f = fopen(state, "r"))) {
+		if ((n = caldb_import(db, f)) < 0) {
+			fprintf(stderr, "jscal: can't import %s: %s\n",
+				state, strerror(errno));
+			exit(1);
 		}
+		printf("Imported %d joystick%s from %s.\n", n, n == 1 ? "" : "s",
+			state);
+		fclose(f);
 	}
+}
 
-	for (i = 0; i < axes; i++) if (js.axis[i]) {
-		fprintf(stderr, "jscal: axes not calibrated\n");
-		exit(2);
+void store_to_db(struct jsdev *dev, const char *path)
+{
+	static struct caldb_entry e;
+	struct caldb_ident id;
+	struct caldb db;
+	FILE *f;
+
+	caldb_ident(dev->fd, dev->name, &id);
+	if (!*id.name && !*id.vendor) {
+		puts("No product name or vendor available, calibration will be stored for the");
+		printf("given device name (%s) only!\n", id.kernel);
 	}
-	if (js.buttons) {
-		fprintf(stderr, "jscal: buttons pressed\n");
-		exit(3);
+
+	if (!(f = fmemopen(e.mappings, sizeof(e.mappings), "w")))
+		goto fail;
+	write_mappings(dev, f);
+	if (fclose(f))
+		goto fail;
+	if (!(f = fmemopen(e.correction, sizeof(e.correction), "w")))
+		goto fail;
+	write_settings(dev, f);
+	if (fclose(f))
+		goto fail;
+
+	open_db(&db, path, 1);
+	if (caldb_store(&db, &id, &e)) {
+		fprintf(stderr, "jscal: can't store calibration in %s: %s\n",
+			path, strerror(errno));
+		exit(1);
 	}
+	caldb_close(&db);
+	return;
+
+fail:
+	perror("jscal: can't store calibration");
+	exit(1);
+}
+
+/* The mappings go first, as the correction follows the axes around */
+void restore_from_db(struct jsdev *dev, const char *path)
+{
+	static struct caldb_entry e;
+	struct caldb_ident id;
+	struct caldb db;
+	int found;
+
+	caldb_ident(dev->fd, dev->name, &id);
+
+	open_db(&db, path, 0);
+	found = caldb_lookup(&db, &id, &e);
+	caldb_close(&db);
+
+	if (found < 0) {
+		fprintf(stderr, "jscal: can't read calibration database %s: %s\n",
+			path, strerror(errno));
+		exit(1);
+	}
+	if (!found) {
+		fprintf(stderr, "jscal: no calibration stored for %s\n", dev->name);
+		exit(1);
+	}
+
+	if (*e.mappings)
+		set_mappings(dev, e.mappings);
+	if (*e.correction)
+		set_correction(dev, e.correction);
 }
 
 int action = 0;
 
+/*
+ * Opens a joystick, making sure the driver is the one we speak to, and
+ * gets its number of axes and buttons. Returns -1 on error.
+ */
+int open_device(struct jsdev *dev, const char *name, int several)
+{
+	const char *base = strrchr(name, '/') ? strrchr(name, '/') + 1 : name;
+
+	dev->name = name;
+	if (several)
+		snprintf(dev->label, sizeof(dev->label), "%s: ", base);
+
+	if ((dev->fd = open(name, O_RDONLY | O_NONBLOCK)) < 0) {
+		fprintf(stderr, "jscal: can't open joystick device %s: %s\n",
+			name, strerror(errno));
+		return -1;
+	}
+
+	if (ioctl(dev->fd, JSIOCGVERSION, &dev->version) < 0) {
+		perror("jscal: error getting version");
+		goto fail;
+	}
+	if (dev->version != JS_VERSION) {
+		fprintf(stderr, "jscal: wrong version\n");
+		print_version(dev);
+		goto fail;
+	}
+
+	if (ioctl(dev->fd, JSIOCGAXES, &dev->axes) < 0) {
+		perror("jscal: error getting axes");
+		goto fail;
+	}
+	if (ioctl(dev->fd, JSIOCGBUTTONS, &dev->buttons) < 0) {
+		perror("jscal: error getting buttons");
+		goto fail;
+	}
+	if (dev->axes > ABS_MAX + 1) dev->axes = ABS_MAX + 1;
+
+	return 0;
+
+fail:
+	close(dev->fd);
+	return -1;
+}
+
+int compare_names(const void *a, const void *b)
+{
+	return strverscmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* A section of a profile, and the joysticks it applies to */
+struct profile {
+	int line;
+	int by_name;
+	char *match;			/* path or joystick name */
+	char *mappings, *correction;
+};
+
+struct profile_joystick {
+	struct jsdev dev;
+	char name[128];			/* as the driver gives it */
+};
+
+struct profile_set {
+	struct profile_joystick *j;
+	int n;
+	int given;			/* on the command line, no others */
+};
+
+/* Opens a joystick, or finds it if it already is */
+struct profile_joystick *profile_joystick(struct profile_set *set,
+					  const char *path)
+{
+	struct profile_joystick *j;
+	int i;
+
+	for (i = 0; i < set->n; i++)
+		if (!strcmp(set->j[i].dev.name, path))
+			return &set->j[i];
+
+	if (!(j = realloc(set->j, (set->n + 1) * sizeof(*j)))) {
+		perror("jscal");
+		exit(1);
+	}
+	set->j = j;
+	j = &set->j[set->n];
+	memset(j, 0, sizeof(*j));
+	if (open_device(&j->dev, path, 0))
+		return NULL;
+	/* The path may not last, the joystick does */
+	if (!(j->dev.name = strdup(path))) {
+		perror("jscal");
+		exit(1);
+	}
+	if (ioctl(j->dev.fd, JSIOCGNAME(sizeof(j->name)), j->name) < 0)
+		strcpy(j->name, "Unknown");
+	set->n++;
+
+	return j;
+}
+
+/* Reads a profile; the values point into the lines, which are kept */
+struct profile *read_profile(const char *path, int *n)
+{
+	struct profile *prof = NULL, *p = NULL;
+	char *line = NULL, *key, *value;
+	size_t size = 0;
+	int lineno = 0;
+	FILE *f;
+
+	if (!(f = strcmp(path, "-") ? fopen(path, "r") : stdin)) {
+		fprintf(stderr, "jscal: can't open profile %s: %s\n", path,
+			strerror(errno));
+		exit(1);
+	}
+
+	*n = 0;
+	while (getline(&line, &size, f) > 0) {
+		lineno++;
+		key = line + strspn(line, " \t");
+		if (*key == '#')
+			continue;
+		key[strcspn(key, "\n")] = 0;
+		value = key + strcspn(key, " \t");
+		if (*value)
+			*value++ = 0;
+		value += strspn(value, " \t");
+		while (*value && strchr(" \t", value[strlen(value) - 1]))
+			value[strlen(value) - 1] = 0;
+		if (!*key)
+			continue;
+
+		if (!strcmp(key, "device") || !strcmp(key, "name")) {
+			if (!(prof = realloc(prof, (*n + 1) * sizeof(*prof)))) {
+				perror("jscal");
+				exit(1);
+			}
+			p = &prof[(*n)++];
+			memset(p, 0, sizeof(*p));
+			p->line = lineno;
+			p->by_name = *key == 'n';
+			p->match = value;
+		} else if (!p) {
+			fprintf(stderr, "jscal: %s:%d: no device or name before %s\n",
+				path, lineno, key);
+			exit(1);
+		} else if (!strcmp(key, "mappings")) {
+			p->mappings = value;
+		} else if (!strcmp(key, "correction")) {
+			p->correction = value;
+		} else {
+			fprintf(stderr, "jscal: %s:%d: unknown setting %s\n",
+				path, lineno, key);
+			exit(1);
+		}
+
+		/* The next line gets a buffer of its own */
+		line = NULL;
+		size = 0;
+	}
+	free(line);
+
+	if (f != stdin)
+		fclose(f);
+
+	return prof;
+}
+
+/*
+ * Applies a profile to the joysticks given, or to those it names, each
+ * opened once whatever the number of sections it matches. Mappings and
+ * correction are both read before either is applied, so that a mistake
+ * leaves the joystick alone; a section which can't be applied is
+ * reported and the others are still applied. Returns the number of
+ * joysticks named which couldn't be opened, and of sections which
+ * couldn't be applied.
+ */
+int apply_profile(const char *path, struct profile_set *set)
+{
+	struct profile *prof;
+	struct profile_joystick *j;
+	glob_t g;
+	int n, i, k, buttons, globbed = 0, errors = 0;
+
+	prof = read_profile(path, &n);
+
+	for (i = 0; i < n && !set->given; i++) {
+		if (!prof[i].by_name) {
+			if (!profile_joystick(set, prof[i].match))
+				errors++;
+		} else if (!globbed++ && !glob("/dev/input/js*", 0, NULL, &g)) {
+			qsort(g.gl_pathv, g.gl_pathc, sizeof(char *), compare_names);
+			for (k = 0; k < g.gl_pathc; k++)
+				profile_joystick(set, g.gl_pathv[k]);
+			globfree(&g);
+		}
+	}
+
+	for (k = 0; k < set->n; k++) {
+		j = &set->j[k];
+		for (i = 0; i < n; i++) {
+			if (strcmp(prof[i].match,
+				   prof[i].by_name ? j->name : j->dev.name))
+				continue;
+
+			buttons = 0;
+			if ((prof[i].mappings &&
+			     (buttons = parse_mappings(&j->dev, prof[i].mappings)) < 0) ||
+			    (prof[i].correction &&
+			     parse_correction(&j->dev, prof[i].correction) < 0) ||
+			    (prof[i].mappings &&
+			     apply_mappings(&j->dev, buttons, !prof[i].correction) < 0) ||
+			    (prof[i].correction && apply_correction(&j->dev) < 0)) {
+				fprintf(stderr, "jscal: %s:%d: not applied to %s\n",
+					path, prof[i].line, j->dev.name);
+				errors++;
+			}
+		}
+	}
+
+	return errors;
+}
+
 int main(int argc, char **argv)
 {
 	int option_index = 0;
 	char *parameter = NULL;
+	const char *database = CALDB_PATH;
+	struct profile_set set = { NULL, 0, 0 };
+	struct jsdev *devs;
+	glob_t g;
+	int all = 0, n, i;
 	int t;
 
   // /usr/include/getopt.h
 	static struct option long_options[] =
 	{
+		{"auto", no_argument, NULL, 'a'},
+		{"all", no_argument, NULL, 'A'},
 		{"calibrate", no_argument, NULL, 'c'},
 		{"help", no_argument, NULL, 'h'},
 		{"set-correction", required_argument, NULL, 's'},
@@ -678,6 +1574,10 @@ int main(int argc, char **argv)
 		{"version", no_argument, NULL, 'V'},
 		{"print-correction", no_argument, NULL, 'p'},
 		{"print-mappings", no_argument, NULL, 'q'},
+		{"store-to-db", no_argument, NULL, 'W'},
+		{"restore-from-db", no_argument, NULL, 'R'},
+		{"database", required_argument, NULL, 'D'},
+		{"apply-profile", required_argument, NULL, 'P'},
     {NULL, no_argument, NULL, 0 }
 	};
 
@@ -686,16 +1586,23 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
+	/* jscal is the one to save which button map ioctl works */
+	setbtnmapcache(1);
+
 	do {
-		t = getopt_long(argc, argv, "chpqu:s:vVt", long_options, &option_index);
+		t = getopt_long(argc, argv, "aAchpqu:s:vVt", long_options, &option_index);
 		switch (t) {
 			case 'p':
 			case 'q':
 			case 's':
 			case 'u':
+			case 'a':
 			case 'c':
 			case 't':
 			case 'V':
+			case 'W':
+			case 'R':
+			case 'P':
 				if (action) {
 					fprintf(stderr, "jscal: more than one action specified\n");
 					exit(1);
@@ -704,6 +1611,12 @@ int main(int argc, char **argv)
 					if ((parameter=optarg)) strcpy(parameter,optarg);
 				}
 				break;
+			case 'A':
+				all = 1;
+				break;
+			case 'D':
+				database = optarg;
+				break;
 			case 'h':
 				help();
 				exit(0);
@@ -721,57 +1634,93 @@ int main(int argc, char **argv)
 		}
 	} while (t != EOF);
 
-	if (argc != optind + 1) {
+	if (all) {
+		if (argc != optind) {
+			fprintf(stderr, "jscal: --all takes no devicename\n");
+			exit(1);
+		}
+		if (glob("/dev/input/js*", 0, NULL, &g) || !g.gl_pathc) {
+			fprintf(stderr, "jscal: no joysticks found\n");
+			exit(1);
+		}
+		qsort(g.gl_pathv, g.gl_pathc, sizeof(char *), compare_names);
+		argv = g.gl_pathv;
+		argc = g.gl_pathc;
+		optind = 0;
+	} else if (argc == optind && action != 'P') {
 		fprintf(stderr, "jscal: missing devicename\n");
 		exit(1);
 	}
 
-	if ((fd = open(argv[argc - 1], O_RDONLY)) < 0) {
-		perror("jscal: can't open joystick device");
-		exit(1);
+	if (action == 'P') {
+		set.given = argc > optind;
+		for (i = optind; i < argc; i++)
+			if (!profile_joystick(&set, argv[i]))
+				exit(1);
+		return apply_profile(parameter, &set) ? 1 : 0;
 	}
 
-	if (ioctl(fd, JSIOCGVERSION, &version) < 0) {
-		perror("jscal: error getting version");
+	n = argc - optind;
+	if (n > 1 && action != 'a') {
+		fprintf(stderr, "jscal: only --auto works on several joysticks\n");
 		exit(1);
 	}
-	if (version != JS_VERSION) {
-		fprintf(stderr, "jscal: wrong version\n");
-		print_version();
+
+	if (!(devs = calloc(n, sizeof(struct jsdev)))) {
+		perror("jscal");
 		exit(1);
 	}
+	for (i = 0; i < n; i++)
+		if (open_device(&devs[i], argv[optind + i], n > 1))
+			exit(1);
 
 	switch (action) {
 		case 0:
-			print_info();
+			print_info(devs);
+			break;
+		case 'a':
+			for (i = 0; i < n; i++) {
+				if (n > 1)
+					printf("%s:\n", devs[i].name);
+				print_info(&devs[i]);
+			}
+			auto_calibrate(devs, n);
 			break;
 		case 'c':
-			print_info();
-			calibrate();
+			print_info(devs);
+			calibrate(devs);
 			break;
 		case 'p':
-			print_settings(argv[argc -1]);
+			print_settings(devs);
 			break;
 		case 'q':
-			print_mappings(argv[argc -1]);
+			print_mappings(devs);
 			break;
 		case 's':
-			set_correction(parameter);
+			set_correction(devs, parameter);
 			break;
 		case 'u':
-			set_mappings(parameter);
+			set_mappings(devs, parameter);
 			break;
 		case 't':
-			test_center();
+			test_center(devs);
 			break;
 		case 'V':
-			print_version();
+			print_version(devs);
+			break;
+		case 'W':
+			store_to_db(devs, database);
+			break;
+		case 'R':
+			restore_from_db(devs, database);
 			break;
 		default:
 			fprintf(stderr, "jscal: this cannot happen\n");
 			exit(1);
 	}
 
-	close(fd);
+	for (i = 0; i < n; i++)
+		close(devs[i].fd);
+	free(devs);
 	return 0;
 }
@@ -0,0 +1,205 @@
+/*
+ * Joystick event logs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+
+#include "jslog.h"
+
+/* Events are written out in big chunks */
+#define JSLOG_BUFFER	65536
+
+static void put16(FILE *f, unsigned int v)
+{
+	putc(v & 0xff, f);
+	putc((v >> 8) & 0xff, f);
+}
+
+static void put32(FILE *f, uint32_t v)
+{
+	put16(f, v & 0xffff);
+	put16(f, v >> 16);
+}
+
+static int get16(FILE *f, unsigned int *v)
+{
+	unsigned char b[2];
+
+	if (fread(b, 1, 2, f) != 2)
+		return -1;
+	*v = b[0] | b[1] << 8;
+
+	return 0;
+}
+
+int jslog_create(struct jslog *log, const char *path)
+{
+	struct jslog_device *dev;
+	int i, j, len;
+
+	if (!(log->f = fopen(path, "wb")))
+		return -1;
+	setvbuf(log->f, NULL, _IOFBF, JSLOG_BUFFER);
+
+	fputs(JSLOG_MAGIC, log->f);
+	putc(JSLOG_VERSION, log->f);
+	putc(log->devices, log->f);
+
+	for (i = 0; i < log->devices; i++) {
+		dev = &log->dev[i];
+		len = strlen(dev->name);
+		put32(log->f, dev->version);
+		putc(dev->axes, log->f);
+		putc(dev->buttons, log->f);
+		putc(len, log->f);
+		fwrite(dev->name, 1, len, log->f);
+		fwrite(dev->axmap, 1, dev->axes, log->f);
+		for (j = 0; j < dev->buttons; j++)
+			put16(log->f, dev->btnmap[j]);
+	}
+
+	log->time = 0;
+
+	return ferror(log->f) ? -1 : 0;
+}
+
+void jslog_write(struct jslog *log, int dev, const struct js_event *js,
+		 int n)
+{
+	uint32_t delta;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (log->devices > 1)
+			putc(dev, log->f);
+		putc(js[i].type, log->f);
+		putc(js[i].number, log->f);
+		put16(log->f, (uint16_t)js[i].value);
+
+		/* The first event is relative to 0 */
+		delta = js[i].time - log->time;
+		while (delta >= 0x80) {
+			putc((delta & 0x7f) | 0x80, log->f);
+			delta >>= 7;
+		}
+		putc(delta, log->f);
+
+		log->time = js[i].time;
+	}
+}
+
+static int read_device(FILE *f, struct jslog_device *dev)
+{
+	unsigned char hdr[7];
+	unsigned int v;
+	int i;
+
+	/* The counts size the maps, and whatever keeps the state of the
+	   axes and buttons replayed */
+	if (fread(hdr, 1, 7, f) != 7 ||
+	    hdr[4] > AXMAP_SIZE || hdr[5] > BTNMAP_SIZE ||
+	    hdr[6] >= JSLOG_NAME_LENGTH ||
+	    fread(dev->name, 1, hdr[6], f) != hdr[6] ||
+	    fread(dev->axmap, 1, hdr[4], f) != hdr[4])
+		return -1;
+
+	dev->version = hdr[0] | hdr[1] << 8 | hdr[2] << 16 | hdr[3] << 24;
+	dev->axes = hdr[4];
+	dev->buttons = hdr[5];
+	dev->name[hdr[6]] = 0;
+
+	for (i = 0; i < dev->axes; i++)
+		if (dev->axmap[i] > ABS_MAX)
+			return -1;
+
+	for (i = 0; i < dev->buttons; i++) {
+		if (get16(f, &v))
+			return -1;
+		dev->btnmap[i] = v;
+	}
+
+	return 0;
+}
+
+int jslog_open(struct jslog *log, const char *path)
+{
+	unsigned char hdr[5];
+	int i, c;
+
+	if (!(log->f = fopen(path, "rb")))
+		return -1;
+	setvbuf(log->f, NULL, _IOFBF, JSLOG_BUFFER);
+
+	if (fread(hdr, 1, 5, log->f) != 5 || memcmp(hdr, JSLOG_MAGIC, 4) ||
+	    hdr[4] != JSLOG_VERSION ||
+	    (c = getc(log->f)) == EOF || c < 1 || c > JSLOG_DEVICES)
+		goto fail;
+	log->devices = c;
+
+	for (i = 0; i < log->devices; i++)
+		if (read_device(log->f, &log->dev[i]))
+			goto fail;
+
+	log->time = 0;
+
+	return 0;
+
+fail:
+	fclose(log->f);
+	return -1;
+}
+
+int jslog_read(struct jslog *log, struct js_event *js)
+{
+	uint32_t delta = 0;
+	unsigned int v;
+	int c, dev = 0, shift = 0;
+
+	if (log->devices > 1) {
+		if ((dev = getc(log->f)) == EOF || dev >= log->devices)
+			return -1;
+	}
+
+	if ((c = getc(log->f)) == EOF)
+		return -1;
+	js->type = c;
+	if ((c = getc(log->f)) == EOF || get16(log->f, &v))
+		return -1;
+	js->number = c;
+	js->value = (int16_t)v;
+
+	do {
+		if ((c = getc(log->f)) == EOF || shift > 28)
+			return -1;
+		delta |= (uint32_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	js->time = log->time += delta;
+
+	return dev;
+}
+
+int jslog_close(struct jslog *log)
+{
+	int ret = ferror(log->f) ? -1 : 0;
+
+	if (fclose(log->f))
+		ret = -1;
+
+	return ret;
+}
@@ -0,0 +1,78 @@
+/*
+ * Joystick event logs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __JSLOG_H__
+#define __JSLOG_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <linux/joystick.h>
+
+#include "axbtnmap.h"
+
+/* A log starts with the magic, a version byte and the number of
+   devices, then describes each device: its driver version (32 bits),
+   number of axes and buttons, the length of its name and the name, its
+   axis map (a byte per axis) and button map (16 bits per button). Each
+   event follows as the device it came from (only if there are several),
+   its type, number, value (16 bits) and the time since the previous
+   event in ms, as a LEB128 varint: five bytes for most events. All
+   values are little endian. */
+#define JSLOG_MAGIC	"JSLG"
+#define JSLOG_VERSION	2
+
+#define JSLOG_NAME_LENGTH	128
+#define JSLOG_DEVICES		16
+
+struct jslog_device {
+	int version;
+	unsigned char axes, buttons;
+	char name[JSLOG_NAME_LENGTH];
+	uint8_t axmap[AXMAP_SIZE];
+	uint16_t btnmap[BTNMAP_SIZE];
+};
+
+struct jslog {
+	FILE *f;
+	uint32_t time;		/* of the previous event */
+
+	int devices;
+	struct jslog_device dev[JSLOG_DEVICES];
+};
+
+/* Creates a log for the devices described in the log structure.
+   Returns -1 on error. */
+int jslog_create(struct jslog *log, const char *path);
+
+/* Appends n events from a device. */
+void jslog_write(struct jslog *log, int dev, const struct js_event *js,
+		 int n);
+
+/* Opens a log for reading and fills in the description of the devices.
+   Returns -1 on error. */
+int jslog_open(struct jslog *log, const char *path);
+
+/* Reads the next event. Returns the device it came from, or -1 at the
+   end of the log or on error. */
+int jslog_read(struct jslog *log, struct js_event *js);
+
+/* Flushes and closes the log. Returns -1 if anything failed. */
+int jslog_close(struct jslog *log);
+
+#endif
@@ -31,8 +31,12 @@
  * 02110-1301 USA.
  */
 
+#define _GNU_SOURCE
+
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 #include <stdlib.h>
 #include <fcntl.h>
@@ -42,11 +46,19 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdarg.h>
+#include <signal.h>
+#include <poll.h>
+#include <glob.h>
 
 #include <linux/input.h>
 #include <linux/joystick.h>
 
 #include "axbtnmap.h"
+#include "bitmaskros.h"
+#include "codenames.h"
+#include "histogram.h"
+#include "jslog.h"
 
 char *axis_names[ABS_MAX + 1] = {
 "X", "Y", "Z", "Rx", "Ry", "Rz", "Throttle", "Rudder", 
@@ -58,28 +70,1149 @@ char *axis_names[ABS_MAX + 1] = {
 char *button_names[KEY_MAX - BTN_MISC + 1] = {
 "Btn0", "Btn1", "Btn2", "Btn3", "Btn4", "Btn5", "Btn6", "Btn7", "Btn8", "Btn9", "?", "?", "?", "?", "?", "?",
 "LeftBtn", "RightBtn", "MiddleBtn", "SideBtn", "ExtraBtn", "ForwardBtn", "BackBtn", "TaskBtn", "?", "?", "?", "?", "?", "?", "?", "?",
-"Trigger", "ThumbBtn", "ThumbBtn2", "TopBtn", "TopBtn2", "PinkieBtn", "BaseBtn", "BaseBtn2", "BaseBtn3", "BaseBtn4", "BaseBtn5", "BaseBtn6", "BtnDead",
+"Trigger", "ThumbBtn", "ThumbBtn2", "TopBtn", "TopBtn2", "PinkieBtn", "BaseBtn", "BaseBtn2", "BaseBtn3", "BaseBtn4", "BaseBtn5", "BaseBtn6", "?", "?", "?", "BtnDead",
 "BtnA", "BtnB", "BtnC", "BtnX", "BtnY", "BtnZ", "BtnTL", "BtnTR", "BtnTL2", "BtnTR2", "BtnSelect", "BtnStart", "BtnMode", "BtnThumbL", "BtnThumbR", "?",
 "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", "?", 
 "WheelBtn", "Gear up",
 };
 
-#define NAME_LENGTH 128
+/*
+ * Names of axes and buttons: the short ones above, which scripts parse,
+ * else the kernel's for the codes they leave out, else "?".
+ */
+static const char *short_name(char * const *names, int first, int last,
+			      int type, int code)
+{
+	const char *name;
 
-int main (int argc, char **argv)
+	if (code >= first && code <= last && names[code - first] &&
+	    strcmp(names[code - first], "?"))
+		return names[code - first];
+	name = code_name(type, code);
+	return name ? name : "?";
+}
+
+static const char *axis_name(int code)
+{
+	return short_name(axis_names, 0, ABS_MAX, EV_ABS, code);
+}
+
+static const char *button_name(int code)
+{
+	return short_name(button_names, BTN_MISC, KEY_MAX, EV_KEY, code);
+}
+
+#define NAME_LENGTH JSLOG_NAME_LENGTH
+
+/* Events read at once when keeping up matters */
+#define EVENT_BATCH 256
+
+static volatile sig_atomic_t interrupted;
+
+static void interrupt(int sig)
+{
+	interrupted = 1;
+}
+
+/*
+ * Catches SIGINT and SIGTERM, which are blocked but for the returned
+ * mask: given to ppoll(), it lets them in only while waiting, so none
+ * can be missed.
+ */
+static void catch_interrupts(sigset_t *orig)
+{
+	struct sigaction sa;
+	sigset_t mask;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigprocmask(SIG_BLOCK, &mask, orig);
+}
+
+static void print_device(const struct jslog_device *dev)
 {
-	int fd, i;
-	unsigned char axes = 2;
-	unsigned char buttons = 2;
-	int version = 0x000800;
-	char name[NAME_LENGTH] = "Unknown";
-	uint16_t btnmap[BTNMAP_SIZE];
-	uint8_t axmap[AXMAP_SIZE];
 	int btnmapok = 1;
+	int i;
+
+	printf("Driver version is %d.%d.%d.\n",
+		dev->version >> 16, (dev->version >> 8) & 0xff,
+		dev->version & 0xff);
+
+	/* Determine whether the button map is usable. */
+	for (i = 0; btnmapok && i < dev->buttons; i++) {
+		if (dev->btnmap[i] < BTN_MISC || dev->btnmap[i] > KEY_MAX) {
+			btnmapok = 0;
+			break;
+		}
+	}
+	if (!btnmapok) {
+		/* btnmap out of range for names. Don't print any. */
+		puts("jstest is not fully compatible with your kernel. Unable to retrieve button map!");
+		printf("Joystick (%s) has %d axes ", dev->name, dev->axes);
+		printf("and %d buttons.\n", dev->buttons);
+	} else {
+		printf("Joystick (%s) has %d axes (", dev->name, dev->axes);
+		for (i = 0; i < dev->axes; i++)
+			printf("%s%s", i > 0 ? ", " : "", axis_name(dev->axmap[i]));
+		puts(")");
+
+		printf("and %d buttons (", dev->buttons);
+		for (i = 0; i < dev->buttons; i++) {
+			printf("%s%s", i > 0 ? ", " : "", button_name(dev->btnmap[i]));
+		}
+		puts(").");
+	}
+}
+
+/*
+ * Records events to a log until interrupted, reading them in batches so
+ * as to keep up with fast devices.
+ */
+static int record(int fd, struct jslog *log, const char *path)
+{
+	struct js_event js[EVENT_BATCH];
+	struct pollfd pfd = { fd, POLLIN };
+	sigset_t orig;
+	unsigned long count = 0;
+	ssize_t n;
+	int ret = 0;
+
+	if (jslog_create(log, path)) {
+		perror("jstest");
+		return 1;
+	}
+
+	catch_interrupts(&orig);
+
+	printf("Recording to %s ... (interrupt to stop)\n", path);
+	fflush(stdout);
+
+	while (!interrupted) {
+		if (ppoll(&pfd, 1, NULL, &orig) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("\njstest: error polling");
+			ret = 1;
+			break;
+		}
+
+		n = read(fd, js, sizeof(js));
+		if (n == 0)
+			break;
+		if (n < (ssize_t)sizeof(*js)) {
+			perror("\njstest: error reading");
+			ret = 1;
+			break;
+		}
+
+		jslog_write(log, 0, js, n / sizeof(*js));
+		count += n / sizeof(*js);
+	}
+
+	if (jslog_close(log)) {
+		perror("jstest: error writing log");
+		ret = 1;
+	}
+
+	printf("%lu events recorded.\n", count);
+
+	return ret;
+}
+
+/*
+ * Timing statistics, printed every STATS_PERIOD ms and at the end. The
+ * intervals between events come from their timestamps, which the
+ * driver keeps in ms; the delay of an event is how much later than
+ * the quickest one it got to us, compared to its timestamp, measured
+ * with CLOCK_MONOTONIC when read() returns, so it shows the jitter of
+ * the way from the driver to the application.
+ */
+
+#define STATS_PERIOD 1000
+
+struct stats {
+	struct histogram interval;	/* between events, in ms */
+	struct histogram delay;		/* beyond the quickest, in us */
+	struct histogram batch;		/* events per read() */
+	struct histogram *axis;		/* between updates of each axis, ms */
+	unsigned long buttons;
+};
+
+static long long clock_us(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long now_us(void)
+{
+	return clock_us(CLOCK_MONOTONIC);
+}
+
+/* Histograms hold 32 bits */
+static uint32_t clamp(long long v)
+{
+	return v < 0 ? 0 : v > UINT32_MAX ? UINT32_MAX : v;
+}
+
+static void stats_reset(struct stats *st, int axes)
+{
+	int i;
+
+	hist_reset(&st->interval);
+	hist_reset(&st->delay);
+	hist_reset(&st->batch);
+	for (i = 0; i < axes; i++)
+		hist_reset(&st->axis[i]);
+	st->buttons = 0;
+}
+
+static void stats_merge(struct stats *st, const struct stats *other, int axes)
+{
+	int i;
+
+	hist_merge(&st->interval, &other->interval);
+	hist_merge(&st->delay, &other->delay);
+	hist_merge(&st->batch, &other->batch);
+	for (i = 0; i < axes; i++)
+		hist_merge(&st->axis[i], &other->axis[i]);
+	st->buttons += other->buttons;
+}
+
+/* Prints the percentiles in ms of a histogram in ms / scale */
+static void print_percentiles(const char *what, const struct histogram *h,
+			      double scale)
+{
+	printf("  %-16s p50 %7.3f  p90 %7.3f  p99 %7.3f  p99.9 %7.3f  max %7.3f ms\n",
+		what, hist_percentile(h, 50) / scale,
+		hist_percentile(h, 90) / scale,
+		hist_percentile(h, 99) / scale,
+		hist_percentile(h, 99.9) / scale, h->max / scale);
+}
+
+static void print_stats(const struct stats *st, double seconds,
+			unsigned char axes, const uint8_t *axmap)
+{
+	char what[32];
+	int i;
+
+	printf("%.1f s: %lu events (%.0f/s), %lu reads of %.1f events, %lu button changes\n",
+		seconds, st->delay.count, st->delay.count / seconds,
+		st->batch.count, hist_mean(&st->batch), st->buttons);
+
+	if (st->interval.count)
+		print_percentiles("interval", &st->interval, 1);
+	if (st->delay.count)
+		print_percentiles("delay", &st->delay, 1000);
+
+	for (i = 0; i < axes; i++) {
+		if (!st->axis[i].count)
+			continue;
+		snprintf(what, sizeof(what), "%d:%s %.0f Hz", i,
+			 axis_name(axmap[i]),
+			 st->axis[i].count / seconds);
+		print_percentiles(what, &st->axis[i], 1);
+	}
+
+	fflush(stdout);
+}
+
+static int stats(int fd, unsigned char axes, const uint8_t *axmap)
+{
+	struct js_event js[EVENT_BATCH];
+	struct pollfd pfd = { fd, POLLIN };
+	struct stats period, total;
+	struct timespec timeout;
+	sigset_t orig;
+	long long start, last_report, now, left, offset, min_offset = 0;
+	uint32_t last_time = 0, *axis_time;
+	int have_time = 0, have_offset = 0;
+	ssize_t n;
+	int i, ret = 0;
+
+	period.axis = calloc(axes, sizeof(struct histogram));
+	total.axis = calloc(axes, sizeof(struct histogram));
+	axis_time = calloc(axes, sizeof(uint32_t));
+	if ((axes && (!period.axis || !total.axis || !axis_time))) {
+		perror("jstest");
+		return 1;
+	}
+	stats_reset(&period, axes);
+	stats_reset(&total, axes);
+
+	catch_interrupts(&orig);
+
+	printf("Measuring ... (interrupt to exit)\n");
+	fflush(stdout);
+
+	start = last_report = now_us();
+
+	while (!interrupted) {
+		now = now_us();
+		if (now - last_report >= STATS_PERIOD * 1000LL) {
+			print_stats(&period, (now - last_report) / 1e6, axes, axmap);
+			stats_merge(&total, &period, axes);
+			stats_reset(&period, axes);
+			last_report = now;
+		}
+
+		left = last_report + STATS_PERIOD * 1000LL - now;
+		timeout.tv_sec = left / 1000000;
+		timeout.tv_nsec = left % 1000000 * 1000;
+		if (ppoll(&pfd, 1, &timeout, &orig) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("\njstest: error polling");
+			ret = 1;
+			break;
+		}
+		if (!pfd.revents)
+			continue;
+
+		n = read(fd, js, sizeof(js));
+		now = now_us();
+		if (n == 0)
+			break;
+		if (n < (ssize_t)sizeof(*js)) {
+			perror("\njstest: error reading");
+			ret = 1;
+			break;
+		}
+		n /= sizeof(*js);
+
+		hist_add(&period.batch, n);
+
+		for (i = 0; i < n; i++) {
+			/* The initial state says nothing about timing */
+			if (js[i].type & JS_EVENT_INIT)
+				continue;
+
+			offset = now - js[i].time * 1000LL;
+			if (!have_offset || offset < min_offset) {
+				min_offset = offset;
+				have_offset = 1;
+			}
+			hist_add(&period.delay, clamp(offset - min_offset));
+
+			if (have_time)
+				hist_add(&period.interval, js[i].time - last_time);
+			last_time = js[i].time;
+			have_time = 1;
+
+			if (js[i].type == JS_EVENT_BUTTON) {
+				period.buttons++;
+			} else if (js[i].type == JS_EVENT_AXIS &&
+				   js[i].number < axes) {
+				if (axis_time[js[i].number])
+					hist_add(&period.axis[js[i].number],
+						 js[i].time - axis_time[js[i].number]);
+				/* 0 marks axes not seen yet */
+				axis_time[js[i].number] = js[i].time ? js[i].time : 1;
+			}
+		}
+	}
+
+	now = now_us();
+	stats_merge(&total, &period, axes);
+
+	printf("\nTotal over ");
+	print_stats(&total, (now - start) / 1e6, axes, axmap);
+	if (total.interval.count) {
+		printf("Intervals between events:\n");
+		hist_print(stdout, &total.interval, 1, "ms");
+	}
+	if (total.delay.count) {
+		printf("Delays:\n");
+		hist_print(stdout, &total.delay, 1000, "ms");
+	}
+
+	free(period.axis);
+	free(total.axis);
+	free(axis_time);
+
+	return ret;
+}
+
+/*
+ * Single line readouts of the state of joysticks. Events are read as
+ * fast as they come, but the readouts are redrawn at most REDRAW_RATE
+ * times a second, and on a terminal only the fields that changed are
+ * rewritten, moving the cursor to them. Readouts are wrapped to the
+ * width of the terminal here, short of the last column, so that where
+ * each field lies is known.
+ */
+
+#define REDRAW_RATE 60
+
+struct screen {
+	int width;			/* of the terminal, 0 if none */
+	int rows;			/* taken by the readouts */
+	int cursor;			/* row the cursor is on */
+	int drawn;			/* whether all of it is on screen */
+};
+
+struct readout {
+	const char *label;		/* shown first, if any */
+	unsigned char axes, buttons;
+	int *axis, *shown_axis;		/* as read, as last drawn */
+	char *button, *shown_button;
+};
+
+struct joystick {
+	int fd;
+	int error;			/* errno, once gone */
+	const char *path;
+	char label[32];
+	struct readout r;
+};
+
+static volatile sig_atomic_t resized;
+
+static void resize(int sig)
+{
+	resized = 1;
+}
+
+static int terminal_width(void)
+{
+	struct winsize ws;
+
+	if (!isatty(STDOUT_FILENO))
+		return 0;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) || !ws.ws_col)
+		return 80;
+
+	return ws.ws_col;
+}
+
+/* Puts a field at the next place on the screen: printed in turn when
+   drawing all of it, else only if it changed, after moving there */
+static void screen_put(struct screen *s, int *row, int *col,
+		       const char *text, int changed)
+{
+	int width = strlen(text);
+
+	if (s->width && *col && *col + width >= s->width) {
+		(*row)++;
+		*col = 0;
+		if (!s->drawn)
+			putchar('\n');
+	}
+
+	if (!s->drawn) {
+		fputs(text, stdout);
+		s->cursor = *row;
+	} else if (changed) {
+		if (*row < s->cursor)
+			printf("\033[%dA", s->cursor - *row);
+		else if (*row > s->cursor)
+			printf("\033[%dB", *row - s->cursor);
+		printf("\033[%dG%s", *col + 1, text);
+		s->cursor = *row;
+	}
+
+	*col += width;
+}
+
+/* Leaves the cursor on a new line below the readouts */
+static void screen_end(struct screen *s)
+{
+	if (s->width && s->drawn && s->cursor < s->rows - 1)
+		printf("\033[%dB", s->rows - 1 - s->cursor);
+	putchar('\n');
+	fflush(stdout);
+
+	s->drawn = 0;
+	s->cursor = 0;
+}
+
+static int readout_alloc(struct readout *r, const char *label,
+			 unsigned char axes, unsigned char buttons)
+{
+	r->label = label;
+	r->axes = axes;
+	r->buttons = buttons;
+	r->axis = calloc(axes, sizeof(int));
+	r->shown_axis = calloc(axes, sizeof(int));
+	r->button = calloc(buttons, sizeof(char));
+	r->shown_button = calloc(buttons, sizeof(char));
+
+	if ((axes && (!r->axis || !r->shown_axis)) ||
+	    (buttons && (!r->button || !r->shown_button)))
+		return -1;
+
+	return 0;
+}
+
+static void readout_free(struct readout *r)
+{
+	free(r->axis);
+	free(r->shown_axis);
+	free(r->button);
+	free(r->shown_button);
+}
+
+static void readout_update(struct readout *r, const struct js_event *js,
+			   int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		switch(js[i].type & ~JS_EVENT_INIT) {
+		case JS_EVENT_BUTTON:
+			if (js[i].number < r->buttons)
+				r->button[js[i].number] = js[i].value;
+			break;
+		case JS_EVENT_AXIS:
+			if (js[i].number < r->axes)
+				r->axis[js[i].number] = js[i].value;
+			break;
+		}
+	}
+}
+
+static void readout_draw(struct screen *s, struct readout *r,
+			 int *row, int *col)
+{
+	char text[16];
+	int i;
+
+	if (r->label)
+		screen_put(s, row, col, r->label, 0);
+
+	if (r->axes)
+		screen_put(s, row, col, "Axes: ", 0);
+	for (i = 0; i < r->axes; i++) {
+		snprintf(text, sizeof(text), "%2d:%6d ", i, r->axis[i]);
+		screen_put(s, row, col, text, r->axis[i] != r->shown_axis[i]);
+		r->shown_axis[i] = r->axis[i];
+	}
+
+	if (r->buttons)
+		screen_put(s, row, col, "Buttons: ", 0);
+	for (i = 0; i < r->buttons; i++) {
+		snprintf(text, sizeof(text), "%2d:%s ", i,
+			 r->button[i] ? "on " : "off");
+		screen_put(s, row, col, text,
+			   r->button[i] != r->shown_button[i]);
+		r->shown_button[i] = r->button[i];
+	}
+}
+
+/* Draws the readouts of the joysticks, each from a row of its own */
+static void screen_draw(struct screen *s, struct joystick *joy, int n)
+{
+	int i, row = 0, col = 0;
+
+	/* Without a terminal to move around in, they are drawn anew */
+	if (!s->width) {
+		putchar(n > 1 && s->drawn ? '\n' : '\r');
+		s->drawn = 0;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (col) {
+			row++;
+			col = 0;
+			if (!s->drawn)
+				putchar('\n');
+		}
+		readout_draw(s, &joy[i].r, &row, &col);
+	}
+
+	s->rows = row + 1;
+	s->drawn = 1;
+
+	fflush(stdout);
+}
+
+/*
+ * Shows the state of joysticks until interrupted, or until they are all
+ * gone, waiting for events from all of them at once. Their events are
+ * also added to the log, if any.
+ */
+static int monitor(struct joystick *joy, int n, struct jslog *log)
+{
+	struct js_event js[EVENT_BATCH];
+	struct epoll_event ev[JSLOG_DEVICES];
+	struct screen s;
+	struct sigaction sa;
+	sigset_t orig, mask;
+	long long now, next = 0;
+	int epfd, i, j, k, left = n, dirty = 0, ret = 0;
+	ssize_t len;
+
+	if ((epfd = epoll_create1(0)) < 0) {
+		perror("jstest");
+		return 1;
+	}
+	for (i = 0; i < n; i++) {
+		ev[0].events = EPOLLIN;
+		ev[0].data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, joy[i].fd, &ev[0])) {
+			perror("jstest");
+			close(epfd);
+			return 1;
+		}
+	}
+
+	memset(&s, 0, sizeof(s));
+	s.width = terminal_width();
+
+	catch_interrupts(&orig);
+
+	/* Resizes are only let in while waiting, as interrupts are */
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = resize;
+	sigaction(SIGWINCH, &sa, NULL);
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGWINCH);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	while (!interrupted && left) {
+		/* The terminal rewraps what is on it its own way, so the
+		   readouts are drawn anew below */
+		if (resized) {
+			resized = 0;
+			if (s.drawn) {
+				screen_end(&s);
+				dirty = 1;
+			}
+			s.width = terminal_width();
+		}
+
+		now = now_us();
+		if (dirty && now >= next) {
+			screen_draw(&s, joy, n);
+			next = now + 1000000 / REDRAW_RATE;
+			dirty = 0;
+		}
+
+		/* Wait for the next frame only if there is something to
+		   draw then */
+		k = epoll_pwait(epfd, ev, n,
+				dirty ? (next - now + 999) / 1000 : -1, &orig);
+		if (k < 0) {
+			if (errno == EINTR)
+				continue;
+			screen_end(&s);
+			perror("jstest: error polling");
+			ret = 1;
+			break;
+		}
+
+		for (j = 0; j < k; j++) {
+			i = ev[j].data.u32;
+
+			len = read(joy[i].fd, js, sizeof(js));
+			if (len <= 0) {
+				/* Unplugged, or at the end of a recording */
+				joy[i].error = len ? errno : 0;
+				epoll_ctl(epfd, EPOLL_CTL_DEL, joy[i].fd, NULL);
+				left--;
+				continue;
+			}
+			len /= sizeof(*js);
+
+			if (log)
+				jslog_write(log, i, js, len);
+			readout_update(&joy[i].r, js, len);
+			dirty = 1;
+		}
+	}
+
+	if (!ret) {
+		if (dirty)
+			screen_draw(&s, joy, n);
+		screen_end(&s);
+	}
+
+	for (i = 0; i < n; i++) {
+		if (joy[i].error) {
+			fprintf(stderr, "jstest: error reading %s: %s\n",
+				joy[i].path, strerror(joy[i].error));
+			ret = 1;
+		}
+	}
+
+	close(epfd);
+
+	return ret;
+}
+
+/*
+ * Opens a joystick and fills in its description; what the driver does
+ * not tell is left as for a 0.x driver.
+ */
+static int open_joystick(const char *path, struct jslog_device *dev)
+{
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -1;
+
+	memset(dev, 0, sizeof(*dev));
+	dev->version = 0x000800;
+	dev->axes = 2;
+	dev->buttons = 2;
+	strcpy(dev->name, "Unknown");
+
+	ioctl(fd, JSIOCGVERSION, &dev->version);
+	ioctl(fd, JSIOCGAXES, &dev->axes);
+	ioctl(fd, JSIOCGBUTTONS, &dev->buttons);
+	ioctl(fd, JSIOCGNAME(NAME_LENGTH), dev->name);
+	dev->name[NAME_LENGTH - 1] = 0;
+
+	getaxmap(fd, dev->axmap);
+	getbtnmap(fd, dev->btnmap);
+
+	return fd;
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strverscmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*
+ * Monitors several joysticks at once, all of them by default, and
+ * records their events to a single log if asked to.
+ */
+static int all(int argc, char **argv)
+{
+	static struct jslog log;
+	struct joystick joy[JSLOG_DEVICES];
+	const char *path = NULL, *base;
+	glob_t g;
+	int i, n, len, width = 0, ret;
+
+	if (argc && !strcmp("--record", argv[0])) {
+		path = argv[1];
+		argc -= 2;
+		argv += 2;
+	}
+
+	memset(&g, 0, sizeof(g));
+	if (!argc) {
+		if (glob("/dev/input/js*", 0, NULL, &g) || !g.gl_pathc) {
+			fprintf(stderr, "jstest: no joysticks found\n");
+			globfree(&g);
+			return 1;
+		}
+		qsort(g.gl_pathv, g.gl_pathc, sizeof(char *), compare_paths);
+		argc = g.gl_pathc;
+		argv = g.gl_pathv;
+	}
+
+	if (argc > JSLOG_DEVICES) {
+		fprintf(stderr, "jstest: can't monitor more than %d joysticks\n",
+			JSLOG_DEVICES);
+		globfree(&g);
+		return 1;
+	}
+
+	memset(joy, 0, sizeof(joy));
+	for (n = 0; n < argc; n++) {
+		if ((joy[n].fd = open_joystick(argv[n], &log.dev[n])) < 0) {
+			fprintf(stderr, "jstest: %s: %s\n", argv[n],
+				strerror(errno));
+			ret = 1;
+			goto out;
+		}
+		joy[n].path = argv[n];
+
+		base = strrchr(argv[n], '/') ? strrchr(argv[n], '/') + 1 : argv[n];
+		snprintf(joy[n].label, sizeof(joy[n].label), "%s", base);
+		if ((int)strlen(joy[n].label) > width)
+			width = strlen(joy[n].label);
+
+		printf("%s: ", argv[n]);
+		print_device(&log.dev[n]);
+	}
+	log.devices = n;
+
+	/* Labels are padded to line the readouts up */
+	for (i = 0; i < n; i++) {
+		len = strlen(joy[i].label);
+		snprintf(joy[i].label + len, sizeof(joy[i].label) - len,
+			 ":%*s", width - len + 1, "");
+		if (readout_alloc(&joy[i].r, joy[i].label, log.dev[i].axes,
+				  log.dev[i].buttons)) {
+			perror("jstest");
+			ret = 1;
+			goto out;
+		}
+	}
+
+	if (path) {
+		if (jslog_create(&log, path)) {
+			perror("jstest");
+			ret = 1;
+			goto out;
+		}
+		printf("Recording to %s ... (interrupt to stop)\n", path);
+	} else {
+		printf("Testing ... (interrupt to exit)\n");
+	}
+	fflush(stdout);
+
+	ret = monitor(joy, n, path ? &log : NULL);
+
+	if (path && jslog_close(&log)) {
+		perror("jstest: error writing log");
+		ret = 1;
+	}
+
+out:
+	for (i = 0; i < n; i++) {
+		readout_free(&joy[i].r);
+		close(joy[i].fd);
+	}
+	globfree(&g);
+
+	return ret;
+}
+
+/*
+ * Event device interface. Events are read from an evdev node in batches
+ * and printed a line per frame, that is per set of changes the device
+ * reports together, up to a SYN_REPORT. The latency of a frame is how
+ * old its timestamp is when read() returns; the kernel is asked to
+ * stamp events with CLOCK_MONOTONIC, so that it means something.
+ */
+
+#ifndef input_event_sec
+#define input_event_sec time.tv_sec
+#define input_event_usec time.tv_usec
+#endif
+
+#define FRAME_LENGTH 1024
+
+struct frame {
+	char text[FRAME_LENGTH];
+	int len;
+	int events;
+};
+
+static void frame_add(struct frame *f, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (f->len >= FRAME_LENGTH - 1)
+		return;
+
+	va_start(ap, fmt);
+	n = vsnprintf(f->text + f->len, FRAME_LENGTH - f->len, fmt, ap);
+	va_end(ap);
+
+	if (n > 0)
+		f->len += n;
+	if (f->len > FRAME_LENGTH - 1)
+		f->len = FRAME_LENGTH - 1;
+}
+
+static void frame_axis(struct frame *f, int code, int value)
+{
+	if (strcmp(axis_name(code), "?"))
+		frame_add(f, "%s%s %d", f->len ? ", " : "",
+			  axis_name(code), value);
+	else
+		frame_add(f, "%sAbs%d %d", f->len ? ", " : "", code, value);
+}
+
+static void frame_key(struct frame *f, int code, int value)
+{
+	static const char *state[] = { "off", "on", "repeat" };
+
+	if (strcmp(button_name(code), "?"))
+		frame_add(f, "%s%s %s", f->len ? ", " : "",
+			  button_name(code),
+			  state[value < 0 || value > 2 ? 1 : value]);
+	else
+		frame_add(f, "%sKey%d %s", f->len ? ", " : "", code,
+			  state[value < 0 || value > 2 ? 1 : value]);
+}
+
+/* Fills a frame with the whole state of the device, but for the keys
+   that are not held down */
+static void frame_state(struct frame *f, int fd, const unsigned char *absbits,
+			const unsigned char *keybits)
+{
+	unsigned char keys[KEY_MAX / 8 + 1];
+	struct input_absinfo abs;
+	int i;
+
+	for (i = 0; i <= ABS_MAX; i++)
+		if (testBit(i, absbits) && !ioctl(fd, EVIOCGABS(i), &abs))
+			frame_axis(f, i, abs.value);
+
+	memset(keys, 0, sizeof(keys));
+	ioctl(fd, EVIOCGKEY(sizeof(keys)), keys);
+	for (i = 0; i <= KEY_MAX; i++)
+		if (testBit(i, keybits) && (i >= BTN_MISC || testBit(i, keys)))
+			frame_key(f, i, testBit(i, keys));
+}
+
+static void print_evdev(int fd, int version, const char *name,
+			const unsigned char *absbits,
+			const unsigned char *keybits)
+{
+	struct input_absinfo abs;
+	int i, axes = 0, buttons = 0, keys = 0;
+
+	printf("Input driver version is %d.%d.%d.\n",
+		version >> 16, (version >> 8) & 0xff, version & 0xff);
+
+	for (i = 0; i <= ABS_MAX; i++)
+		axes += testBit(i, absbits);
+	for (i = 0; i <= KEY_MAX; i++) {
+		if (testBit(i, keybits)) {
+			if (i < BTN_MISC)
+				keys++;
+			else
+				buttons++;
+		}
+	}
+
+	printf("Device (%s) has %d axes%s\n", name, axes, axes ? ":" : "");
+	for (i = 0; i <= ABS_MAX; i++) {
+		if (!testBit(i, absbits) || ioctl(fd, EVIOCGABS(i), &abs))
+			continue;
+		printf("  %2d:%-9s min %6d  max %6d  fuzz %4d  flat %4d  resolution %d\n",
+			i, axis_name(i),
+			abs.minimum, abs.maximum, abs.fuzz, abs.flat,
+			abs.resolution);
+	}
+
+	printf("and %d buttons", buttons);
+	if (buttons) {
+		printf(" (");
+		for (i = BTN_MISC, buttons = 0; i <= KEY_MAX; i++) {
+			if (!testBit(i, keybits))
+				continue;
+			printf("%s%s", buttons++ ? ", " : "",
+				button_name(i));
+		}
+		printf(")");
+	}
+	if (keys)
+		printf(" and %d keys", keys);
+	puts(".");
+}
+
+static int evdev(const char *path)
+{
+	struct input_event ev[EVENT_BATCH];
+	struct pollfd pfd;
+	struct frame frame;
+	struct histogram latency, size;
+	unsigned char absbits[ABS_MAX / 8 + 1];
+	unsigned char keybits[KEY_MAX / 8 + 1];
+	char name[NAME_LENGTH] = "Unknown";
+	clockid_t clock = CLOCK_MONOTONIC;
+	sigset_t orig;
+	long long now, delay;
+	unsigned long drops = 0;
+	int fd, version, dropped = 0;
+	ssize_t n;
+	int i, ret = 0;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		perror("jstest");
+		return 1;
+	}
+	if (ioctl(fd, EVIOCGVERSION, &version)) {
+		fprintf(stderr, "jstest: %s: not an event device\n", path);
+		close(fd);
+		return 1;
+	}
+
+	memset(absbits, 0, sizeof(absbits));
+	memset(keybits, 0, sizeof(keybits));
+	ioctl(fd, EVIOCGNAME(sizeof(name)), name);
+	name[sizeof(name) - 1] = 0;
+	ioctl(fd, EVIOCGBIT(EV_ABS, sizeof(absbits)), absbits);
+	ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keybits)), keybits);
+
+	/* Older kernels stamp events with the wall clock only */
+	if (ioctl(fd, EVIOCSCLOCKID, &clock))
+		clock = CLOCK_REALTIME;
+
+	/* Frames are written out a batch at a time */
+	setvbuf(stdout, NULL, _IOFBF, BUFSIZ);
+
+	print_evdev(fd, version, name, absbits, keybits);
+
+	hist_reset(&latency);
+	hist_reset(&size);
+	memset(&frame, 0, sizeof(frame));
+
+	catch_interrupts(&orig);
+
+	printf("Testing ... (interrupt to exit)\n");
+	fflush(stdout);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (!interrupted) {
+		if (ppoll(&pfd, 1, NULL, &orig) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("jstest: error polling");
+			ret = 1;
+			break;
+		}
+
+		n = read(fd, ev, sizeof(ev));
+		now = clock_us(clock);
+		if (n == 0)
+			break;
+		if (n < (ssize_t)sizeof(*ev)) {
+			perror("jstest: error reading");
+			ret = 1;
+			break;
+		}
+		n /= sizeof(*ev);
+
+		for (i = 0; i < n; i++) {
+			switch (ev[i].type) {
+			case EV_SYN:
+				/* The kernel ran out of room: what is left of
+				   the frame is worthless, the state is asked
+				   for at the next one instead */
+				if (ev[i].code == SYN_DROPPED) {
+					dropped = 1;
+					drops++;
+					break;
+				}
+				if (ev[i].code != SYN_REPORT)
+					break;
+
+				if (dropped) {
+					frame.len = 0;
+					frame_state(&frame, fd, absbits, keybits);
+					printf("Events dropped, state now: %s\n",
+						frame.text);
+					dropped = 0;
+				} else if (frame.events) {
+					delay = now - (ev[i].input_event_sec * 1000000LL +
+						       ev[i].input_event_usec);
+					hist_add(&latency, clamp(delay));
+					hist_add(&size, frame.events);
+					printf("Frame: time %ld.%06ld, latency %.3f ms: %s\n",
+						(long)ev[i].input_event_sec,
+						(long)ev[i].input_event_usec,
+						delay / 1000.0, frame.text);
+				}
+				frame.len = 0;
+				frame.events = 0;
+				break;
+
+			case EV_ABS:
+				if (dropped)
+					break;
+				frame_axis(&frame, ev[i].code, ev[i].value);
+				frame.events++;
+				break;
+
+			case EV_KEY:
+				if (dropped)
+					break;
+				frame_key(&frame, ev[i].code, ev[i].value);
+				frame.events++;
+				break;
+			}
+		}
+
+		fflush(stdout);
+	}
+
+	printf("%lu frames of %.1f events, %lu drops\n",
+		latency.count, hist_mean(&size), drops);
+	if (latency.count) {
+		print_percentiles("latency", &latency, 1000);
+		printf("Latencies:\n");
+		hist_print(stdout, &latency, 1000, "ms");
+	}
+	fflush(stdout);
+
+	close(fd);
+
+	return ret;
+}
+
+/*
+ * Prints a recorded log, as --event would have.
+ */
+static int play(const char *path)
+{
+	static struct jslog log;
+	struct js_event js;
+	unsigned long count = 0;
+	uint32_t start = 0;
+	int i, dev;
+
+	if (jslog_open(&log, path)) {
+		fprintf(stderr, "jstest: %s: not a joystick event log\n", path);
+		return 1;
+	}
+
+	for (i = 0; i < log.devices; i++) {
+		if (log.devices > 1)
+			printf("Device %d: ", i);
+		print_device(&log.dev[i]);
+	}
+
+	while ((dev = jslog_read(&log, &js)) >= 0) {
+		if (!count++)
+			start = js.time;
+		if (log.devices > 1)
+			printf("Event: device %d, type %d, time %d, number %d, value %d\n",
+				dev, js.type, js.time, js.number, js.value);
+		else
+			printf("Event: type %d, time %d, number %d, value %d\n",
+				js.type, js.time, js.number, js.value);
+	}
+
+	printf("%lu events over %.3f s.\n", count,
+		count ? (uint32_t)(js.time - start) / 1000.0 : 0.0);
+
+	jslog_close(&log);
 
-	if (argc < 2 || argc > 3 || !strcmp("--help", argv[1])) {
+	return 0;
+}
+
+int main (int argc, char **argv)
+{
+	int fd;
+	static struct jslog log;
+	struct jslog_device *dev = &log.dev[0];
+
+	if (argc >= 2 && !strcmp("--all", argv[1]) &&
+	    (argc == 2 || strcmp("--record", argv[2]) || argc >= 4))
+		return all(argc - 2, argv + 2);
+
+	if (argc < 2 || argc > 4 || !strcmp("--help", argv[1]) ||
+	    !strcmp("--all", argv[1]) ||
+	    (argc == 4) != !strcmp("--record", argv[1]) ||
+	    (argc != 3 && !strcmp("--play", argv[1])) ||
+	    (argc != 3 && !strcmp("--evdev", argv[1]))) {
 		puts("");
 		puts("Usage: jstest [<mode>] <device>");
+		puts("       jstest --record <file> <device>");
+		puts("       jstest --play <file>");
+		puts("       jstest --evdev <event-device>");
+		puts("       jstest --all [--record <file>] [<device> ...]");
 		puts("");
 		puts("Modes:");
 		puts("  --normal           One-line mode showing immediate status");
@@ -87,49 +1220,44 @@ int main (int argc, char **argv)
 		puts("  --event            Prints events as they come in");
 		puts("  --nonblock         Same as --event, in nonblocking mode");
 		puts("  --select           Same as --event, using select() call");
+		puts("  --stats            Prints timing statistics every second");
+		puts("  --record <file>    Records events to a file");
+		puts("  --play <file>      Prints the events recorded in a file");
+		puts("  --all              --normal for several joysticks at once,");
+		puts("                     all of them unless given");
+		puts("  --evdev            Prints the frames of an event device, with");
+		puts("                     their latency");
 		puts("");
 		return 1;
 	}
-	if ((fd = open(argv[argc - 1], O_RDONLY)) < 0) {
+
+	if (!strcmp("--play", argv[1]))
+		return play(argv[2]);
+
+	if (!strcmp("--evdev", argv[1]))
+		return evdev(argv[2]);
+
+	if ((fd = open_joystick(argv[argc - 1], dev)) < 0) {
 		perror("jstest");
 		return 1;
 	}
+	log.devices = 1;
 
-	ioctl(fd, JSIOCGVERSION, &version);
-	ioctl(fd, JSIOCGAXES, &axes);
-	ioctl(fd, JSIOCGBUTTONS, &buttons);
-	ioctl(fd, JSIOCGNAME(NAME_LENGTH), name);
+	print_device(dev);
 
-	getaxmap(fd, axmap);
-	getbtnmap(fd, btnmap);
+/*
+ * Event interface, events recorded to a log.
+ */
 
-	printf("Driver version is %d.%d.%d.\n",
-		version >> 16, (version >> 8) & 0xff, version & 0xff);
+	if (!strcmp("--record", argv[1]))
+		return record(fd, &log, argv[2]);
 
-	/* Determine whether the button map is usable. */
-	for (i = 0; btnmapok && i < buttons; i++) {
-		if (btnmap[i] < BTN_MISC || btnmap[i] > KEY_MAX) {
-			btnmapok = 0;
-			break;
-		}
-	}
-	if (!btnmapok) {
-		/* btnmap out of range for names. Don't print any. */
-		puts("jstest is not fully compatible with your kernel. Unable to retrieve button map!");
-		printf("Joystick (%s) has %d axes ", name, axes);
-		printf("and %d buttons.\n", buttons);
-	} else {
-		printf("Joystick (%s) has %d axes (", name, axes);
-		for (i = 0; i < axes; i++)
-			printf("%s%s", i > 0 ? ", " : "", axis_names[axmap[i]]);
-		puts(")");
+/*
+ * Event interface, timing statistics.
+ */
 
-		printf("and %d buttons (", buttons);
-		for (i = 0; i < buttons; i++) {
-			printf("%s%s", i > 0 ? ", " : "", button_names[btnmap[i] - BTN_MISC]);
-		}
-		puts(").");
-	}
+	if (!strcmp("--stats", argv[1]))
+		return stats(fd, dev->axes, dev->axmap);
 
 	printf("Testing ... (interrupt to exit)\n");
 
@@ -137,7 +1265,7 @@ int main (int argc, char **argv)
  * Old (0.x) interface.
  */
 
-	if ((argc == 2 && version < 0x010000) || !strcmp("--old", argv[1])) {
+	if ((argc == 2 && dev->version < 0x010000) || !strcmp("--old", argv[1])) {
 
 		struct JS_DATA_TYPE js;
 
@@ -163,45 +1291,22 @@ int main (int argc, char **argv)
 
 	if (argc == 2 || !strcmp("--normal", argv[1])) {
 
-		int *axis;
-		char *button;
-		int i;
-		struct js_event js;
-
-		axis = calloc(axes, sizeof(int));
-		button = calloc(buttons, sizeof(char));
-
-		while (1) {
-			if (read(fd, &js, sizeof(struct js_event)) != sizeof(struct js_event)) {
-				perror("\njstest: error reading");
-				return 1;
-			}
-
-			switch(js.type & ~JS_EVENT_INIT) {
-			case JS_EVENT_BUTTON:
-				button[js.number] = js.value;
-				break;
-			case JS_EVENT_AXIS:
-				axis[js.number] = js.value;
-				break;
-			}
+		struct joystick joy;
+		int ret;
 
-			printf("\r");
-
-			if (axes) {
-				printf("Axes: ");
-				for (i = 0; i < axes; i++)
-					printf("%2d:%6d ", i, axis[i]);
-			}
+		memset(&joy, 0, sizeof(joy));
+		joy.fd = fd;
+		joy.path = argv[argc - 1];
+		if (readout_alloc(&joy.r, NULL, dev->axes, dev->buttons)) {
+			perror("jstest");
+			return 1;
+		}
 
-			if (buttons) {
-				printf("Buttons: ");
-				for (i = 0; i < buttons; i++)
-					printf("%2d:%s ", i, button[i] ? "on " : "off");
-			}
+		fflush(stdout);
+		ret = monitor(&joy, 1, NULL);
+		readout_free(&joy.r);
 
-			fflush(stdout);
-		}
+		return ret;
 	}
 
 
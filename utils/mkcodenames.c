@@ -0,0 +1,195 @@
+/*
+ * Generates the tables of the names of the input event codes (see
+ * codenames.h), written as C to standard output.
+ *
+ * Reads the definitions of the kernel headers, as the preprocessor
+ * lists them with -dD, in order: each KEY_, BTN_, ABS_ and REL_ macro
+ * whose value is a number, or another such name, names a code. The
+ * name of a code is the last one defined as a number, so that the
+ * first of a range (BTN_JOYSTICK) gives way to the code's own name
+ * (BTN_TRIGGER); aliases (BTN_A) can be looked up but aren't printed.
+ *
+ * The lookup by name is a perfect hash (see namehash.h).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <linux/input.h>
+
+#include "codenames.h"
+
+#define MAX_NAMES	4096
+#define MAX_NAME	64
+#define MAX_CODE	0x1000
+
+static const struct prefix {
+	const char *prefix;
+	const char *type;
+	unsigned short code;		/* of the type */
+	const char *table;
+} prefixes[] = {
+	{ "KEY_", "EV_KEY", EV_KEY, "key_names" },
+	{ "BTN_", "EV_KEY", EV_KEY, "key_names" },
+	{ "ABS_", "EV_ABS", EV_ABS, "abs_names" },
+	{ "REL_", "EV_REL", EV_REL, "rel_names" },
+};
+
+#define PREFIXES	(sizeof(prefixes) / sizeof(prefixes[0]))
+
+static struct name {
+	char name[MAX_NAME];
+	const struct prefix *prefix;
+	unsigned int code;
+	int alias;
+} names[MAX_NAMES];
+
+static int num_names;
+
+static int find_name(const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_names; i++)
+		if (!strcmp(names[i].name, name))
+			return i;
+
+	return -1;
+}
+
+/* Adds a definition, if it names a code */
+static void add_define(const char *name, const char *value)
+{
+	const struct prefix *p = NULL;
+	unsigned long code;
+	char *end;
+	int i, alias = 0;
+
+	for (i = 0; i < PREFIXES; i++)
+		if (!strncmp(name, prefixes[i].prefix, strlen(prefixes[i].prefix)))
+			p = &prefixes[i];
+
+	/* Not the bounds of the tables either */
+	if (!p || strlen(name) >= MAX_NAME || strstr(name, "_MIN_") ||
+	    (strlen(name) > 4 && (!strcmp(name + strlen(name) - 4, "_MAX") ||
+				  !strcmp(name + strlen(name) - 4, "_CNT"))))
+		return;
+
+	code = strtoul(value, &end, 0);
+	if (end == value || *end) {
+		if ((i = find_name(value)) < 0)
+			return;
+		code = names[i].code;
+		alias = 1;
+	}
+	if (code >= MAX_CODE)
+		return;
+
+	/* Redefined */
+	if ((i = find_name(name)) < 0) {
+		if (num_names == MAX_NAMES) {
+			fprintf(stderr, "mkcodenames: too many names\n");
+			exit(1);
+		}
+		i = num_names++;
+	}
+
+	strcpy(names[i].name, name);
+	names[i].prefix = p;
+	names[i].code = code;
+	names[i].alias = alias;
+}
+
+static void read_defines(FILE *f)
+{
+	char line[1024], name[256], value[256];
+
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "#define %255s %255s", name, value) == 2 &&
+		    !strchr(name, '('))
+			add_define(name, value);
+}
+
+static void print_names(const struct prefix *p, const char *size)
+{
+	const char *name[MAX_CODE];
+	int i, last = -1;
+
+	memset(name, 0, sizeof(name));
+	for (i = 0; i < num_names; i++)
+		if (!names[i].alias && names[i].prefix->code == p->code) {
+			name[names[i].code] = names[i].name;
+			if ((int)names[i].code > last)
+				last = names[i].code;
+		}
+
+	printf("#define %s\t%d\n\n", size, last + 1);
+	printf("static const char * const %s[%s] = {\n", p->table, size);
+	for (i = 0; i <= last; i++)
+		if (name[i])
+			printf("\t[0x%03x] = \"%s\",\n", i, name[i]);
+	printf("};\n\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const char *hashed[MAX_NAMES];
+	static unsigned short values[MAX_NAMES];
+	struct namehash_table t;
+	int i;
+
+	if (argc != 1) {
+		fprintf(stderr, "usage: cc -dD -E - <<< '#include <linux/input.h>' | mkcodenames\n");
+		return 1;
+	}
+
+	read_defines(stdin);
+	if (!num_names) {
+		fprintf(stderr, "mkcodenames: no event codes found\n");
+		return 1;
+	}
+
+	for (i = 0; i < num_names; i++) {
+		hashed[i] = names[i].name;
+		values[i] = i + 1;
+	}
+	if (namehash_build(&t, hashed, values, num_names)) {
+		fprintf(stderr, "mkcodenames: can't hash the names\n");
+		return 1;
+	}
+
+	printf("/* Generated from <linux/input.h> by mkcodenames, do not edit. */\n\n");
+
+	print_names(&prefixes[0], "CODENAMES_KEYS");
+	print_names(&prefixes[2], "CODENAMES_ABS");
+	print_names(&prefixes[3], "CODENAMES_REL");
+
+	printf("static const struct codename codenames[%d] = {\n", num_names);
+	for (i = 0; i < num_names; i++)
+		printf("\t{ \"%s\", %s, 0x%03x },\n", names[i].name,
+		       names[i].prefix->type, names[i].code);
+	printf("};\n\n");
+
+	namehash_print(&t, "codenames", "CODENAMES");
+
+	namehash_free(&t);
+	return 0;
+}
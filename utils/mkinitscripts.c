@@ -0,0 +1,410 @@
+/*
+ * Compiles the device initialization scripts of inputattach into a
+ * bytecode table (see initops.h), written as C to standard output.
+ *
+ * A script starts with "script <name>" and holds one instruction per
+ * line (which a trailing backslash continues), optionally preceded by
+ * a label ("<label>:"); a trailing ? on
+ * the instruction name marks a try. Numeric operands are C constant
+ * expressions without spaces, evaluated by the C compiler; strings
+ * ("...", with C escapes) and byte expressions may be mixed to give
+ * the bytes of a string operand. Everything following a # is ignored.
+ * Scripts implicitly end with "done".
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "initops.h"
+
+#define MAX_TOKENS	64
+#define MAX_INSNS	256
+#define MAX_LABELS	64
+#define MAX_SCRIPTS	64
+#define MAX_STRING	255
+
+#define OP(name, code, operands)	{ name, #code, operands }
+
+static const struct op {
+	const char *name;
+	const char *code;
+	const char *operands;
+} ops[INIT_OPS] = {
+	OP("done",	INIT_DONE,	""),
+	OP("fail",	INIT_FAIL,	""),
+	OP("send",	INIT_SEND,	"s"),
+	OP("expect",	INIT_EXPECT,	"ws"),
+	OP("scan",	INIT_SCAN,	"ws"),
+	OP("read",	INIT_READ,	"wbb"),
+	OP("sync",	INIT_SYNC,	"wbbb"),
+	OP("check",	INIT_CHECK,	"bbb"),
+	OP("ifeq",	INIT_IFEQ,	"bbbt"),
+	OP("ifne",	INIT_IFNE,	"bbbt"),
+	OP("sleep",	INIT_SLEEP,	"w"),
+	OP("setline",	INIT_SETLINE,	"ll"),
+	OP("dtr",	INIT_DTR,	"b"),
+	OP("discard",	INIT_DISCARD,	""),
+	OP("lineend",	INIT_LINEEND,	"bb"),
+	OP("getline",	INIT_GETLINE,	"w"),
+	OP("await",	INIT_AWAIT,	"wbs"),
+	OP("ifprefix",	INIT_IFPREFIX,	"st"),
+	OP("ifiprefix",	INIT_IFIPREFIX,	"st"),
+	OP("ifcontains", INIT_IFCONTAINS, "st"),
+	OP("ifok",	INIT_IFOK,	"t"),
+	OP("iffail",	INIT_IFFAIL,	"t"),
+	OP("count",	INIT_COUNT,	"b"),
+	OP("loop",	INIT_LOOP,	"t"),
+	OP("jump",	INIT_JUMP,	"t"),
+	OP("id",	INIT_ID,	"l"),
+	OP("extra",	INIT_EXTRA,	"l"),
+	OP("dump",	INIT_DUMP,	""),
+};
+
+struct insn {
+	const struct op *op;
+	int try;
+	int line;
+	int offset;
+	int ntokens;
+	char *tokens[MAX_TOKENS];
+};
+
+static const char *path;
+static int lineno;
+
+static struct insn insns[MAX_INSNS];
+static int num_insns;
+
+static struct {
+	char *name;
+	int offset;
+} labels[MAX_LABELS];
+static int num_labels;
+
+/* Entry points, printed after the table */
+static char *entries[MAX_SCRIPTS];
+static int num_entries;
+
+/* Offset of the current script in the table */
+static int base;
+
+static void fail(int line, const char *msg, const char *arg)
+{
+	fprintf(stderr, "mkinitscripts: %s:%d: %s%s%s\n", path, line, msg,
+		arg ? " " : "", arg ? arg : "");
+	exit(EXIT_FAILURE);
+}
+
+/* Decodes a string token into buf, returns its length */
+static int string_bytes(int line, const char *s, unsigned char *buf)
+{
+	char *end;
+	int len = 0;
+
+	for (s++; *s != '"'; s++) {
+		if (len == MAX_STRING)
+			fail(line, "string too long", NULL);
+		if (*s != '\\') {
+			buf[len++] = *s;
+			continue;
+		}
+		switch (*++s) {
+		case 'r': buf[len++] = '\r'; break;
+		case 'n': buf[len++] = '\n'; break;
+		case 't': buf[len++] = '\t'; break;
+		case 'x':
+			buf[len++] = strtoul(s + 1, &end, 16);
+			if (end == s + 1)
+				fail(line, "bad escape in", s - 1);
+			s = end - 1;
+			break;
+		default:
+			if (*s >= '0' && *s <= '7') {
+				buf[len++] = strtoul(s, &end, 8);
+				s = end - 1;
+			} else {
+				buf[len++] = *s;
+			}
+		}
+	}
+
+	return len;
+}
+
+/* Length of the string operand made of the given tokens */
+static int string_length(int line, char **tokens, int n)
+{
+	unsigned char buf[MAX_STRING];
+	int i, len = 0;
+
+	for (i = 0; i < n; i++)
+		len += tokens[i][0] == '"' ?
+			string_bytes(line, tokens[i], buf) : 1;
+
+	if (len > MAX_STRING)
+		fail(line, "string too long", NULL);
+
+	return len;
+}
+
+/* Splits a line into tokens, keeping quoted strings and characters */
+static int tokenize(char *s, char **tokens)
+{
+	int n = 0;
+	char quote;
+
+	for (;;) {
+		while (isspace((unsigned char)*s))
+			*s++ = 0;
+		if (!*s || *s == '#') {
+			*s = 0;
+			return n;
+		}
+		if (n == MAX_TOKENS)
+			fail(lineno, "too many operands", NULL);
+		tokens[n++] = s;
+
+		while (*s && !isspace((unsigned char)*s)) {
+			if (*s != '"' && *s != '\'') {
+				s++;
+				continue;
+			}
+			for (quote = *s++; *s != quote; s++) {
+				if (!*s)
+					fail(lineno, "unterminated string", NULL);
+				if (*s == '\\' && s[1])
+					s++;
+			}
+			s++;
+		}
+	}
+}
+
+static int find_label(int line, const char *name)
+{
+	int i;
+
+	for (i = 0; i < num_labels; i++)
+		if (!strcmp(labels[i].name, name))
+			return labels[i].offset;
+
+	fail(line, "unknown label", name);
+	return -1;
+}
+
+/* Size of an instruction in bytes; checks its operands */
+static int insn_size(struct insn *in)
+{
+	const char *o;
+	int size = 1, n = in->ntokens, fixed = strlen(in->op->operands);
+
+	for (o = in->op->operands; *o; o++) {
+		switch (*o) {
+		case 'b': size += 1; break;
+		case 'w': case 't': size += 2; break;
+		case 'l': size += 4; break;
+		case 's':
+			/* Takes whatever the other operands leave */
+			if (n < fixed)
+				fail(in->line, "missing operands for", in->op->name);
+			size += 1 + string_length(in->line,
+				in->tokens + (o - in->op->operands),
+				n - fixed + 1);
+			n = fixed;
+			break;
+		}
+	}
+
+	if (n != fixed)
+		fail(in->line, "wrong number of operands for", in->op->name);
+
+	return size;
+}
+
+static void emit_insn(struct insn *in)
+{
+	unsigned char buf[MAX_STRING];
+	char **t = in->tokens;
+	const char *o;
+	int i, j, n, len;
+
+	printf("\t/* %4d */ %s%s,", in->offset - base, in->op->code,
+	       in->try ? " | INIT_TRY" : "");
+
+	for (o = in->op->operands; *o; o++) {
+		switch (*o) {
+		case 'b': printf(" INIT_B(%s),", *t++); break;
+		case 'w': printf(" INIT_W(%s),", *t++); break;
+		case 'l': printf(" INIT_L(%s),", *t++); break;
+		case 't':
+			printf(" INIT_W(%d),", find_label(in->line, *t++));
+			break;
+		case 's':
+			n = in->ntokens - strlen(in->op->operands) + 1;
+			printf(" %d,", string_length(in->line, t, n));
+			for (i = 0; i < n; i++, t++) {
+				if (**t != '"') {
+					printf(" INIT_B(%s),", *t);
+					continue;
+				}
+				len = string_bytes(in->line, *t, buf);
+				for (j = 0; j < len; j++)
+					printf(" 0x%02x,", buf[j]);
+			}
+			break;
+		}
+	}
+
+	printf("\n");
+}
+
+static void end_script(char *name, int *offset)
+{
+	char *c;
+	int i, j;
+
+	if (!name)
+		return;
+
+	memset(&insns[num_insns], 0, sizeof(*insns));
+	insns[num_insns].op = &ops[INIT_DONE];
+	insns[num_insns++].offset = (*offset)++;
+
+	printf("\t/* %s */\n", name);
+	for (i = 0; i < num_insns; i++)
+		emit_insn(&insns[i]);
+
+	for (c = name; *c; c++)
+		*c = *c == '-' ? '_' : toupper((unsigned char)*c);
+	if (num_entries == MAX_SCRIPTS)
+		fail(lineno, "too many scripts", NULL);
+	if (asprintf(&entries[num_entries++],
+		     "#define INIT_SCRIPT_%s\t(init_scripts + %d)\n",
+		     name, base) < 0)
+		fail(lineno, "out of memory", NULL);
+
+	for (i = 0; i < num_labels; i++)
+		free(labels[i].name);
+	for (i = 0; i < num_insns; i++)
+		for (j = 0; j < insns[i].ntokens; j++)
+			free(insns[i].tokens[j]);
+	num_labels = num_insns = 0;
+	base = *offset;
+}
+
+int main(int argc, char **argv)
+{
+	char buf[1024], *tokens[MAX_TOKENS], *name = NULL, *c;
+	struct insn *in;
+	FILE *f;
+	int n, i, len, offset = 0;
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: mkinitscripts <scripts>\n");
+		return EXIT_FAILURE;
+	}
+
+	path = argv[1];
+	if (!(f = fopen(path, "r"))) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	printf("/* Generated from %s by mkinitscripts, do not edit. */\n\n",
+	       path);
+	printf("static const unsigned char init_scripts[] = {\n");
+
+	while (fgets(buf, sizeof(buf), f)) {
+		lineno++;
+		while ((len = strlen(buf)) > 1 && buf[len - 2] == '\\' &&
+		       fgets(buf + len - 2, sizeof(buf) - len + 2, f))
+			lineno++;
+		n = tokenize(buf, tokens);
+		if (!n)
+			continue;
+
+		if (!strcmp(tokens[0], "script")) {
+			if (n != 2)
+				fail(lineno, "script needs a name", NULL);
+			end_script(name, &offset);
+			free(name);
+			name = strdup(tokens[1]);
+			continue;
+		}
+
+		if (!name)
+			fail(lineno, "instruction outside of a script", NULL);
+
+		c = tokens[0] + strlen(tokens[0]) - 1;
+		if (*c == ':') {
+			*c = 0;
+			for (i = 0; i < num_labels; i++)
+				if (!strcmp(labels[i].name, tokens[0]))
+					fail(lineno, "duplicate label", tokens[0]);
+			if (num_labels == MAX_LABELS)
+				fail(lineno, "too many labels", NULL);
+			labels[num_labels].name = strdup(tokens[0]);
+			labels[num_labels++].offset = offset - base;
+			memmove(tokens, tokens + 1, --n * sizeof(*tokens));
+			if (!n)
+				continue;
+		}
+
+		if (num_insns == MAX_INSNS - 1)
+			fail(lineno, "script too long", NULL);
+		in = &insns[num_insns++];
+		memset(in, 0, sizeof(*in));
+		in->line = lineno;
+		in->offset = offset;
+
+		c = tokens[0] + strlen(tokens[0]) - 1;
+		if (*c == '?') {
+			*c = 0;
+			in->try = 1;
+		}
+		for (i = 0; i < INIT_OPS; i++)
+			if (!strcmp(ops[i].name, tokens[0]))
+				in->op = &ops[i];
+		if (!in->op)
+			fail(lineno, "unknown instruction", tokens[0]);
+
+		in->ntokens = n - 1;
+		for (i = 1; i < n; i++)
+			in->tokens[i - 1] = strdup(tokens[i]);
+
+		offset += insn_size(in);
+		if (offset - base > 0xffff)
+			fail(lineno, "script too long", NULL);
+	}
+
+	end_script(name, &offset);
+	free(name);
+	fclose(f);
+
+	printf("};\n\n");
+
+	for (i = 0; i < num_entries; i++) {
+		fputs(entries[i], stdout);
+		free(entries[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+/*
+ * Builds the perfect hash tables of names (see namehash.h), for the
+ * programs which generate them at build time.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "namehash.h"
+
+#define MAX_SEED	0xffff
+
+/* Names per bucket, on average */
+#define BUCKET_SIZE	4
+
+/* Finds the seed of each bucket; returns -1 if one has none */
+static int place(struct namehash_table *t, const char * const *names,
+		 const unsigned short *values, int n, unsigned int *bucket)
+{
+	int *size, *order, i, j, k, b, m;
+	unsigned int s, taken[BUCKET_SIZE * 8];
+	int ret = 0;
+
+	size = calloc(t->buckets, sizeof(int));
+	order = malloc(t->buckets * sizeof(int));
+	memset(t->slot, 0, t->slots * sizeof(*t->slot));
+
+	for (i = 0; i < n; i++) {
+		bucket[i] = namehash(names[i], 0) % t->buckets;
+		size[bucket[i]]++;
+	}
+
+	/* Fullest buckets first, while there is room */
+	for (i = 0; i < t->buckets; i++)
+		order[i] = i;
+	for (i = 1; i < t->buckets; i++)
+		for (j = i; j > 0 && size[order[j]] > size[order[j - 1]]; j--) {
+			b = order[j];
+			order[j] = order[j - 1];
+			order[j - 1] = b;
+		}
+
+	for (i = 0; i < t->buckets; i++) {
+		b = order[i];
+		t->seed[b] = 0;
+		if (!size[b])
+			continue;
+		if (size[b] > sizeof(taken) / sizeof(taken[0])) {
+			ret = -1;
+			break;
+		}
+
+		for (s = 1; s <= MAX_SEED; s++) {
+			for (j = 0, m = 0; j < n; j++) {
+				if (bucket[j] != b)
+					continue;
+				taken[m] = namehash(names[j], s) % t->slots;
+				if (t->slot[taken[m]])
+					break;
+				for (k = 0; k < m && taken[k] != taken[m]; k++)
+					;
+				if (k < m)
+					break;
+				m++;
+			}
+			if (j == n)
+				break;
+		}
+		if (s > MAX_SEED) {
+			ret = -1;
+			break;
+		}
+
+		t->seed[b] = s;
+		for (j = 0; j < n; j++)
+			if (bucket[j] == b)
+				t->slot[namehash(names[j], s) % t->slots] = values[j];
+	}
+
+	free(size);
+	free(order);
+	return ret;
+}
+
+int namehash_build(struct namehash_table *t, const char * const *names,
+		   const unsigned short *values, int n)
+{
+	unsigned int *bucket = malloc((n + 1) * sizeof(*bucket));
+
+	/* One slot per name would do, but some room finds seeds faster */
+	t->buckets = (n + BUCKET_SIZE - 1) / BUCKET_SIZE + 1;
+	t->slots = n + n / 4 + 1;
+	t->seed = malloc(t->buckets * sizeof(*t->seed));
+	t->slot = NULL;
+
+	for (;;) {
+		t->slot = realloc(t->slot, t->slots * sizeof(*t->slot));
+		if (!place(t, names, values, n, bucket))
+			break;
+		t->slots += n / 8 + 1;
+
+		/* Names which only differ by case never part */
+		if (t->slots > 4 * n + 64) {
+			free(bucket);
+			return -1;
+		}
+	}
+
+	free(bucket);
+	return 0;
+}
+
+static void print_array(const char *array, const unsigned short *v,
+			unsigned int n)
+{
+	int i;
+
+	printf("static const unsigned short %s[%u] = {", array, n);
+	for (i = 0; i < n; i++)
+		printf("%s%4u,", i % 12 ? " " : "\n\t", v[i]);
+	printf("\n};\n\n");
+}
+
+void namehash_print(const struct namehash_table *t, const char *array,
+		    const char *macro)
+{
+	char name[64];
+
+	printf("#define %s_BUCKETS\t%u\n", macro, t->buckets);
+	printf("#define %s_SLOTS\t%u\n\n", macro, t->slots);
+	snprintf(name, sizeof(name), "%s_seed", array);
+	print_array(name, t->seed, t->buckets);
+	snprintf(name, sizeof(name), "%s_slot", array);
+	print_array(name, t->slot, t->slots);
+}
+
+void namehash_free(struct namehash_table *t)
+{
+	free(t->seed);
+	free(t->slot);
+}
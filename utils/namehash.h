@@ -0,0 +1,74 @@
+/*
+ * Perfect hashes of names, for looking them up in generated tables.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __NAMEHASH_H__
+#define __NAMEHASH_H__
+
+/*
+ * "Hash and displace": the names are hashed into buckets of about four,
+ * and the buckets, the fullest first, each get the seed for which the
+ * second hash puts their names in free slots. A name is looked up by
+ * hashing it once to find its bucket's seed, and once more with that
+ * seed to find the one slot it can be in:
+ *
+ *	seed = X_seed[namehash(name, 0) % X_BUCKETS];
+ *	value = X_slot[namehash(name, seed) % X_SLOTS];
+ *
+ * A name that isn't there lands in some slot all the same, so the name
+ * the value stands for must be compared; 0 is an empty slot.
+ */
+
+/* The hash of a name, ignoring case, with a seed */
+static inline unsigned int namehash(const char *s, unsigned int seed)
+{
+	unsigned int h = 2166136261u ^ (seed * 0x9e3779b9u);
+	unsigned char c;
+
+	for (; (c = *s); s++) {
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 16777619u;
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+
+	return h;
+}
+
+/* The tables, for the generators (namehash.o) */
+struct namehash_table {
+	unsigned int buckets, slots;
+	unsigned short *seed, *slot;
+};
+
+/* Hashes n names, which mustn't differ only by case: each one's slot
+   holds its value, which mustn't be 0. Returns -1 if no seeds were
+   found. */
+int namehash_build(struct namehash_table *t, const char * const *names,
+		   const unsigned short *values, int n);
+
+/* Writes the tables as C to standard output: array_seed and array_slot,
+   sized by MACRO_BUCKETS and MACRO_SLOTS. */
+void namehash_print(const struct namehash_table *t, const char *array,
+		    const char *macro);
+
+void namehash_free(struct namehash_table *t);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * Buffered, non-blocking serial line I/O.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/uio.h>
+
+#include "serbuf.h"
+#include "serlog.h"
+
+#define RX_MASK (SERBUF_RX_SIZE - 1)
+
+#define RETRY_ERROR(x) (x == EAGAIN || x == EWOULDBLOCK || x == EINTR)
+
+long ser_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void ser_init(struct serbuf *b, int fd)
+{
+	struct serlog *log = b->log;
+
+	memset(b, 0, sizeof(*b));
+	b->fd = fd;
+	b->log = log;
+	b->deadline = ser_now();
+}
+
+void ser_timeout(struct serbuf *b, int timeout)
+{
+	b->timeout = timeout;
+	b->deadline = ser_now() + timeout;
+	b->matched = 0;
+}
+
+/* Called by the waits when they have made progress */
+static void ser_progress(struct serbuf *b)
+{
+	b->deadline = ser_now() + b->timeout;
+}
+
+/* Ends the current wait */
+static int ser_done(struct serbuf *b, int ret)
+{
+	b->last = b->matched;
+	b->matched = 0;
+
+	return ret;
+}
+
+static int ser_expired(struct serbuf *b)
+{
+	return ser_now() >= b->deadline;
+}
+
+int ser_fill(struct serbuf *b)
+{
+	struct iovec iov[2];
+	unsigned int pos, space;
+	ssize_t n;
+
+	for (;;) {
+		if (b->rx_tail - b->rx_head == SERBUF_RX_SIZE) {
+			/* Nobody is listening, keep the most recent half */
+			b->rx_head += SERBUF_RX_SIZE / 2;
+		}
+
+		pos = b->rx_tail & RX_MASK;
+		space = SERBUF_RX_SIZE - (b->rx_tail - b->rx_head);
+
+		iov[0].iov_base = b->rx + pos;
+		iov[0].iov_len = SERBUF_RX_SIZE - pos < space ?
+				 SERBUF_RX_SIZE - pos : space;
+		iov[1].iov_base = b->rx;
+		iov[1].iov_len = space - iov[0].iov_len;
+
+		n = readv(b->fd, iov, 2);
+		if (n > 0) {
+			if (b->log)
+				serlog_record(b->log, SERLOG_RX,
+					      iov[0].iov_base,
+					      n < iov[0].iov_len ? n : iov[0].iov_len,
+					      iov[1].iov_base,
+					      n < iov[0].iov_len ? 0 : n - iov[0].iov_len);
+			b->rx_tail += n;
+			b->rx_bytes += n;
+		}
+		else if (n < 0 && RETRY_ERROR(errno))
+			return 0;
+		else
+			return -1;
+	}
+}
+
+int ser_flush(struct serbuf *b)
+{
+	ssize_t n;
+
+	while (b->tx_len) {
+		n = write(b->fd, b->tx, b->tx_len);
+		if (n < 0)
+			return RETRY_ERROR(errno) ? SER_PENDING : -1;
+		if (b->log)
+			serlog_record(b->log, SERLOG_TX, b->tx, n, NULL, 0);
+		b->tx_bytes += n;
+		memmove(b->tx, b->tx + n, b->tx_len - n);
+		b->tx_len -= n;
+	}
+
+	return 0;
+}
+
+int ser_write(struct serbuf *b, const void *buf, int len)
+{
+	if (len > SERBUF_TX_SIZE - b->tx_len)
+		return -1;
+
+	memcpy(b->tx + b->tx_len, buf, len);
+	b->tx_len += len;
+
+	return ser_flush(b) < 0 ? -1 : 0;
+}
+
+int ser_events(struct serbuf *b)
+{
+	return POLLIN | (b->tx_len ? POLLOUT : 0);
+}
+
+unsigned int ser_avail(struct serbuf *b)
+{
+	return b->rx_tail - b->rx_head;
+}
+
+void ser_discard(struct serbuf *b)
+{
+	b->rx_head = b->rx_tail;
+}
+
+int ser_getc(struct serbuf *b, unsigned char *c)
+{
+	if (ser_avail(b)) {
+		*c = b->rx[b->rx_head++ & RX_MASK];
+		return 0;
+	}
+
+	return ser_expired(b) ? -1 : SER_PENDING;
+}
+
+int ser_sleep(struct serbuf *b)
+{
+	return ser_expired(b) ? 0 : SER_PENDING;
+}
+
+int ser_read(struct serbuf *b, void *buf, int len)
+{
+	unsigned char *p = buf;
+
+	if (ser_avail(b) && b->matched < len) {
+		while (ser_avail(b) && b->matched < len)
+			p[b->matched++] = b->rx[b->rx_head++ & RX_MASK];
+		ser_progress(b);
+	}
+
+	if (b->matched == len)
+		return ser_done(b, 0);
+
+	return ser_expired(b) ? ser_done(b, -1) : SER_PENDING;
+}
+
+int ser_expect(struct serbuf *b, const void *pattern, int len)
+{
+	const unsigned char *p = pattern;
+
+	if (ser_avail(b) && b->matched < len) {
+		while (ser_avail(b) && b->matched < len)
+			if (b->rx[b->rx_head++ & RX_MASK] != p[b->matched++])
+				return ser_done(b, -1);
+		ser_progress(b);
+	}
+
+	if (b->matched == len)
+		return ser_done(b, 0);
+
+	return ser_expired(b) ? ser_done(b, -1) : SER_PENDING;
+}
+
+/*
+ * After a mismatch, how much of the pattern is still matched: the
+ * longest start of it that the bytes just matched, followed by c, end
+ * with. Falling back to the first byte alone would miss a pattern that
+ * overlaps itself, like "AAB" in "AAAB". Patterns are short, so this is
+ * worked out as needed rather than tabled.
+ */
+static int scan_fallback(const unsigned char *p, int matched, unsigned char c)
+{
+	int k;
+
+	for (k = matched; k > 0; k--)
+		if (p[k - 1] == c && !memcmp(p, p + matched - k + 1, k - 1))
+			return k;
+
+	return 0;
+}
+
+int ser_scan(struct serbuf *b, const void *pattern, int len)
+{
+	const unsigned char *p = pattern;
+	unsigned char c;
+
+	if (ser_avail(b) && b->matched < len) {
+		while (ser_avail(b) && b->matched < len) {
+			c = b->rx[b->rx_head++ & RX_MASK];
+			if (c == p[b->matched])
+				b->matched++;
+			else
+				b->matched = scan_fallback(p, b->matched, c);
+		}
+		ser_progress(b);
+	}
+
+	if (b->matched == len)
+		return ser_done(b, 0);
+
+	return ser_expired(b) ? ser_done(b, -1) : SER_PENDING;
+}
+
+int ser_getline(struct serbuf *b, unsigned char term, int skip,
+		char *buf, int size)
+{
+	unsigned char c;
+
+	if (!ser_avail(b)) {
+		buf[b->matched] = 0;
+		return ser_expired(b) ? ser_done(b, -1) : SER_PENDING;
+	}
+
+	while (ser_avail(b)) {
+		c = b->rx[b->rx_head++ & RX_MASK];
+		if (c == skip)
+			continue;
+		if (b->matched < size - 1)
+			buf[b->matched++] = c;
+		if (c == term) {
+			buf[b->matched] = 0;
+			return ser_done(b, 0);
+		}
+	}
+
+	buf[b->matched] = 0;
+	ser_progress(b);
+
+	return SER_PENDING;
+}
+
+int ser_matched(struct serbuf *b)
+{
+	return b->last;
+}
+
+int ser_wait(struct serbuf *b)
+{
+	struct pollfd pfd;
+	long timeout;
+
+	pfd.fd = b->fd;
+	pfd.events = ser_events(b);
+
+	timeout = b->deadline - ser_now();
+	if (poll(&pfd, 1, timeout > 0 ? timeout : 0) <= 0)
+		return 0;
+
+	if ((pfd.revents & POLLOUT) && ser_flush(b) < 0)
+		return -1;
+	if (pfd.revents & (POLLIN | POLLHUP | POLLERR))
+		return ser_fill(b);
+
+	return 0;
+}
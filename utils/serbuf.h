@@ -0,0 +1,127 @@
+/*
+ * Buffered, non-blocking serial line I/O.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SERBUF_H__
+#define __SERBUF_H__
+
+struct serlog;
+
+/* Receive ring and transmit queue sizes; the former must be a power
+   of two. */
+#define SERBUF_RX_SIZE 512
+#define SERBUF_TX_SIZE 256
+
+/* Returned by the waiting functions below while they are neither done
+   nor timed out: the caller should come back once the line has more
+   input or the deadline has passed. */
+#define SER_PENDING 1
+
+/* A serial line, its buffers and its current deadline. Input is read
+   in bulk into the ring by ser_fill(); output is queued and written
+   in bulk by ser_flush(). The waiting functions never block, they
+   consume whatever is buffered and report SER_PENDING otherwise, so
+   that any number of lines can be driven from one poll()/epoll()
+   loop (ser_wait() provides that loop for a single line). */
+struct serbuf {
+	int fd;
+	long deadline;		/* CLOCK_MONOTONIC, in ms */
+	int timeout;		/* inter-byte timeout of the current wait */
+
+	unsigned char rx[SERBUF_RX_SIZE];
+	unsigned int rx_head, rx_tail;	/* free-running indices */
+
+	unsigned char tx[SERBUF_TX_SIZE];
+	int tx_len;
+
+	int matched;		/* progress of the current wait */
+	int last;		/* progress of the previous wait */
+
+	unsigned long rx_bytes, tx_bytes;	/* since ser_init() */
+
+	struct serlog *log;	/* if set, all traffic is recorded there */
+};
+
+/* Returns the current CLOCK_MONOTONIC time in milliseconds. */
+long ser_now(void);
+
+/* Resets the buffers of the given line, which uses the given file
+   descriptor (opened with O_NONBLOCK). The log is kept. */
+void ser_init(struct serbuf *b, int fd);
+
+/* Sets the deadline for the next wait to timeout ms from now. The
+   deadline is pushed back by the same amount whenever a wait makes
+   progress, so timeouts are between bytes rather than overall. */
+void ser_timeout(struct serbuf *b, int timeout);
+
+/* Reads everything available on the line into the receive ring,
+   discarding the oldest data if nobody consumes it. Returns -1 if the
+   line hung up or failed, 0 otherwise. */
+int ser_fill(struct serbuf *b);
+
+/* Queues the given bytes and writes as much of the queue as the line
+   will take. Returns -1 on error or if the queue overflows. */
+int ser_write(struct serbuf *b, const void *buf, int len);
+
+/* Writes as much of the transmit queue as possible. Returns -1 on
+   error, SER_PENDING if some output is still queued, 0 otherwise. */
+int ser_flush(struct serbuf *b);
+
+/* Returns the poll() events the line is currently waiting for. */
+int ser_events(struct serbuf *b);
+
+/* Number of bytes in the receive ring. */
+unsigned int ser_avail(struct serbuf *b);
+
+/* Drops everything received so far. */
+void ser_discard(struct serbuf *b);
+
+/* Takes one byte from the receive ring. */
+int ser_getc(struct serbuf *b, unsigned char *c);
+
+/* Waits until the deadline has passed; returns 0 then. */
+int ser_sleep(struct serbuf *b);
+
+/* Waits for len bytes and stores them in buf. On timeout, returns -1
+   with whatever was received stored at the start of buf and its
+   length available through ser_matched(). */
+int ser_read(struct serbuf *b, void *buf, int len);
+
+/* Waits for the line to produce exactly the given bytes. Fails as
+   soon as a byte differs from the pattern. */
+int ser_expect(struct serbuf *b, const void *pattern, int len);
+
+/* Waits for the given bytes to turn up, skipping anything before
+   them. */
+int ser_scan(struct serbuf *b, const void *pattern, int len);
+
+/* Waits for a response terminated by the given byte, storing it
+   (terminator included, NUL-terminated) in buf, which holds size
+   bytes. Bytes equal to skip are dropped. On timeout, returns -1 with
+   the partial response in buf. */
+int ser_getline(struct serbuf *b, unsigned char term, int skip,
+		char *buf, int size);
+
+/* Number of bytes matched or read by the last wait. */
+int ser_matched(struct serbuf *b);
+
+/* Blocks in poll() until the line has input, can take queued output,
+   or its deadline has passed, and reads the input. Returns -1 if the
+   line hung up or failed. */
+int ser_wait(struct serbuf *b);
+
+#endif
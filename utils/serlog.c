@@ -0,0 +1,142 @@
+/*
+ * Serial session logs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include <time.h>
+
+#include "serlog.h"
+
+static long long serlog_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void put_varint(FILE *f, unsigned long v)
+{
+	while (v >= 0x80) {
+		putc((v & 0x7f) | 0x80, f);
+		v >>= 7;
+	}
+	putc(v, f);
+}
+
+static int get_varint(FILE *f, unsigned long *v)
+{
+	int c, shift = 0;
+
+	*v = 0;
+	do {
+		if ((c = getc(f)) == EOF || shift > 28)
+			return -1;
+		*v |= (unsigned long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+int serlog_create(struct serlog *log, const char *path, const char *mode,
+		  int baud)
+{
+	int len = strlen(mode);
+
+	if (!(log->f = fopen(path, "wb")))
+		return -1;
+
+	fputs(SERLOG_MAGIC, log->f);
+	putc(SERLOG_VERSION, log->f);
+	putc(len, log->f);
+	fwrite(mode, 1, len, log->f);
+	putc(baud & 0xff, log->f);
+	putc((baud >> 8) & 0xff, log->f);
+	putc((baud >> 16) & 0xff, log->f);
+	putc((baud >> 24) & 0xff, log->f);
+
+	log->last = serlog_now();
+
+	return 0;
+}
+
+void serlog_record(struct serlog *log, int dir, const void *buf, int len,
+		   const void *buf2, int len2)
+{
+	long long now = serlog_now();
+
+	putc(dir, log->f);
+	put_varint(log->f, now - log->last);
+	put_varint(log->f, len + len2);
+	fwrite(buf, 1, len, log->f);
+	if (len2)
+		fwrite(buf2, 1, len2, log->f);
+
+	log->last = now;
+}
+
+int serlog_open(struct serlog *log, const char *path, char *mode, int size,
+		int *baud)
+{
+	unsigned char hdr[6], b[4];
+
+	if (!(log->f = fopen(path, "rb")))
+		return -1;
+
+	if (fread(hdr, 1, 6, log->f) != 6 ||
+	    memcmp(hdr, SERLOG_MAGIC, 4) || hdr[4] != SERLOG_VERSION ||
+	    hdr[5] >= size ||
+	    fread(mode, 1, hdr[5], log->f) != hdr[5] ||
+	    fread(b, 1, 4, log->f) != 4) {
+		fclose(log->f);
+		return -1;
+	}
+
+	mode[hdr[5]] = 0;
+	*baud = b[0] | b[1] << 8 | b[2] << 16 | b[3] << 24;
+
+	return 0;
+}
+
+int serlog_next(struct serlog *log, int *dir, long *delay,
+		unsigned char *buf, int size)
+{
+	unsigned long v, len;
+	int c;
+
+	if ((c = getc(log->f)) == EOF || get_varint(log->f, &v) ||
+	    get_varint(log->f, &len) || len > size ||
+	    fread(buf, 1, len, log->f) != len)
+		return -1;
+
+	*dir = c;
+	*delay = v;
+
+	return len;
+}
+
+int serlog_close(struct serlog *log)
+{
+	int ret = ferror(log->f) ? -1 : 0;
+
+	if (fclose(log->f))
+		ret = -1;
+
+	return ret;
+}
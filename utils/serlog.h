@@ -0,0 +1,63 @@
+/*
+ * Serial session logs.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef __SERLOG_H__
+#define __SERLOG_H__
+
+#include <stdio.h>
+
+/* A log starts with the magic, a version byte, the length of the mode
+   name, the mode name and the baud rate (32 bits, little endian). Then
+   each burst of bytes read from or written to the line is a record:
+   a direction byte, the time since the previous record in us and the
+   length, both as LEB128 varints, and the bytes themselves. */
+#define SERLOG_MAGIC	"SLOG"
+#define SERLOG_VERSION	1
+
+#define SERLOG_RX	0	/* from the device */
+#define SERLOG_TX	1	/* to the device */
+
+struct serlog {
+	FILE *f;
+	long long last;		/* time of the previous record, in us */
+};
+
+/* Creates a log for a session with the given mode and baud rate.
+   Returns -1 on error. */
+int serlog_create(struct serlog *log, const char *path, const char *mode,
+		  int baud);
+
+/* Appends a record of len bytes, in one or two pieces (the second one
+   may be NULL) for the benefit of ring buffers. */
+void serlog_record(struct serlog *log, int dir, const void *buf, int len,
+		   const void *buf2, int len2);
+
+/* Opens a log for reading and returns its mode name (NUL-terminated,
+   in a buffer of size bytes) and baud rate. Returns -1 on error. */
+int serlog_open(struct serlog *log, const char *path, char *mode, int size,
+		int *baud);
+
+/* Reads the next record into buf, which holds size bytes. Returns its
+   length, or -1 at the end of the log or on error. */
+int serlog_next(struct serlog *log, int *dir, long *delay,
+		unsigned char *buf, int size);
+
+/* Flushes and closes the log. Returns -1 if anything failed. */
+int serlog_close(struct serlog *log);
+
+#endif
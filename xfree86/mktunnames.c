@@ -0,0 +1,63 @@
+/** Generates tuntitko-hash.h: the perfect hash tables tunLookUpKey(),
+ * tunLookUpAbsValuator() and tunLookUpRelValuator() find the names of
+ * tuntitko-nametab.h with, in a single probe. They are built as those
+ * of the utilities are, by ../utils/namehash.c.
+ *
+ * A name given twice keeps the id it was first given, as when the
+ * tables were searched in order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "namehash.h"
+#include "tuntitko-nametab.h"
+
+static int
+tunHash (char **names, int n, const char *array, const char *macro)
+{
+  const char **hashed = malloc (n * sizeof (char *));
+  unsigned short *ids = malloc (n * sizeof (unsigned short));
+  struct namehash_table t;
+  int i, j, count = 0, ret;
+
+  for (i = 0; i < n; i++)
+    {
+      if (!names [i])
+	continue;
+      for (j = 0; j < count && strcasecmp (hashed [j], names [i]); j++)
+	;
+      if (j < count)
+	continue;
+      hashed [count] = names [i];
+      ids [count++] = i + 1;
+    }
+
+  ret = namehash_build (&t, hashed, ids, count);
+  if (!ret)
+    {
+      namehash_print (&t, array, macro);
+      namehash_free (&t);
+    }
+
+  free (hashed);
+  free (ids);
+  return ret;
+}
+
+int
+main (void)
+{
+  printf ("/* Generated from tuntitko-nametab.h by mktunnames, do not edit. */\n\n");
+
+  if (tunHash (tun_names_keys, KEY_MAX + 1, "tun_keys", "TUN_KEYS") ||
+      tunHash (tun_names_abs, ABS_MAX + 1, "tun_abs", "TUN_ABS") ||
+      tunHash (tun_names_rel, REL_MAX + 1, "tun_rel", "TUN_REL"))
+    {
+      fprintf (stderr, "mktunnames: can't hash the names\n");
+      return 1;
+    }
+
+  return 0;
+}